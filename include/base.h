@@ -5,6 +5,8 @@
 #ifndef CS430_PROJ3_ILLUMINATION_BASE_H
 #define CS430_PROJ3_ILLUMINATION_BASE_H
 
+#include <stdint.h>
+
 #define false 0
 #define true 1
 #define MAX_SIZE 1024
@@ -12,4 +14,14 @@
 /* variables and types */
 typedef int8_t boolean;
 
+/* floating point type of the scene, intersection and shading math. Building with USE_FLOAT
+ * (and -fsingle-precision-constant so literals follow) gives a single precision renderer */
+#ifdef USE_FLOAT
+typedef float scalar;
+#define SCALAR_ROUNDING 1e-6    // relative rounding error bounds are padded for, a few ulps
+#else
+typedef double scalar;
+#define SCALAR_ROUNDING 1e-9
+#endif
+
 #endif //CS430_PROJ3_ILLUMINATION_BASE_H
@@ -0,0 +1,35 @@
+//
+// Splits one frame over several worker processes and stitches the fragments back together
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_DISTRIBUTED_H
+#define CS430_PROJ3_ILLUMINATION_DISTRIBUTED_H
+
+#include <stdio.h>
+#include "ppmrw.h"
+
+#define MAX_WORKERS 64          // maximum number of worker processes for one frame
+#define BANDS_PER_WORKER 4      // hand out more bands than workers so fast workers pick up slack
+#define COST_SAMPLE_STEP 8      // estimate cost from every Nth row and column
+
+/* rectangle of the full frame (x1 and y1 are exclusive) */
+typedef struct region_t {
+    int x0, y0, x1, y1;
+    double cost;    // estimated intersection tests
+} region;
+
+/* functions */
+int parse_region(char *str, int full_width, int full_height, region *r);
+
+void render_region_to_file(FILE *out, region *r, int full_width, int full_height,
+                           double cam_width, double cam_height);
+
+void serve_regions(FILE *in, FILE *out, int full_width, int full_height,
+                   double cam_width, double cam_height);
+
+size_t distributed_bytes(image *img, double cam_width, double cam_height, int nlocal, int ncmds);
+
+void render_distributed(image *img, double cam_width, double cam_height,
+                        int nlocal, char **worker_cmds, int ncmds);
+
+#endif //CS430_PROJ3_ILLUMINATION_DISTRIBUTED_H
@@ -0,0 +1,50 @@
+//
+// Predicts what a render will cost from scene statistics, without rendering it
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_ESTIMATE_H
+#define CS430_PROJ3_ILLUMINATION_ESTIMATE_H
+
+#include <stdio.h>
+#include "base.h"
+
+#define ESTIMATE_PROBES 16      // the probe rays form an NxN grid over the frame
+
+/* per operation costs, written by the benchmark (cs430_proj3_illumination_bench --calibrate) */
+typedef struct render_costs_t {
+    double pixel_ns;            // primary ray setup and writing the pixel
+    double sphere_ns;           // one ray against one sphere
+    double plane_ns;            // one ray against one plane
+    double shade_point_ns;      // shading a lit point for one point light
+    double shade_spot_ns;       // the same for a spotlight, from inside its cone
+    double scale;               // measured render time over what the costs above add up to
+} render_costs;
+
+/* scene statistics and what they predict for one frame */
+typedef struct render_estimate_t {
+    int width, height;
+    int spheres, planes, instances, members;   // members: objects in the instanced groups
+    int point_lights, spot_lights;
+    double sphere_coverage;     // share of the frame covered by the spheres' projected disks
+    double other_coverage;      // share of the probe rays that show a plane or an instance first
+    double hit_fraction;        // share of the pixels that see an object
+    double cone_coverage;       // share of the visible points inside the spotlights' cones
+    double lit_fraction;        // share of the shadow rays that reach their light
+    double primary_rays;
+    double shadow_rays;
+    double tests;               // ray-object intersection tests
+    int threads;                // render threads or worker processes the frame is split over
+    double seconds;
+} render_estimate;
+
+/* functions */
+int read_render_costs(const char *path, render_costs *costs);
+
+int write_render_costs(const char *path, render_costs *costs);
+
+void estimate_render(int width, int height, scalar cam_width, scalar cam_height, int threads,
+                     render_costs *costs, render_estimate *est);
+
+void print_render_estimate(FILE *out, render_estimate *est);
+
+#endif //CS430_PROJ3_ILLUMINATION_ESTIMATE_H
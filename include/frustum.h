@@ -0,0 +1,41 @@
+//
+// Screen space bounds of primitives and per-tile candidate lists for primary rays
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_FRUSTUM_H
+#define CS430_PROJ3_ILLUMINATION_FRUSTUM_H
+
+#include "ppmrw.h"
+#include "primary.h"
+
+#define CULL_TILE 16        // tiles are CULL_TILE x CULL_TILE pixels
+#define SCREEN_PAD 1        // pixels added around projected bounds to absorb rounding
+
+/* pixel rectangle [x0, x1) x [y0, y1) of the full frame */
+typedef struct screen_rect_t {
+    int x0, y0, x1, y1;
+} screen_rect;
+
+/* candidate spheres for each tile of a region, stored back to back */
+typedef struct tile_bins_t {
+    int tiles_x, tiles_y;
+    int *start;     // tile t's candidates are items[start[t]] .. items[start[t+1]-1]
+    int *items;     // indices into the primary_frame sphere arrays, ascending within a tile
+} tile_bins;
+
+/* functions */
+boolean sphere_screen_rect(scalar *C, scalar r, int full_width, int full_height,
+                           scalar cam_width, scalar cam_height, screen_rect *rect);
+
+void bin_spheres(tile_bins *bins, primary_frame *pf, int width, int height, int full_width, int full_height,
+                 int x0, int y0, scalar cam_width, scalar cam_height);
+
+void free_tile_bins(tile_bins *bins);
+
+size_t culled_region_bytes(int width, int height, int full_width, int full_height,
+                           scalar cam_width, scalar cam_height);
+
+void culled_region(image *img, int full_width, int full_height, int x0, int y0,
+                   scalar cam_width, scalar cam_height);
+
+#endif //CS430_PROJ3_ILLUMINATION_FRUSTUM_H
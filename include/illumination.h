@@ -6,27 +6,58 @@
 #define CS430_PROJ3_ILLUMINATION_ILLUMINATION_H
 
 #include "json.h"
+#include "vector_math.h"
 
 /* function declarations */
-void calculate_diffuse(double *normal_vector,
-                       double *light_vector,
-                       double *light_color,
-                       double *obj_color,
-                       double *out_color);
-
-void calculate_specular(double ns,
-                        double *L,
-                        double *R,
-                        double *N,
-                        double *V,
-                        double *KS,
-                        double *IL,
-                        double *out_color);
-
-double clamp(double color_val);
-
-double calculate_angular_att(Light *light, double direction_to_object[3]);
-
-double calculate_radial_att(Light *light, double distance_to_light);
+void calculate_diffuse(scalar *normal_vector,
+                       scalar *light_vector,
+                       scalar *light_color,
+                       scalar *obj_color,
+                       scalar *out_color);
+
+void calculate_specular(scalar ns,
+                        scalar *L,
+                        scalar *R,
+                        scalar *N,
+                        scalar *V,
+                        scalar *KS,
+                        scalar *IL,
+                        scalar *out_color);
+
+scalar clamp(scalar color_val);
+
+scalar calculate_angular_att(Light *light, scalar direction_to_object[3]);
+
+scalar calculate_radial_att(Light *light, scalar distance_to_light);
+
+void fix_radial_att(Light *light);
+
+/* attenuation kernels for lights prepared by compile_lights, no type checks or fixups */
+
+/**
+ * Radial attenuation with coefficients already fixed up. Same arithmetic as calculate_radial_att
+ * @param light - the light
+ * @param distance_to_light - distance from the point to the light
+ * @return - the attenuation value
+ */
+static inline scalar radial_att(Light *light, scalar distance_to_light) {
+    if (distance_to_light > 99999999999999) return 1.0;
+    scalar dl_sqr = sqr(distance_to_light);
+    scalar denom = light->rad_att2 * dl_sqr + light->rad_att1 * distance_to_light + light->ang_att0;
+    return 1.0 / denom;
+}
+
+/**
+ * Angular attenuation of a spotlight against its precomputed cosine cutoff
+ * @param light - a spotlight
+ * @param direction_to_object - direction vector from the light to the object
+ * @return - the attenuation value
+ */
+static inline scalar spot_angular_att(Light *light, scalar *direction_to_object) {
+    scalar vo_dot_vl = v3_dot(light->direction, direction_to_object);
+    if (vo_dot_vl < light->cos_theta)
+        return 0.0;
+    return pow(vo_dot_vl, light->ang_att0);
+}
 
 #endif //CS430_PROJ3_ILLUMINATION_ILLUMINATION_H
@@ -0,0 +1,26 @@
+//
+// Ray traversal of instanced prototype groups
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_INSTANCE_H
+#define CS430_PROJ3_ILLUMINATION_INSTANCE_H
+
+#include "json.h"
+#include "raycaster.h"
+
+/* the primitive a ray hit inside an instance, and where it sits in the instance hierarchy */
+typedef struct instance_hit_t {
+    int depth;                          // number of entries in path
+    int path[MAX_INSTANCE_DEPTH + 2];   // object index at each level, path[0] indexes objects
+    object leaf;                        // the primitive moved into world space
+    scalar position[3];                 // world space position, leaf points here
+} instance_hit;
+
+/* functions */
+scalar instance_intersect(Ray *ray, Instance *inst, scalar max_t);
+
+void resolve_instance_hit(instance_hit *hit);
+
+void shade_instance(Ray *ray, int obj_index, scalar t, scalar *color);
+
+#endif //CS430_PROJ3_ILLUMINATION_INSTANCE_H
@@ -16,39 +16,59 @@
 #define PLANE 3
 #define LIGHT 4
 #define SPOTLIGHT 5
+#define INSTANCE 6
+#define MAX_PROTOTYPES 64       // maximum number of prototype groups
+#define MAX_INSTANCE_DEPTH 8    // maximum nesting of instances inside prototypes
+#define JSON_ARENA_BLOCK (1 << 16)  // bytes per parsing arena block
 
 // structs to store different types of objects
 typedef struct camera_t {
-    double width;
-    double height;
+    scalar width;
+    scalar height;
+    scalar *position;       // NULL for the origin
+    scalar *direction;      // where it looks, NULL for +z
+    scalar *up;             // NULL for +y
 } Camera;
 
 typedef struct sphere_t {
-    double *diff_color;
-    double *spec_color;
-    double *position;
-    double radius;
+    int material;           // index into materials
+    scalar *position;
+    scalar radius;
 } Sphere;
 
 typedef struct plane_t {
-    double *diff_color;     // diffuse color
-    double *spec_color;     // specular color
-    double *position;
-    double *normal;
+    int material;           // index into materials, same place as the sphere's
+    scalar *position;
+    scalar *normal;
 } Plane;
 
+// a distinct surface material. Objects with the same colors share one entry
+typedef struct material_t {
+    scalar diff_color[3];   // diffuse color
+    scalar spec_color[3];   // specular color
+} Material;
+
 typedef struct light_t {
     int type;
-    double *color;
-    double *position;
-    double *direction;
-    double theta_deg;
-    double rad_att0;
-    double rad_att1;
-    double rad_att2;
-    double ang_att0;
+    scalar *color;
+    scalar *position;
+    scalar *direction;
+    scalar theta_deg;
+    scalar rad_att0;
+    scalar rad_att1;
+    scalar rad_att2;
+    scalar ang_att0;
+    scalar cos_theta;       // cosine of a spotlight's theta, set by compile_lights
 } Light;
 
+// a copy of a prototype group, moved and uniformly scaled. The geometry and materials
+// are the prototype's, only the transform is stored per instance
+typedef struct instance_t {
+    int prototype;          // index into prototypes
+    scalar translate[3];
+    scalar scale;
+} Instance;
+
 // object datatype to store json data
 typedef struct object_t {
     int type;  // -1 so we can check if the object has been populated
@@ -56,20 +76,70 @@ typedef struct object_t {
         Camera camera;
         Sphere sphere;
         Plane plane;
+        Instance instance;
     };
 } object;
 
+// a named group of spheres, planes and instances of earlier groups
+typedef struct prototype_t {
+    char *name;
+    object *objects;        // type 0 terminated like the scene's objects
+    int nobjects;
+    int capacity;
+    int depth;              // levels of instances below this group
+    boolean sealed;         // instanced already, can't take more objects
+    scalar center[3];       // bounding sphere of the group in its own space
+    scalar radius;          // INFINITY if the group holds a plane
+} Prototype;
+
+// one object of the top-level array as parsed, before it's added to the scene
+typedef struct scene_entry_t {
+    int type;               // CAMERA, SPHERE, PLANE, INSTANCE or LIGHT
+    object obj;
+    Light light;
+    scalar diff_color[3];   // interned into materials when the entry is added
+    scalar spec_color[3];
+    boolean has_diff_color;
+    boolean has_spec_color;
+    char *group;            // prototype group the object goes into, NULL for the scene
+    char *prototype;        // group an instance copies, looked up when the entry is added
+    int line;               // line the object ended on
+} scene_entry;
+
+// bump allocator for the vectors of one parsing thread
+typedef struct json_arena_t {
+    char *block;
+    size_t used;
+    size_t size;
+} json_arena;
+
 /* global variables */
-extern int line;
+extern _Thread_local int line;
 extern object objects[MAX_OBJECTS];
 extern Light lights[MAX_OBJECTS];
 extern int nlights;
 extern int nobjects;
+extern Material *materials;
+extern int nmaterials;
+extern Prototype prototypes[MAX_PROTOTYPES];
+extern int nprototypes;
+extern int ninstances;      // instances directly in the scene
 
 /* function definitions */
 void read_json(FILE *json);
+void parse_object(FILE *json, scene_entry *e);
+void add_scene_entry(scene_entry *e);
+void finish_scene();
+void use_json_arena(json_arena *arena);
+void *json_alloc(size_t size);
+void json_free(void *p);
 void init_objects();
 void init_lights();
+void normalize_scene();
+int intern_material(scalar *diff_color, scalar *spec_color);
+int find_prototype(char *name);
+void add_to_prototype(char *name, object *obj);
+void bound_prototype(int k);
 void print_objects(object *obj);
 
 #endif //CS430_PROJ3_ILLUMINATION_JSON_H
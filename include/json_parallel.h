@@ -0,0 +1,24 @@
+//
+// Multi-threaded parsing of the top-level array of a scene file
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_JSON_PARALLEL_H
+#define CS430_PROJ3_ILLUMINATION_JSON_PARALLEL_H
+
+#include <stddef.h>
+
+#define MAX_PARSE_THREADS 64
+
+/* where one object of the top-level array sits in the file */
+typedef struct json_span_t {
+    size_t start;       // offset of its '{'
+    size_t end;         // one past its '}'
+    int line;           // line its '{' is on
+} json_span;
+
+/* functions */
+json_span *scan_top_level(const char *data, size_t length, int *count);
+
+void read_json_parallel(const char *path, int nthreads);
+
+#endif //CS430_PROJ3_ILLUMINATION_JSON_PARALLEL_H
@@ -0,0 +1,18 @@
+//
+// Splats spheres smaller than a pixel instead of ray tracing them
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_LOD_H
+#define CS430_PROJ3_ILLUMINATION_LOD_H
+
+#include "ppmrw.h"
+#include "base.h"
+
+#define DEFAULT_LOD_RADIUS 0.5      // spheres projecting to a smaller radius, in pixels, are splatted
+
+/* functions */
+int split_lod_spheres(int width, int height, scalar cam_width, scalar cam_height, scalar max_radius);
+
+void splat_lod_spheres(image *img, scalar cam_width, scalar cam_height);
+
+#endif //CS430_PROJ3_ILLUMINATION_LOD_H
@@ -0,0 +1,37 @@
+//
+// Allocations tracked by category, with current and peak bytes and an optional hard limit
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_MEMSTATS_H
+#define CS430_PROJ3_ILLUMINATION_MEMSTATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* what the memory is for */
+#define MEM_SCENE 0             // objects, lights, parsed vectors, prototypes, scene snapshots
+#define MEM_MATERIALS 1         // material table
+#define MEM_ACCEL 2             // per frame acceleration data: primary ray tables, tile bins, shadow maps, caches
+#define MEM_FRAMEBUFFER 3       // the frame and images the size of it
+#define MEM_IO 4                // parse spans, row encoding buffers, fragments
+#define MEM_SCRATCH 5           // temporary per tile or per thread buffers
+#define MEM_CATEGORIES 6
+
+/* functions */
+void *mem_alloc(int category, size_t size);
+
+void *mem_calloc(int category, size_t count, size_t size);
+
+void *mem_realloc(int category, void *ptr, size_t size);
+
+void mem_free(void *ptr);
+
+void mem_add(int category, ptrdiff_t bytes);
+
+void mem_check(size_t bytes, const char *what);
+
+void set_mem_limit(size_t bytes);
+
+void print_mem_stats(FILE *out);
+
+#endif //CS430_PROJ3_ILLUMINATION_MEMSTATS_H
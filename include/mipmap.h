@@ -0,0 +1,50 @@
+//
+// Filters the frame down to a pyramid of smaller images while it is being rendered
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_MIPMAP_H
+#define CS430_PROJ3_ILLUMINATION_MIPMAP_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "ppmrw.h"
+#include "writer.h"
+
+#define MAX_MIP_LEVELS 16       // levels below the full frame
+#define MIP_QUEUE_SIZE 64       // bands in flight between renderer and filter thread (power of 2)
+
+/* downsampling filters */
+#define MIP_BOX 0               // average of each 2x2 block
+#define MIP_TENT 1              // 4x4 taps weighted 1 3 3 1, softer and less aliased
+
+/* the levels plus a single producer/single consumer queue of finished bands, like band_writer's */
+typedef struct mip_pyramid_t {
+    int filter;
+    int nlevels;                            // levels below the full frame
+    image levels[MAX_MIP_LEVELS + 1];       // levels[0] is the full frame, each next one half the size
+    int done[MAX_MIP_LEVELS + 1];           // rows of each level filtered so far
+    band queue[MIP_QUEUE_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+    pthread_t thread;
+    band_writer *writer;                    // finished bands also go to this writer thread, if set
+} mip_pyramid;
+
+/* functions */
+int parse_mip_filter(char *str);
+
+int init_mips(mip_pyramid *m, image *img, int nlevels, int filter);
+
+void start_mips(mip_pyramid *m);
+
+void mip_band_done(int y0, int y1, void *arg);
+
+void finish_mips(mip_pyramid *m);
+
+void build_mips(mip_pyramid *m);
+
+int write_mips(mip_pyramid *m, const char *out_path, int format);
+
+void free_mips(mip_pyramid *m);
+
+#endif //CS430_PROJ3_ILLUMINATION_MIPMAP_H
@@ -29,6 +29,35 @@ typedef struct image_t {
     int width, height, max_color_val;
 } image;
 
+// where a fragment sits in a larger frame (x1 and y1 are exclusive)
+typedef struct region_header_t {
+    int x0, y0, x1, y1;
+    int full_width, full_height;
+} region_header;
+
+// output file mapped into memory by map_ppm
+typedef struct ppm_map_t {
+    int fd;
+    void *base;
+    size_t length;
+} ppm_map;
+
+// per channel differences between two images of the same size
+typedef struct image_diff_t {
+    int max_diff;               // largest difference in 8-bit levels
+    double mean_diff;           // mean absolute difference over all channels
+    size_t pixels_differing;    // pixels with any channel different
+    size_t pixels;
+} image_diff;
+
 void print_pixels(RGBPixel *pixmap, int width, int height);
 void create_ppm(FILE *fh, int type, image *img);
+int read_ppm(const char *path, image *img);
+void create_ppm_region(FILE *fh, image *img, int x0, int y0, int full_width, int full_height);
+int read_region_header(FILE *fh, region_header *hdr);
+int read_region_data(FILE *fh, region_header *hdr, image *frame);
+void diff_images(image *a, image *b, image_diff *diff);
+void print_image_diff(FILE *fh, const char *label, image_diff *diff);
+int map_ppm(const char *path, image *img, ppm_map *map);
+int unmap_ppm(ppm_map *map);
 #endif //CS430_PROJ3_ILLUMINATION_PPMRW_H
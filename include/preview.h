@@ -0,0 +1,36 @@
+//
+// Preview renders that trace a subset of the pixels and fill in the rest from their neighbours
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_PREVIEW_H
+#define CS430_PROJ3_ILLUMINATION_PREVIEW_H
+
+#include <stdio.h>
+#include "ppmrw.h"
+#include "base.h"
+
+/* which pixels get traced up front */
+#define PREVIEW_CHECKER 1       // every other pixel in a checkerboard, half of them
+#define PREVIEW_QUARTER 2       // one pixel of every 2x2 block, a quarter of them
+
+#define PREVIEW_DEPTH_RATIO 1.05    // neighbours further apart in depth than this don't blend
+#define PREVIEW_COLOR_SPREAD 24     // nor neighbours whose colours are further apart than this
+
+/* how a preview frame was made */
+typedef struct preview_stats_t {
+    size_t pixels;
+    size_t traced;          // in the first pass
+    size_t filled;          // blended from traced neighbours
+    size_t retraced;        // neighbours disagreed, traced after all
+} preview_stats;
+
+/* functions */
+int parse_preview_mode(char *str);
+
+size_t preview_bytes(image *img);
+
+void preview_scene(image *img, scalar cam_width, scalar cam_height, int mode, preview_stats *stats);
+
+void print_preview_stats(FILE *out, int mode, preview_stats *stats);
+
+#endif //CS430_PROJ3_ILLUMINATION_PREVIEW_H
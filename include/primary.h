@@ -0,0 +1,67 @@
+//
+// Primary visibility with per-frame constants. Every primary ray starts at the camera at the
+// origin, so everything that only depends on the ray origin is computed once per frame
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_PRIMARY_H
+#define CS430_PROJ3_ILLUMINATION_PRIMARY_H
+
+#include <math.h>
+#include "ppmrw.h"
+#include "base.h"
+
+/* per-frame object constants and per-row/per-column ray direction components */
+typedef struct primary_frame_t {
+    int nspheres;
+    int *sphere_idx;            // index in objects
+    scalar *sx, *sy, *sz;       // origin - center
+    scalar *sc;                 // |origin - center|^2 - r^2
+    int nplanes;
+    int *plane_idx;
+    scalar *nx, *ny, *nz;       // unit normal
+    scalar *pn;                 // (position - origin) . normal
+    int width, height;
+    scalar *col_x, *col_x2;     // unnormalized direction x (and its square) for each column
+    scalar *row_y, *row_y2;     // unnormalized direction y (and its square) for each row
+} primary_frame;
+
+/* distance along primary ray direction d to sphere k of the frame, -1 for a miss */
+static inline scalar primary_sphere_t(primary_frame *pf, int k, scalar *d) {
+    scalar b = 2 * (d[0]*pf->sx[k] + d[1]*pf->sy[k] + d[2]*pf->sz[k]);
+    scalar disc = b*b - 4*pf->sc[k];
+    if (disc < 0)
+        return -1;
+    disc = sqrt(disc);
+    scalar t = (-b - disc) / 2.0;
+    if (t < 0.0)
+        t = (-b + disc) / 2.0;
+    return t;
+}
+
+/* distance along primary ray direction d to plane k of the frame, -1 if they are parallel */
+static inline scalar primary_plane_t(primary_frame *pf, int k, scalar *d) {
+    scalar vd = pf->nx[k]*d[0] + pf->ny[k]*d[1] + pf->nz[k]*d[2];
+    if (fabs(vd) < 0.0001)
+        return -1;
+    return pf->pn[k] / vd;
+}
+
+/* functions */
+void prepare_primary_frame(primary_frame *pf, int width, int height, int full_width, int full_height,
+                           int x0, int y0, scalar cam_width, scalar cam_height);
+
+void free_primary_frame(primary_frame *pf);
+
+size_t primary_frame_bytes(int width, int height);
+
+void primary_ray_dir(primary_frame *pf, int i, int j, scalar *direction);
+
+void primary_closest_subset(primary_frame *pf, scalar *direction, int *spheres, int nspheres,
+                            int *ret_index, scalar *ret_best_t);
+
+void primary_closest(primary_frame *pf, scalar *direction, int *ret_index, scalar *ret_best_t);
+
+void primary_region(image *img, int full_width, int full_height, int x0, int y0,
+                    scalar cam_width, scalar cam_height);
+
+#endif //CS430_PROJ3_ILLUMINATION_PRIMARY_H
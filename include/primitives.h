@@ -0,0 +1,91 @@
+//
+// The scene's primitives sorted into buckets by kind, each with its own intersection kernel
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_PRIMITIVES_H
+#define CS430_PROJ3_ILLUMINATION_PRIMITIVES_H
+
+#include <math.h>
+#include "json.h"
+#include "raycaster.h"
+#include "base.h"
+
+/* spheres, with the squared radius the intersection needs instead of the radius */
+typedef struct sphere_bucket_t {
+    int count;
+    int index[MAX_OBJECTS];     // index in objects
+    scalar cx[MAX_OBJECTS], cy[MAX_OBJECTS], cz[MAX_OBJECTS];
+    scalar r2[MAX_OBJECTS];
+} sphere_bucket;
+
+/* planes whose unit normal is +-x, +-y or +-z */
+typedef struct axis_plane_bucket_t {
+    int count;
+    int index[MAX_OBJECTS];
+    int axis[MAX_OBJECTS];      // 0, 1 or 2
+    scalar offset[MAX_OBJECTS]; // position[axis]
+} axis_plane_bucket;
+
+/* any other plane */
+typedef struct plane_bucket_t {
+    int count;
+    int index[MAX_OBJECTS];
+    scalar px[MAX_OBJECTS], py[MAX_OBJECTS], pz[MAX_OBJECTS];
+    scalar nx[MAX_OBJECTS], ny[MAX_OBJECTS], nz[MAX_OBJECTS];
+} plane_bucket;
+
+typedef struct primitive_buckets_t {
+    boolean usable;             // false when the scene has instances, they go through objects
+    sphere_bucket spheres;
+    axis_plane_bucket axis_planes;
+    plane_bucket planes;
+} primitive_buckets;
+
+/**
+ * sphere_intersect with the squared radius precomputed, -1 for a miss
+ * @param o - ray origin
+ * @param d - ray direction (unit)
+ */
+static inline scalar sphere_r2_intersect(scalar *o, scalar *d, scalar cx, scalar cy, scalar cz, scalar r2) {
+    scalar vx = o[0] - cx, vy = o[1] - cy, vz = o[2] - cz;
+    scalar b = 2 * (d[0]*vx + d[1]*vy + d[2]*vz);
+    scalar c = vx*vx + vy*vy + vz*vz - r2;
+    scalar disc = b*b - 4*c;
+    if (disc < 0)
+        return -1;
+    disc = sqrt(disc);
+    scalar t = (-b - disc) / 2.0;
+    if (t < 0.0)
+        t = (-b + disc) / 2.0;
+    if (t < 0.0)
+        return -1;
+    return t;
+}
+
+/**
+ * plane_intersect for a plane with normal +-axis. The dot products with the normal reduce to
+ * one component each, and the normal's sign cancels, so this is one subtraction and one divide
+ * @param o - ray origin
+ * @param d - ray direction
+ * @param axis - 0, 1 or 2
+ * @param offset - the plane's position along the axis
+ */
+static inline scalar axis_plane_intersect(scalar *o, scalar *d, int axis, scalar offset) {
+    scalar vd = d[axis];
+    if (fabs(vd) < 0.0001)
+        return -1;
+    scalar t = (offset - o[axis]) / vd;
+    if (t < 0.0)
+        return -1;
+    return t;
+}
+
+/* global variables */
+extern primitive_buckets primitives;
+
+/* functions */
+void compile_primitives();
+
+void closest_primitive(Ray *ray, int self_index, scalar max_distance, int *ret_index, scalar *ret_best_t);
+
+#endif //CS430_PROJ3_ILLUMINATION_PRIMITIVES_H
@@ -0,0 +1,19 @@
+//
+// Hybrid renderer: rasterizes primary visibility into a depth/ID buffer, ray traces shading
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_RASTER_H
+#define CS430_PROJ3_ILLUMINATION_RASTER_H
+
+#include "ppmrw.h"
+#include "base.h"
+
+#define RASTER_TILE 32      // tiles are RASTER_TILE x RASTER_TILE pixels
+
+/* functions */
+size_t raster_region_bytes(int width, int height);
+
+void raster_region(image *img, int full_width, int full_height, int x0, int y0,
+                   scalar cam_width, scalar cam_height);
+
+#endif //CS430_PROJ3_ILLUMINATION_RASTER_H
@@ -14,14 +14,94 @@
 
 #define MAX_COLOR_VAL 255   // maximum color to support for RGB
 
+/* renderers raycast_region can use */
+#define ENGINE_SCALAR 0     // one pixel at a time, shadow rays inline
+#define ENGINE_WAVEFRONT 1  // one tile at a time, each stage in bulk (wavefront.c)
+#define ENGINE_PRIMARY 2    // per-frame constants for primary rays (primary.c)
+#define ENGINE_CULLED 3     // ENGINE_PRIMARY with per-tile sphere lists (frustum.c)
+#define ENGINE_RASTER 4     // rasterized primary visibility, ray traced shading (raster.c)
+
+/* shadow rays are tested from this fraction of the hit distance towards the light. In single
+ * precision a hit point where two surfaces meet can round to just behind one of them, and its
+ * shadow ray would hit that surface straight away. Double precision doesn't need it */
+#ifdef USE_FLOAT
+#define SHADOW_OFFSET 1e-4
+#else
+#define SHADOW_OFFSET 0
+#endif
+
 /* custom types */
 typedef struct ray_t {
-    double origin[3];
-    double direction[3];
+    scalar origin[3];
+    scalar direction[3];
 } Ray;
 
+/* called when rows [y0, y1) of the image are finished */
+typedef void (*band_callback)(int y0, int y1, void *arg);
+
+/* adds one light's contribution to a point that sees the given fraction of it */
+typedef void (*light_kernel)(Ray *ray, object *obj, Ray *shadow_ray, scalar distance_to_light,
+                             Light *light, scalar visibility, scalar *color);
+
+/* consecutive lights of one type, shaded by the kernel built for that type */
+typedef struct light_run_t {
+    int first;              // index in lights of the first light
+    int end;                // one past the last light
+    light_kernel shade;
+} light_run;
+
+/**
+ * Moves the origin of a shadow ray SHADOW_OFFSET of the hit distance towards the light.
+ * Only the shadow test uses the moved ray, shading still starts at the hit point
+ * @param shadow_ray - ray from the hit point towards the light
+ * @param t - distance to the hit point along the primary ray
+ * @param distance_to_light - shortened by the same amount
+ */
+static inline void offset_shadow_ray(Ray *shadow_ray, scalar t, scalar *distance_to_light) {
+    if (SHADOW_OFFSET == 0)
+        return;
+    scalar eps = SHADOW_OFFSET * t;
+    for (int k=0; k<3; k++)
+        shadow_ray->origin[k] += eps * shadow_ray->direction[k];
+    *distance_to_light -= eps;
+}
+
+/* global variables */
+extern scalar background_color[3];
+extern int render_engine;
+extern light_run light_runs[MAX_OBJECTS];
+extern int nlight_runs;
+
 /* functions */
-void raycast_scene(image*, double, double, object*);
+int parse_engine(char*);
+
+void raycast_scene(image*, scalar, scalar, object*);
+
+void raycast_region(image*, int, int, int, int, scalar, scalar, object*);
+
+size_t region_bytes(int, int, int, int, scalar, scalar);
+
+void raycast_scene_bands(image*, scalar, scalar, object*, int, band_callback, void*);
+
+void get_primary_ray_dir(int, int, int, int, scalar, scalar, scalar*);
+
+double estimate_pixel_cost(int, int, int, int, scalar, scalar);
+
+void set_pixel_color(scalar*, int, int, image*);
+
+void compile_lights();
+
+void shade_point_light(Ray*, object*, Ray*, scalar, Light*, scalar, scalar*);
+
+void shade_spot_light(Ray*, object*, Ray*, scalar, Light*, scalar, scalar*);
+
+void shade(Ray*, int, scalar, scalar*);
+
+void get_dist_and_idx_closest_obj(Ray*, int, scalar, int*, scalar*);
+
+scalar sphere_intersect(Ray*, scalar*, scalar);
+
+scalar plane_intersect(Ray*, scalar*, scalar*);
 
 int get_camera(object*);
 #endif //CS430_PROJ3_ILLUMINATION_RAYCASTER_H
@@ -0,0 +1,55 @@
+//
+// Snapshots of the parsed scene and what changed between two of them
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_SCENE_DIFF_H
+#define CS430_PROJ3_ILLUMINATION_SCENE_DIFF_H
+
+#include "json.h"
+
+#define MAX_DIFF_BOUNDS (2 * MAX_OBJECTS)   // every object before and after the change
+
+/* everything the renderer reads from one parse of the scene */
+typedef struct scene_snapshot_t {
+    object objects[MAX_OBJECTS];
+    int nobjects;
+    Light lights[MAX_OBJECTS];
+    int nlights;
+    Material *materials;
+    int nmaterials;
+    Prototype prototypes[MAX_PROTOTYPES];
+    int nprototypes;
+} scene_snapshot;
+
+/* world space bounding sphere of something that changed between two parses */
+typedef struct diff_bound_t {
+    scalar center[3];
+    scalar radius;          // INFINITY when it can't be bounded (planes)
+} diff_bound;
+
+/* what changed between two versions of the scene */
+typedef struct scene_diff_t {
+    boolean everything;         // the camera or something unbounded (a plane) changed
+    boolean light_count_changed;
+    boolean light_changed[MAX_OBJECTS];     // by index, when the count is the same
+    int nchanged_lights;
+    int prefix;                 // objects before this index are unchanged
+    int shift;                  // how far the unchanged objects after the changed run moved
+    diff_bound bounds[MAX_DIFF_BOUNDS];     // changed objects before and after
+    int nbounds;
+} scene_diff;
+
+/* functions */
+void take_snapshot(scene_snapshot *s, boolean copy_materials);
+
+void free_snapshot(scene_snapshot *s);
+
+void reparse_scene(FILE *json, scene_snapshot *old, scene_snapshot *cur);
+
+void diff_scenes(scene_snapshot *old, scene_snapshot *cur, scene_diff *diff);
+
+boolean segment_hits_bound(scalar *p, scalar *d, scalar len, diff_bound *bound);
+
+boolean ray_hits_changed(scalar *origin, scalar *d, scalar len, scene_diff *diff);
+
+#endif //CS430_PROJ3_ILLUMINATION_SCENE_DIFF_H
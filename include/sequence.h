@@ -0,0 +1,34 @@
+//
+// Renders numbered sequences of scene files, reusing what each pixel saw in the frame before
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_SEQUENCE_H
+#define CS430_PROJ3_ILLUMINATION_SEQUENCE_H
+
+#include "ppmrw.h"
+
+#define MAX_FRAME_PATH 4096
+
+/* what every pixel saw in the previous frame */
+typedef struct frame_cache_t {
+    int *obj;               // object the primary ray hit, -1 for the background
+    scalar *t;              // distance to the hit
+    unsigned char *visible; // per pixel and light, whether the shadow ray reached the light
+    int nlights;            // lights visible has room for
+} frame_cache;
+
+/* how much of a frame came from the cache */
+typedef struct reuse_stats_t {
+    size_t pixels;
+    size_t primary_reused;
+    size_t shadow_rays;
+    size_t shadow_reused;
+} reuse_stats;
+
+/* functions */
+int check_frame_pattern(const char *pattern);
+
+void render_sequence(const char *scene_pattern, const char *out_pattern, int frames, int format,
+                     image *img, int shadow_res, int pcf);
+
+#endif //CS430_PROJ3_ILLUMINATION_SEQUENCE_H
@@ -0,0 +1,41 @@
+//
+// Shadow map approximation of shadow rays for point lights and spotlights
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_SHADOWMAP_H
+#define CS430_PROJ3_ILLUMINATION_SHADOWMAP_H
+
+#include "base.h"
+
+#define SHADOW_CUBE 1           // point light: six faces around the light
+#define SHADOW_SPOT 2           // spotlight: one face covering the cone
+#define SHADOW_MAX_SPOT_DEG 75  // wider spotlights get a cube map
+#define SHADOW_BIAS_TEXELS 1.0  // depth bias in texel footprints at the receiver's distance
+#define DEFAULT_SHADOW_RES 256
+#define DEFAULT_SHADOW_PCF 1    // PCF kernel width in texels (1 = no filtering)
+
+/* one light's depth map: distance from the light to the closest object through each texel */
+typedef struct shadow_map_t {
+    int kind;
+    int res;
+    int faces;
+    scalar *depth;          // faces * res * res
+    int *id;                // closest object through each texel, -1 for none
+    scalar tan_half;        // half field of view of a face, as a tangent
+    scalar forward[3];      // spotlight orientation
+    scalar right[3];
+    scalar up[3];
+} shadow_map;
+
+/* global variables */
+extern shadow_map *shadow_maps;     // one per light, NULL when shadows are ray traced
+extern int shadow_pcf;
+
+/* functions */
+void build_shadow_maps(int res, int pcf);
+
+void free_shadow_maps();
+
+scalar shadow_map_visibility(int light_index, int obj_index, scalar *point, scalar distance_to_light);
+
+#endif //CS430_PROJ3_ILLUMINATION_SHADOWMAP_H
@@ -0,0 +1,66 @@
+//
+// Renders the frame (or several views) in tiles on a pool of threads, with the tile size and
+// order tuned per scene
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_TILES_H
+#define CS430_PROJ3_ILLUMINATION_TILES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ppmrw.h"
+#include "views.h"
+#include "base.h"
+
+#define MAX_RENDER_THREADS 64
+#define DEFAULT_TILE_SIZE 32
+#define DEFAULT_TILE_CACHE ".tile_tuning"   // where tuned plans are kept, one line per scene
+#define TUNE_WINDOW 64          // tuning samples windows this size, every candidate size divides it
+#define TUNE_STRIDE 16          // tuning renders about one window in N
+#define TUNE_MAX_SHARE 4        // and never more than one in N, smaller frames aren't tuned
+
+/* the order threads take tiles in */
+#define TILE_SCANLINE 0         // rows of tiles, left to right
+#define TILE_MORTON 1           // Z order curve
+#define TILE_HILBERT 2          // Hilbert curve, neighbouring tiles stay close together
+#define TILE_CENTER 3           // nearest the middle of the frame first
+#define TILE_ORDERS 4
+
+/* how a frame is split up and handed out */
+typedef struct tile_plan_t {
+    int size;                   // tiles are size x size pixels
+    int order;                  // TILE_ constant
+} tile_plan;
+
+/* what a tuned plan is reused for, anything that changes the cost of a pixel */
+typedef struct tune_key_t {
+    uint64_t scene;             // hash_scene_file of the scene
+    int width, height;
+    int threads;
+    int engine;                 // ENGINE_ constant
+    int shadow_res;             // shadow map resolution, 0 without shadow maps
+    int pcf;                    // shadow map filter taps
+    boolean fast_math;
+    double lod_radius;          // 0 without level of detail
+} tune_key;
+
+/* functions */
+int parse_tile_order(char *str);
+
+const char *tile_order_name(int order);
+
+void render_tiles(image *img, scalar cam_width, scalar cam_height, int threads, tile_plan *plan);
+
+void render_view_tiles(image *imgs, view *views, int nviews, int threads, tile_plan *plan);
+
+size_t tile_render_bytes(image *img, int nviews, scalar cam_width, scalar cam_height, int threads, tile_plan *plan);
+
+double autotune_tiles(image *img, scalar cam_width, scalar cam_height, int threads, tile_plan *best);
+
+uint64_t hash_scene_file(const char *path);
+
+int load_tile_plan(const char *cache_path, tune_key *key, tile_plan *plan);
+
+int save_tile_plan(const char *cache_path, tune_key *key, tile_plan *plan);
+
+#endif //CS430_PROJ3_ILLUMINATION_TILES_H
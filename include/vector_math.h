@@ -6,13 +6,17 @@
 #define CS430_PROJ3_ILLUMINATION_VECTOR_MATH_H
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <tgmath.h>     // math functions follow scalar, sqrtf and friends in a float build
+#include "base.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 
-typedef double V3[3];   // represents a 3d vector
+typedef scalar V3[3];   // represents a 3d vector
 
 
-static inline double sqr(double v) {
+static inline scalar sqr(scalar v) {
     return v*v;
 }
 
@@ -28,15 +32,79 @@ static inline void v3_copy(V3 from, V3 to) {
     to[2] = from[2];
 }
 
-static inline void normalize(double *v) {
-    double len = sqr(v[0]) + sqr(v[1]) + sqr(v[2]);
+/* set by --fast-math: normalize and specular highlights use the approximations below instead
+ * of sqrt, pow and divisions. Lengths and sphere intersections keep sqrt, a lone square root
+ * is quicker than the estimate and its Newton step in double precision. Scene data is still
+ * set up exactly (finish_scene), only rendering approximates */
+extern boolean fast_math;
+
+/**
+ * Approximate 1/sqrt(x) for x > 0: the hardware estimate (12 bits) refined with one Newton
+ * step to about 22 bits. Without SSE a bit trick guess takes two steps to get there
+ */
+static inline scalar fast_rsqrt(scalar x) {
+#ifdef __SSE__
+    scalar y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss((float)x)));
+#else
+    union { float f; uint32_t u; } bits = {.f = (float)x};
+    bits.u = 0x5f375a86 - (bits.u >> 1);
+    scalar y = bits.f;
+    y = y * (1.5 - 0.5 * x * y * y);
+#endif
+    return y * (1.5 - 0.5 * x * y * y);
+}
+
+/* approximate log2(x) for normal x > 0 from the exponent bits and a short series on the mantissa */
+static inline double fast_log2(double x) {
+    union { double d; uint64_t u; } bits = {.d = x};
+    int e = (int)((bits.u >> 52) & 0x7ff) - 1023;
+    bits.u = (bits.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;   // mantissa in [1, 2)
+    double m = bits.d;
+    if (m > M_SQRT2) {
+        m *= 0.5;       // [sqrt(1/2), sqrt(2)) keeps t small
+        e++;
+    }
+    // log2(m) = 2/ln2 * (t + t^3/3 + t^5/5 + ...) with t = (m-1)/(m+1), |t| < 0.18
+    double t = (m - 1) / (m + 1);
+    double t2 = t*t;
+    return e + t * (2.8853900817779268 + t2 * (0.9617966939259756 + t2 * 0.5770780163555854));
+}
+
+/* approximate 2^y: the integer part goes straight into the exponent bits, a polynomial does the rest */
+static inline double fast_exp2(double y) {
+    if (y < -1022)
+        return 0;
+    if (y > 1023)
+        return INFINITY;
+    double n = floor(y + 0.5);
+    double f = (y - n) * M_LN2;     // |f| <= ln2/2, e^f to the f^5 term is good to 3e-6
+    double p = 1 + f*(1 + f*(1.0/2 + f*(1.0/6 + f*(1.0/24 + f*(1.0/120)))));
+    union { double d; uint64_t u; } bits = {.u = (uint64_t)((int64_t)n + 1023) << 52};
+    return p * bits.d;
+}
+
+/* approximate x^p for x > 0 */
+static inline scalar fast_pow(scalar x, scalar p) {
+    return fast_exp2(p * fast_log2(x));
+}
+
+static inline void normalize(scalar *v) {
+    scalar len = sqr(v[0]) + sqr(v[1]) + sqr(v[2]);
+    if (fast_math) {
+        // one reciprocal square root and three multiplies instead of a sqrt and three divisions
+        scalar inv = fast_rsqrt(len);
+        v[0] *= inv;
+        v[1] *= inv;
+        v[2] *= inv;
+        return;
+    }
     len = sqrt(len);
     v[0] /= len;
     v[1] /= len;
     v[2] /= len;
 }
 
-static inline double v3_len(V3 a) {
+static inline scalar v3_len(V3 a) {
     return sqrt(sqr(a[0]) + sqr(a[1]) + sqr(a[2]));
 }
 
@@ -52,13 +120,13 @@ static inline void v3_sub(V3 a, V3 b, V3 c) {
     c[2] = a[2] - b[2];
 }
 
-static inline void v3_scale(V3 a, double s, V3 b) {
+static inline void v3_scale(V3 a, scalar s, V3 b) {
     b[0] = s * a[0];
     b[1] = s * a[1];
     b[2] = s * a[2];
 }
 
-static inline double v3_dot(V3 a, V3 b) {
+static inline scalar v3_dot(V3 a, V3 b) {
     return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
 }
 
@@ -70,9 +138,9 @@ static inline void v3_cross(V3 a, V3 b, V3 c) {
 
 static inline void v3_reflect(V3 v, V3 n, V3 v_r) {
     normalize(n);
-    double scalar = 2.0 * v3_dot(n, v);
+    scalar proj = 2.0 * v3_dot(n, v);
     V3 tmp_vector;
-    v3_scale(n, scalar, tmp_vector);
+    v3_scale(n, proj, tmp_vector);
     v3_sub(v, tmp_vector, v_r);
 }
 
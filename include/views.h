@@ -0,0 +1,35 @@
+//
+// Renders the scene from every camera in it, e.g. stereo pairs, cube maps and camera arrays
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_VIEWS_H
+#define CS430_PROJ3_ILLUMINATION_VIEWS_H
+
+#include <stdio.h>
+#include "ppmrw.h"
+#include "json.h"
+#include "raycaster.h"
+#include "base.h"
+
+#define MAX_VIEWS 64
+
+/* one camera, ready to make primary rays */
+typedef struct view_t {
+    int camera;                 // index in objects
+    scalar cam_width, cam_height;
+    scalar origin[3];
+    scalar right[3], up[3], forward[3];     // unit basis, +x +y +z of the camera's space
+} view;
+
+/* functions */
+boolean camera_is_posed(object *camera);
+
+int find_views(view *views, int max_views);
+
+void view_ray(view *v, int row, int col, int full_width, int full_height, Ray *ray);
+
+void render_view_region(image *img, view *v, int full_width, int full_height, int x0, int y0);
+
+int write_views(image *imgs, int nviews, const char *out_path, int format);
+
+#endif //CS430_PROJ3_ILLUMINATION_VIEWS_H
@@ -0,0 +1,17 @@
+//
+// Watches the scene file and re-renders only what an edit can have changed
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_WATCH_H
+#define CS430_PROJ3_ILLUMINATION_WATCH_H
+
+#include "ppmrw.h"
+
+#define WATCH_POLL_MS 250       // how often the scene file is checked for changes
+#define WATCH_TILE 16           // screen tiles are re-rendered whole
+
+/* functions */
+void watch_scene(const char *scene_path, const char *out_path, int format, image *img,
+                 int shadow_res, int pcf);
+
+#endif //CS430_PROJ3_ILLUMINATION_WATCH_H
@@ -0,0 +1,30 @@
+//
+// Wavefront renderer: processes a whole tile of rays per stage instead of one pixel at a time
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_WAVEFRONT_H
+#define CS430_PROJ3_ILLUMINATION_WAVEFRONT_H
+
+#include "ppmrw.h"
+#include "base.h"
+
+#define WAVEFRONT_TILE 32   // tiles are WAVEFRONT_TILE x WAVEFRONT_TILE pixels
+
+/* structure of arrays ray buffer, entry k of every array belongs to ray k */
+typedef struct ray_batch_t {
+    int count;
+    scalar *ox, *oy, *oz;   // origin
+    scalar *dx, *dy, *dz;   // direction
+    scalar *max_t;          // don't care about hits past this distance
+    scalar *t;              // closest hit distance
+    int *obj;               // closest hit object (-1 for none), or the object a shadow ray leaves
+    int *pixel;             // pixel (primary) or hit (shadow) the ray belongs to
+} ray_batch;
+
+/* functions */
+size_t wavefront_region_bytes();
+
+void wavefront_region(image *img, int full_width, int full_height, int x0, int y0,
+                      scalar cam_width, scalar cam_height);
+
+#endif //CS430_PROJ3_ILLUMINATION_WAVEFRONT_H
@@ -0,0 +1,63 @@
+//
+// Writes finished row bands of an image on its own thread while rendering continues
+//
+
+#ifndef CS430_PROJ3_ILLUMINATION_WRITER_H
+#define CS430_PROJ3_ILLUMINATION_WRITER_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "ppmrw.h"
+
+#define FORMAT_P3 3
+#define FORMAT_P6 6
+#define FORMAT_P6_GZ 7          // gzip compressed P6 (needs zlib)
+
+#define WRITER_QUEUE_SIZE 64    // bands in flight between renderer and writer (power of 2)
+#define WRITER_BAND_ROWS 16     // rows the renderer finishes before handing them off
+
+/* rows [y0, y1) of the image are done. y0 < 0 tells the writer to stop */
+typedef struct band_t {
+    int y0, y1;
+} band;
+
+/* encoder state plus a single producer/single consumer lock-free queue of finished bands */
+typedef struct band_writer_t {
+    int format;
+    image *img;
+    FILE *fh;
+#ifdef HAVE_ZLIB
+    gzFile gz;
+#endif
+    unsigned char *row_buf;     // one row packed as bytes
+    band queue[WRITER_QUEUE_SIZE];
+    atomic_size_t head;         // next band the writer takes
+    atomic_size_t tail;         // next free slot for the renderer
+    pthread_t thread;
+    int error;
+} band_writer;
+
+/* functions */
+int parse_format(char *str);
+
+int open_writer(band_writer *w, const char *path, int format, image *img);
+
+void write_band(band_writer *w, int y0, int y1);
+
+int close_writer(band_writer *w);
+
+int write_numbered(image *imgs, int count, const char *out_path, const char *suffix, int first, int format);
+
+void start_writer(band_writer *w);
+
+void push_band(band_writer *w, int y0, int y1);
+
+int finish_writer(band_writer *w);
+
+void band_done(int y0, int y1, void *arg);
+
+#endif //CS430_PROJ3_ILLUMINATION_WRITER_H
@@ -0,0 +1,515 @@
+/** kernel micro-benchmark entry point
+ *  Author: Michael Gilbert
+ *
+ *  runs the intersection, shading and vector math kernels in isolation over large
+ *  randomized batches of rays and primitives and reports ns/op and ops/cycle */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "../include/json.h"
+#include "../include/vector_math.h"
+#include "../include/raycaster.h"
+#include "../include/illumination.h"
+#include "../include/estimate.h"
+#include "../include/primitives.h"
+#include "../include/base.h"
+
+#define DEFAULT_BATCH 65536         // rays/primitives per batch
+#define DEFAULT_ITERATIONS 64       // passes over each batch
+#define SHININESS 20                // same shininess the renderer uses
+#define CALIBRATION_SIZE 200        // width and height of the calibration render
+#define CALIBRATION_RUNS 3          // the calibration render is timed this many times, best one counts
+
+/* scene rendered by --calibrate to fit the estimator's scale: a box of planes, spheres of
+ * several sizes, point lights and a spotlight */
+static const char *calibration_scene =
+        "[{\"type\": \"camera\", \"width\": 1.0, \"height\": 1.0},"
+        " {\"type\": \"plane\", \"position\": [0, -2, 0], \"normal\": [0, 1, 0],"
+        "  \"diffuse_color\": [0.6, 0.6, 0.6], \"specular_color\": [0.1, 0.1, 0.1]},"
+        " {\"type\": \"plane\", \"position\": [0, 0, 30], \"normal\": [0, 0, -1],"
+        "  \"diffuse_color\": [0.3, 0.3, 0.8], \"specular_color\": [0.1, 0.1, 0.1]},"
+        " {\"type\": \"sphere\", \"position\": [0, 0, 10], \"radius\": 2,"
+        "  \"diffuse_color\": [0.9, 0.2, 0.2], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"sphere\", \"position\": [-4, -1, 14], \"radius\": 1,"
+        "  \"diffuse_color\": [0.2, 0.9, 0.2], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"sphere\", \"position\": [4, -1, 12], \"radius\": 1,"
+        "  \"diffuse_color\": [0.2, 0.2, 0.9], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"sphere\", \"position\": [2, 3, 18], \"radius\": 0.5,"
+        "  \"diffuse_color\": [0.9, 0.9, 0.2], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"sphere\", \"position\": [-2, 2, 8], \"radius\": 0.3,"
+        "  \"diffuse_color\": [0.9, 0.2, 0.9], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"sphere\", \"position\": [0, -1.5, 6], \"radius\": 0.5,"
+        "  \"diffuse_color\": [0.2, 0.9, 0.9], \"specular_color\": [0.5, 0.5, 0.5]},"
+        " {\"type\": \"light\", \"color\": [2, 2, 2], \"position\": [5, 8, 0],"
+        "  \"radial-a2\": 0.01, \"radial-a1\": 0.01, \"radial-a0\": 0.5},"
+        " {\"type\": \"light\", \"color\": [1, 1, 1], \"position\": [-6, 4, 6],"
+        "  \"radial-a2\": 0.01, \"radial-a1\": 0.01, \"radial-a0\": 0.5},"
+        " {\"type\": \"light\", \"color\": [3, 3, 3], \"position\": [0, 6, 10], \"direction\": [0, -1, 0],"
+        "  \"theta\": 30, \"angular-a0\": 2, \"radial-a2\": 0.01, \"radial-a1\": 0.01, \"radial-a0\": 0.5}]";
+
+/* every kernel result is folded in here so the compiler can't throw the work away */
+volatile double sink = 0;
+
+/* all randomized inputs for one run. Index i of each array belongs together */
+typedef struct bench_data_t {
+    int n;
+    Ray *rays;
+    V3 *centers;        // sphere centers
+    double *radii;
+    V3 *plane_pos;
+    V3 *plane_norm;
+    V3 *normals;        // unit surface normals
+    V3 *to_light;       // unit vectors from surface to light
+    V3 *reflected;      // to_light reflected about normal
+    V3 *view;           // unit vectors towards the camera
+    V3 *obj_color;
+    V3 *light_color;
+    Light *lights;      // mix of point lights and spotlights
+    double *distances;  // distance to the light
+} bench_data;
+
+typedef double (*kernel_fn)(bench_data*);
+
+/* xorshift64* -- fixed seed so every run sees the same batches */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static double rand_unit() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static double rand_range(double lo, double hi) {
+    return lo + (hi - lo) * rand_unit();
+}
+
+static void rand_dir(V3 v) {
+    do {
+        v[0] = rand_range(-1, 1);
+        v[1] = rand_range(-1, 1);
+        v[2] = rand_range(-1, 1);
+    } while (v3_len(v) < 0.001);
+    normalize(v);
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Allocates and fills a batch with random rays and primitives. Rays start near the
+ * origin and point roughly down +z like primary rays do, so a good share of them hit.
+ * @param d - batch to fill
+ * @param n - number of entries in each array
+ */
+void fill_bench_data(bench_data *d, int n) {
+    d->n = n;
+    d->rays = malloc(sizeof(Ray) * n);
+    d->centers = malloc(sizeof(V3) * n);
+    d->radii = malloc(sizeof(double) * n);
+    d->plane_pos = malloc(sizeof(V3) * n);
+    d->plane_norm = malloc(sizeof(V3) * n);
+    d->normals = malloc(sizeof(V3) * n);
+    d->to_light = malloc(sizeof(V3) * n);
+    d->reflected = malloc(sizeof(V3) * n);
+    d->view = malloc(sizeof(V3) * n);
+    d->obj_color = malloc(sizeof(V3) * n);
+    d->light_color = malloc(sizeof(V3) * n);
+    d->lights = calloc(n, sizeof(Light));
+    d->distances = malloc(sizeof(double) * n);
+    if (d->rays == NULL || d->centers == NULL || d->radii == NULL || d->plane_pos == NULL ||
+        d->plane_norm == NULL || d->normals == NULL || d->to_light == NULL || d->reflected == NULL ||
+        d->view == NULL || d->obj_color == NULL || d->light_color == NULL || d->lights == NULL ||
+        d->distances == NULL) {
+        fprintf(stderr, "Error: fill_bench_data: Out of memory\n");
+        exit(1);
+    }
+
+    for (int i=0; i<n; i++) {
+        d->rays[i].origin[0] = rand_range(-0.5, 0.5);
+        d->rays[i].origin[1] = rand_range(-0.5, 0.5);
+        d->rays[i].origin[2] = rand_range(-0.5, 0.5);
+        d->rays[i].direction[0] = rand_range(-0.3, 0.3);
+        d->rays[i].direction[1] = rand_range(-0.3, 0.3);
+        d->rays[i].direction[2] = 1;
+        normalize(d->rays[i].direction);
+
+        d->centers[i][0] = rand_range(-3, 3);
+        d->centers[i][1] = rand_range(-3, 3);
+        d->centers[i][2] = rand_range(5, 20);
+        d->radii[i] = rand_range(0.1, 2);
+
+        d->plane_pos[i][0] = rand_range(-5, 5);
+        d->plane_pos[i][1] = rand_range(-5, 5);
+        d->plane_pos[i][2] = rand_range(-5, 25);
+        rand_dir(d->plane_norm[i]);
+
+        rand_dir(d->normals[i]);
+        rand_dir(d->to_light[i]);
+        rand_dir(d->view[i]);
+        v3_reflect(d->to_light[i], d->normals[i], d->reflected[i]);
+        d->obj_color[i][0] = rand_unit();
+        d->obj_color[i][1] = rand_unit();
+        d->obj_color[i][2] = rand_unit();
+        d->light_color[i][0] = rand_range(0, 5);
+        d->light_color[i][1] = rand_range(0, 5);
+        d->light_color[i][2] = rand_range(0, 5);
+
+        Light *l = &d->lights[i];
+        l->type = (rand_unit() < 0.5) ? SPOTLIGHT : LIGHT;
+        l->color = d->light_color[i];
+        l->direction = malloc(sizeof(double) * 3);
+        if (l->direction == NULL) {
+            fprintf(stderr, "Error: fill_bench_data: Out of memory\n");
+            exit(1);
+        }
+        rand_dir(l->direction);
+        l->theta_deg = rand_range(5, 90);
+        l->cos_theta = cos(l->theta_deg * (M_PI / 180.0));
+        // tilt the spotlight's axis at most asin(sin(theta) / 2) off the point, so it's lit from inside
+        // the cone and shading pays for the angular falloff
+        double tilt = sin(l->theta_deg * (M_PI / 180.0)) / 2;
+        for (int k=0; k<3; k++)
+            l->direction[k] = tilt * l->direction[k] - d->to_light[i][k];
+        normalize(l->direction);
+        l->rad_att0 = rand_range(0.1, 1);
+        l->rad_att1 = rand_range(0.1, 1);
+        l->rad_att2 = rand_range(0.1, 1);
+        l->ang_att0 = rand_range(0.5, 10);
+        d->distances[i] = rand_range(0.5, 50);
+    }
+}
+
+/* kernels -- each one runs over the whole batch once and returns a reduction of its results */
+
+static double run_sphere_intersect(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += sphere_intersect(&d->rays[i], d->centers[i], d->radii[i]);
+    return acc;
+}
+
+static double run_plane_intersect(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += plane_intersect(&d->rays[i], d->plane_pos[i], d->plane_norm[i]);
+    return acc;
+}
+
+/* the bucketed kernels of primitives.c on the same spheres, and planes along the axes */
+static double run_sphere_r2_intersect(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++) {
+        double *c = d->centers[i];
+        acc += sphere_r2_intersect(d->rays[i].origin, d->rays[i].direction, c[0], c[1], c[2],
+                                   d->radii[i] * d->radii[i]);
+    }
+    return acc;
+}
+
+static double run_axis_plane_intersect(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += axis_plane_intersect(d->rays[i].origin, d->rays[i].direction, i % 3, d->plane_pos[i][i % 3]);
+    return acc;
+}
+
+static double run_calculate_diffuse(bench_data *d) {
+    double acc = 0;
+    double out[3];
+    for (int i=0; i<d->n; i++) {
+        calculate_diffuse(d->normals[i], d->to_light[i], d->light_color[i], d->obj_color[i], out);
+        acc += out[0] + out[1] + out[2];
+    }
+    return acc;
+}
+
+static double run_calculate_specular(bench_data *d) {
+    double acc = 0;
+    double out[3];
+    for (int i=0; i<d->n; i++) {
+        calculate_specular(SHININESS, d->to_light[i], d->reflected[i], d->normals[i], d->view[i],
+                           d->obj_color[i], d->light_color[i], out);
+        acc += out[0] + out[1] + out[2];
+    }
+    return acc;
+}
+
+static double run_calculate_angular_att(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += calculate_angular_att(&d->lights[i], d->view[i]);
+    return acc;
+}
+
+static double run_calculate_radial_att(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += calculate_radial_att(&d->lights[i], d->distances[i]);
+    return acc;
+}
+
+static double run_spot_angular_att(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += spot_angular_att(&d->lights[i], d->view[i]);
+    return acc;
+}
+
+static double run_radial_att(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += radial_att(&d->lights[i], d->distances[i]);
+    return acc;
+}
+
+static double run_normalize(bench_data *d) {
+    double acc = 0;
+    V3 tmp;
+    for (int i=0; i<d->n; i++) {
+        v3_copy(d->centers[i], tmp);
+        normalize(tmp);
+        acc += tmp[0];
+    }
+    return acc;
+}
+
+/* the renderer's light kernels on a lit point of a sphere */
+static object bench_sphere;
+
+static double run_shade_point_light(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++) {
+        Ray shadow_ray;
+        v3_copy(d->centers[i], shadow_ray.origin);
+        v3_copy(d->to_light[i], shadow_ray.direction);
+        double color[3] = {0, 0, 0};
+        shade_point_light(&d->rays[i], &bench_sphere, &shadow_ray, d->distances[i], &d->lights[i], 1.0, color);
+        acc += color[0];
+    }
+    return acc;
+}
+
+static double run_shade_spot_light(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++) {
+        Ray shadow_ray;
+        v3_copy(d->centers[i], shadow_ray.origin);
+        v3_copy(d->to_light[i], shadow_ray.direction);
+        double color[3] = {0, 0, 0};
+        shade_spot_light(&d->rays[i], &bench_sphere, &shadow_ray, d->distances[i], &d->lights[i], 1.0, color);
+        acc += color[0];
+    }
+    return acc;
+}
+
+/* primary ray setup and writing the pixel, what every pixel pays besides intersections */
+static RGBPixel bench_pixels[64 * 64];
+
+static double run_pixel(bench_data *d) {
+    image img = {.pixmap = bench_pixels, .width = 64, .height = 64, .max_color_val = 255};
+    double acc = 0;
+    for (int i=0; i<d->n; i++) {
+        int row = (i / 64) % 64, col = i % 64;
+        double dir[3];
+        get_primary_ray_dir(row, col, 64, 64, 1.0, 1.0, dir);
+        set_pixel_color(d->obj_color[i], row, col, &img);
+        acc += dir[0];
+    }
+    return acc;
+}
+
+static double run_v3_len(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += v3_len(d->centers[i]);
+    return acc;
+}
+
+static double run_v3_dot(bench_data *d) {
+    double acc = 0;
+    for (int i=0; i<d->n; i++)
+        acc += v3_dot(d->normals[i], d->to_light[i]);
+    return acc;
+}
+
+static double run_v3_cross(bench_data *d) {
+    double acc = 0;
+    V3 tmp;
+    for (int i=0; i<d->n; i++) {
+        v3_cross(d->normals[i], d->to_light[i], tmp);
+        acc += tmp[0] + tmp[1] + tmp[2];
+    }
+    return acc;
+}
+
+static double run_v3_reflect(bench_data *d) {
+    double acc = 0;
+    V3 tmp;
+    for (int i=0; i<d->n; i++) {
+        v3_reflect(d->to_light[i], d->normals[i], tmp);
+        acc += tmp[0] + tmp[1] + tmp[2];
+    }
+    return acc;
+}
+
+/**
+ * Times one kernel over the batch and prints its per-op cost
+ * @param name - name to print in the report
+ * @param fn - kernel to run
+ * @param d - randomized batch
+ * @param iterations - number of passes over the batch
+ */
+double run_kernel(const char *name, kernel_fn fn, bench_data *d, int iterations) {
+    double acc = fn(d);     // warm caches and branch predictors
+    double t0 = now_ns();
+    uint64_t c0 = now_cycles();
+    for (int it=0; it<iterations; it++)
+        acc += fn(d);
+    uint64_t c1 = now_cycles();
+    double t1 = now_ns();
+    sink += acc;
+
+    double ops = (double)d->n * iterations;
+    if (c1 > c0)
+        printf("%-24s %10.3f ns/op %10.4f ops/cycle\n", name, (t1 - t0) / ops, ops / (double)(c1 - c0));
+    else
+        printf("%-24s %10.3f ns/op %10s ops/cycle\n", name, (t1 - t0) / ops, "n/a");
+    return (t1 - t0) / ops;
+}
+
+/**
+ * Measures the render estimator's per operation costs, then renders a calibration scene and
+ * fits the scale between what those costs add up to and the time the render really took
+ * @param path - calibration file to write
+ * @param d - randomized batch for the kernels
+ * @param iterations - number of passes over the batch
+ */
+void calibrate(const char *path, bench_data *d, int iterations) {
+    render_costs costs;
+    costs.pixel_ns = run_kernel("pixel", run_pixel, d, iterations);
+    costs.sphere_ns = run_kernel("sphere_intersect", run_sphere_intersect, d, iterations);
+    costs.plane_ns = run_kernel("plane_intersect", run_plane_intersect, d, iterations);
+    costs.shade_point_ns = run_kernel("shade_point_light", run_shade_point_light, d, iterations);
+    costs.shade_spot_ns = run_kernel("shade_spot_light", run_shade_spot_light, d, iterations);
+    costs.scale = 1;
+
+    FILE *json = fmemopen((void*)calibration_scene, strlen(calibration_scene), "r");
+    if (json == NULL) {
+        fprintf(stderr, "Error: calibrate: Failed to open the calibration scene\n");
+        exit(1);
+    }
+    init_lights();
+    init_objects();
+    read_json(json);
+    int cam = get_camera(objects);
+    image img = {.width = CALIBRATION_SIZE, .height = CALIBRATION_SIZE, .max_color_val = MAX_COLOR_VAL};
+    img.pixmap = malloc(sizeof(RGBPixel) * img.width * img.height);
+    if (img.pixmap == NULL) {
+        fprintf(stderr, "Error: calibrate: Out of memory\n");
+        exit(1);
+    }
+    double best = INFINITY;
+    for (int r=0; r<CALIBRATION_RUNS; r++) {
+        double t0 = now_ns();
+        raycast_scene(&img, objects[cam].camera.width, objects[cam].camera.height, objects);
+        double t1 = now_ns();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    free(img.pixmap);
+
+    render_estimate est;
+    estimate_render(img.width, img.height, objects[cam].camera.width, objects[cam].camera.height, 1, &costs, &est);
+    costs.scale = best * 1e-9 / est.seconds;
+    printf("calibration render %dx%d: %.3f ms, the kernel costs add up to %.3f ms, scale %.3f\n",
+           img.width, img.height, best * 1e-6, est.seconds * 1e3, costs.scale);
+    if (write_render_costs(path, &costs) < 0)
+        exit(1);
+    printf("wrote %s\n", path);
+}
+
+/* example usage: bench [batch_size] [iterations]
+ *                bench --calibrate costs.cal     (costs for the renderer's --estimate) */
+int main(int argc, char *argv[]) {
+    int n = DEFAULT_BATCH;
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 1 && strcmp(argv[1], "--calibrate") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "Error: main: usage: %s --calibrate costs.cal\n", argv[0]);
+            exit(1);
+        }
+        bench_data d;
+        fill_bench_data(&d, n);
+        bench_sphere.type = SPHERE;
+        bench_sphere.sphere.position = d.centers[0];
+        bench_sphere.sphere.radius = 1;
+        bench_sphere.sphere.material = intern_material(d.obj_color[0], d.light_color[0]);
+        calibrate(argv[2], &d, iterations);
+        return 0;
+    }
+    if (argc > 3) {
+        fprintf(stderr, "Error: main: usage: %s [batch_size] [iterations]\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (argc > 2)
+        iterations = atoi(argv[2]);
+    if (n <= 0 || iterations <= 0) {
+        fprintf(stderr, "Error: main: batch_size and iterations must be > 0\n");
+        exit(1);
+    }
+
+    bench_data d;
+    fill_bench_data(&d, n);
+
+    printf("batch: %d, iterations: %d", n, iterations);
+#ifdef HAVE_TSC
+    printf(" (cycles are TSC reference cycles)\n");
+#else
+    printf(" (no cycle counter on this platform)\n");
+#endif
+    run_kernel("sphere_intersect", run_sphere_intersect, &d, iterations);
+    run_kernel("plane_intersect", run_plane_intersect, &d, iterations);
+    run_kernel("sphere_r2_intersect", run_sphere_r2_intersect, &d, iterations);
+    run_kernel("axis_plane_intersect", run_axis_plane_intersect, &d, iterations);
+    run_kernel("calculate_diffuse", run_calculate_diffuse, &d, iterations);
+    run_kernel("calculate_specular", run_calculate_specular, &d, iterations);
+    run_kernel("calculate_angular_att", run_calculate_angular_att, &d, iterations);
+    run_kernel("calculate_radial_att", run_calculate_radial_att, &d, iterations);
+    run_kernel("spot_angular_att", run_spot_angular_att, &d, iterations);
+    run_kernel("radial_att", run_radial_att, &d, iterations);
+    run_kernel("normalize", run_normalize, &d, iterations);
+    run_kernel("v3_len", run_v3_len, &d, iterations);
+    run_kernel("v3_dot", run_v3_dot, &d, iterations);
+    run_kernel("v3_cross", run_v3_cross, &d, iterations);
+    run_kernel("v3_reflect", run_v3_reflect, &d, iterations);
+
+    /* the kernels --fast-math changes, with its approximations */
+    fast_math = true;
+    run_kernel("calculate_specular fast", run_calculate_specular, &d, iterations);
+    run_kernel("normalize fast", run_normalize, &d, iterations);
+    fast_math = false;
+
+    return 0;
+}
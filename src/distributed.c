@@ -0,0 +1,328 @@
+/* distributed.c - renders one frame with several worker processes
+ *
+ * Workers speak a tiny line protocol: the coordinator writes "x0 y0 x1 y1\n" to a worker's
+ * input and the worker answers with one P6 fragment (see create_ppm_region) on its output.
+ * Local workers are forked and talk over pipes, remote workers are any command that runs
+ * the renderer with --worker (e.g. through ssh) and are driven over the same pipes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include "../include/distributed.h"
+#include "../include/raycaster.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/* one worker process and the pipes we drive it with */
+typedef struct worker_t {
+    pid_t pid;
+    FILE *to;       // region assignments
+    FILE *from;     // fragments
+    int busy;
+} worker;
+
+/**
+ * Parses a region of interest written as "x0,y0,x1,y1"
+ * @param str - string to parse
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param r - where the region is stored
+ * @return 0 on success, -1 if the string is malformed or the region doesn't fit the frame
+ */
+int parse_region(char *str, int full_width, int full_height, region *r) {
+    char extra;
+    if (sscanf(str, "%d,%d,%d,%d%c", &r->x0, &r->y0, &r->x1, &r->y1, &extra) != 4) {
+        fprintf(stderr, "Error: parse_region: Region must look like x0,y0,x1,y1\n");
+        return -1;
+    }
+    if (r->x0 < 0 || r->y0 < 0 || r->x1 > full_width || r->y1 > full_height ||
+        r->x0 >= r->x1 || r->y0 >= r->y1) {
+        fprintf(stderr, "Error: parse_region: Region must be non-empty and inside the %dx%d frame\n",
+                full_width, full_height);
+        return -1;
+    }
+    r->cost = 0;
+    return 0;
+}
+
+/**
+ * Renders one region of the frame and writes it as a fragment
+ * @param out - where the fragment is written
+ * @param r - region of the full frame to render
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void render_region_to_file(FILE *out, region *r, int full_width, int full_height,
+                           double cam_width, double cam_height) {
+    image frag;
+    frag.width = r->x1 - r->x0;
+    frag.height = r->y1 - r->y0;
+    frag.max_color_val = 255;
+    frag.pixmap = mem_alloc(MEM_IO, sizeof(RGBPixel) * (size_t)frag.width * frag.height);
+    raycast_region(&frag, full_width, full_height, r->x0, r->y0, cam_width, cam_height, objects);
+    create_ppm_region(out, &frag, r->x0, r->y0, full_width, full_height);
+    fflush(out);
+    mem_free(frag.pixmap);
+}
+
+/**
+ * Worker loop. Reads region assignments until EOF and answers each one with a fragment
+ * @param in - region assignments, one "x0 y0 x1 y1" per line
+ * @param out - fragments
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void serve_regions(FILE *in, FILE *out, int full_width, int full_height,
+                   double cam_width, double cam_height) {
+    region r;
+    int res;
+    while ((res = fscanf(in, "%d %d %d %d", &r.x0, &r.y0, &r.x1, &r.y1)) == 4) {
+        if (r.x0 < 0 || r.y0 < 0 || r.x1 > full_width || r.y1 > full_height ||
+            r.x0 >= r.x1 || r.y0 >= r.y1) {
+            fprintf(stderr, "Error: serve_regions: Region %d,%d,%d,%d doesn't fit the frame\n",
+                    r.x0, r.y0, r.x1, r.y1);
+            exit(1);
+        }
+        render_region_to_file(out, &r, full_width, full_height, cam_width, cam_height);
+    }
+    if (res != EOF) {
+        fprintf(stderr, "Error: serve_regions: Malformed region assignment\n");
+        exit(1);
+    }
+}
+
+/* sorts regions so the most expensive ones are handed out first */
+static int compare_region_cost(const void *a, const void *b) {
+    double ca = ((const region*)a)->cost;
+    double cb = ((const region*)b)->cost;
+    if (ca < cb) return 1;
+    if (ca > cb) return -1;
+    return ((const region*)a)->y0 - ((const region*)b)->y0;
+}
+
+/**
+ * Cuts the frame into horizontal bands of roughly equal estimated cost. Cost comes from
+ * casting primary rays through a sparse grid of pixels
+ * @param img - full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param nbands - how many bands we would like
+ * @param bands - output array with room for nbands regions
+ * @return - number of bands actually made (never more than nbands or the number of rows)
+ */
+int split_by_cost(image *img, double cam_width, double cam_height, int nbands, region *bands) {
+    double *row_cost = mem_alloc(MEM_SCRATCH, sizeof(double) * img->height);
+    double total = 0;
+    for (int i=0; i<img->height; i++) {
+        if (i % COST_SAMPLE_STEP != 0) {
+            row_cost[i] = row_cost[i - 1];    // rows between samples cost the same as the sample
+        }
+        else {
+            row_cost[i] = 0;
+            for (int j=0; j<img->width; j+=COST_SAMPLE_STEP)
+                row_cost[i] += estimate_pixel_cost(i, j, img->width, img->height, cam_width, cam_height);
+        }
+        total += row_cost[i];
+    }
+
+    double target = total / nbands;
+    int count = 0;
+    double acc = 0;
+    int start = 0;
+    for (int i=0; i<img->height; i++) {
+        acc += row_cost[i];
+        boolean last_row = (i == img->height - 1);
+        if ((acc >= target && count < nbands - 1) || last_row) {
+            bands[count].x0 = 0;
+            bands[count].x1 = img->width;
+            bands[count].y0 = start;
+            bands[count].y1 = i + 1;
+            bands[count].cost = acc;
+            count++;
+            start = i + 1;
+            acc = 0;
+        }
+    }
+    mem_free(row_cost);
+    return count;
+}
+
+/**
+ * Starts one worker. With cmd == NULL the worker is a fork of this process that already has
+ * the scene loaded, otherwise cmd is run through the shell with its stdin/stdout on our pipes
+ * @param w - worker to fill in
+ * @param workers - workers started so far (a forked worker must not hold on to their pipes)
+ * @param nstarted - number of workers started so far
+ * @param cmd - command that starts a remote worker or NULL for a local one
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void start_worker(worker *w, worker *workers, int nstarted, char *cmd, int full_width, int full_height,
+                  double cam_width, double cam_height) {
+    int to_pipe[2];
+    int from_pipe[2];
+    if (pipe(to_pipe) < 0 || pipe(from_pipe) < 0) {
+        perror("Error: start_worker: pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Error: start_worker: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        // otherwise earlier workers never see EOF on their assignment pipe
+        for (int k=0; k<nstarted; k++) {
+            fclose(workers[k].to);
+            fclose(workers[k].from);
+        }
+        close(to_pipe[1]);
+        close(from_pipe[0]);
+        if (cmd != NULL) {
+            dup2(to_pipe[0], STDIN_FILENO);
+            dup2(from_pipe[1], STDOUT_FILENO);
+            close(to_pipe[0]);
+            close(from_pipe[1]);
+            execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+            perror("Error: start_worker: exec");
+            _exit(127);
+        }
+        FILE *in = fdopen(to_pipe[0], "r");
+        FILE *out = fdopen(from_pipe[1], "w");
+        serve_regions(in, out, full_width, full_height, cam_width, cam_height);
+        fclose(out);
+        _exit(0);
+    }
+    close(to_pipe[0]);
+    close(from_pipe[1]);
+    w->pid = pid;
+    w->to = fdopen(to_pipe[1], "w");
+    w->from = fdopen(from_pipe[0], "r");
+    w->busy = false;
+}
+
+/* sends one region to an idle worker */
+static void assign_region(worker *w, region *r) {
+    fprintf(w->to, "%d %d %d %d\n", r->x0, r->y0, r->x1, r->y1);
+    fflush(w->to);
+    w->busy = true;
+}
+
+/**
+ * Most bytes render_distributed can allocate in this process, or in a forked worker on top of
+ * what it inherits. A band can be as tall as the frame when the cost is all in one place
+ * @param img - full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param nlocal - number of local workers to fork
+ * @param ncmds - number of remote workers, they count against their own limits
+ */
+size_t distributed_bytes(image *img, double cam_width, double cam_height, int nlocal, int ncmds) {
+    size_t bands = sizeof(region) * (nlocal + ncmds) * BANDS_PER_WORKER;
+    size_t most = sizeof(double) * img->height;                     // split_by_cost
+    if (3 * (size_t)img->width > most)
+        most = 3 * (size_t)img->width;                              // read_region_data
+    if (nlocal > 0) {
+        size_t worker = sizeof(RGBPixel) * (size_t)img->width * img->height +
+                        region_bytes(img->width, img->height, img->width, img->height, cam_width, cam_height);
+        if (worker > most)
+            most = worker;
+    }
+    return bands + most;
+}
+
+/**
+ * Renders the full frame with nlocal forked workers plus one worker per command, handing out
+ * bands of rows by estimated cost (largest first) and stitching fragments as they come back.
+ * Every worker runs the same per pixel code as a single process render, so the stitched
+ * frame is byte-identical to it.
+ * @param img - full frame (pixmap must be allocated)
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param nlocal - number of local workers to fork
+ * @param worker_cmds - commands that start remote workers
+ * @param ncmds - number of commands
+ */
+void render_distributed(image *img, double cam_width, double cam_height,
+                        int nlocal, char **worker_cmds, int ncmds) {
+    int nworkers = nlocal + ncmds;
+    if (nworkers <= 0 || nworkers > MAX_WORKERS) {
+        fprintf(stderr, "Error: render_distributed: Number of workers must be 1-%d\n", MAX_WORKERS);
+        exit(1);
+    }
+
+    int nbands = nworkers * BANDS_PER_WORKER;
+    region *bands = mem_alloc(MEM_SCRATCH, sizeof(region) * nbands);
+    nbands = split_by_cost(img, cam_width, cam_height, nbands, bands);
+    qsort(bands, nbands, sizeof(region), compare_region_cost);
+
+    worker workers[MAX_WORKERS];
+    for (int k=0; k<nworkers; k++) {
+        char *cmd = (k < nlocal) ? NULL : worker_cmds[k - nlocal];
+        start_worker(&workers[k], workers, k, cmd, img->width, img->height, cam_width, cam_height);
+    }
+
+    int next = 0;
+    for (int k=0; k<nworkers; k++) {
+        if (next < nbands)
+            assign_region(&workers[k], &bands[next++]);
+    }
+
+    int remaining = nbands;
+    while (remaining > 0) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        int max_fd = -1;
+        for (int k=0; k<nworkers; k++) {
+            if (!workers[k].busy) continue;
+            int fd = fileno(workers[k].from);
+            FD_SET(fd, &ready);
+            if (fd > max_fd) max_fd = fd;
+        }
+        if (select(max_fd + 1, &ready, NULL, NULL, NULL) < 0) {
+            perror("Error: render_distributed: select");
+            exit(1);
+        }
+        for (int k=0; k<nworkers; k++) {
+            if (!workers[k].busy || !FD_ISSET(fileno(workers[k].from), &ready)) continue;
+            region_header hdr;
+            if (read_region_header(workers[k].from, &hdr) < 0 ||
+                read_region_data(workers[k].from, &hdr, img) < 0) {
+                fprintf(stderr, "Error: render_distributed: Worker %d sent a bad fragment\n", k);
+                exit(1);
+            }
+            workers[k].busy = false;
+            remaining--;
+            if (next < nbands)
+                assign_region(&workers[k], &bands[next++]);
+        }
+    }
+
+    // closing the assignment pipes tells the workers we're done
+    int failed = 0;
+    for (int k=0; k<nworkers; k++) {
+        fclose(workers[k].to);
+        fclose(workers[k].from);
+    }
+    for (int k=0; k<nworkers; k++) {
+        int status;
+        if (waitpid(workers[k].pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "Error: render_distributed: %d worker(s) exited with an error\n", failed);
+        exit(1);
+    }
+    mem_free(bands);
+}
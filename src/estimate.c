@@ -0,0 +1,254 @@
+/* estimate.c - predicts rays cast and wall time of a render without rendering it
+ *
+ * The model follows the scalar engine with ray traced shadows: every pixel casts a primary
+ * ray, every pixel that sees an object casts one shadow ray per light, and every ray is tested
+ * against every object. How many pixels see an object comes from the spheres' projected disks
+ * and a small grid of probe rays (planes and instances are too irregular to project). The probes
+ * also give the share of shadow rays that get through and how much of the visible scene lies
+ * inside the spotlights' cones. Counts are turned into time with per operation costs measured
+ * by the benchmark, and a scale factor the benchmark fits by timing a real render. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../include/estimate.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+
+/**
+ * Reads a calibration file of "name value" lines, '#' starts a comment line
+ * @param path - file name
+ * @param costs - filled in
+ * @return - 0 on success, -1 (after printing why) if a cost is missing or unknown
+ */
+int read_render_costs(const char *path, render_costs *costs) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: read_render_costs: Failed to open '%s'\n", path);
+        return -1;
+    }
+    struct { const char *name; double *value; } keys[] = {
+            {"pixel_ns", &costs->pixel_ns},
+            {"sphere_ns", &costs->sphere_ns},
+            {"plane_ns", &costs->plane_ns},
+            {"shade_point_ns", &costs->shade_point_ns},
+            {"shade_spot_ns", &costs->shade_spot_ns},
+            {"scale", &costs->scale}
+    };
+    int nkeys = sizeof(keys) / sizeof(keys[0]);
+    int found = 0;
+    char buf[MAX_SIZE];
+    int line_no = 0;
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        line_no++;
+        char name[64];
+        double value;
+        if (buf[0] == '#' || sscanf(buf, "%63s", name) != 1)
+            continue;   // comment or blank line
+        if (sscanf(buf, "%63s %lf", name, &value) != 2) {
+            fprintf(stderr, "Error: read_render_costs: Expected 'name value' in '%s': %d\n", path, line_no);
+            fclose(f);
+            return -1;
+        }
+        int k;
+        for (k=0; k<nkeys && strcmp(keys[k].name, name) != 0; k++);
+        if (k == nkeys) {
+            fprintf(stderr, "Error: read_render_costs: Unknown cost '%s' in '%s': %d\n", name, path, line_no);
+            fclose(f);
+            return -1;
+        }
+        *keys[k].value = value;
+        found |= 1 << k;
+    }
+    fclose(f);
+    for (int k=0; k<nkeys; k++) {
+        if (!(found & (1 << k))) {
+            fprintf(stderr, "Error: read_render_costs: '%s' has no %s\n", path, keys[k].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes a calibration file that read_render_costs reads back
+ * @param path - file name
+ * @param costs - the costs
+ * @return - 0 on success, -1 on error
+ */
+int write_render_costs(const char *path, render_costs *costs) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: write_render_costs: Failed to create '%s'\n", path);
+        return -1;
+    }
+    fprintf(f, "# render cost calibration from cs430_proj3_illumination_bench --calibrate\n");
+    fprintf(f, "pixel_ns %.4f\n", costs->pixel_ns);
+    fprintf(f, "sphere_ns %.4f\n", costs->sphere_ns);
+    fprintf(f, "plane_ns %.4f\n", costs->plane_ns);
+    fprintf(f, "shade_point_ns %.4f\n", costs->shade_point_ns);
+    fprintf(f, "shade_spot_ns %.4f\n", costs->shade_spot_ns);
+    fprintf(f, "scale %.4f\n", costs->scale);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: write_render_costs: Failed to write '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Share of the view plane (z = 1) covered by a sphere's projected disk. The disk is clipped to
+ * the frame by its bounding square, which is then scaled down to the disk's area
+ * @param center - sphere center
+ * @param radius - sphere radius
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @return - coverage from 0 to 1
+ */
+static double disk_coverage(scalar *center, scalar radius, scalar cam_width, scalar cam_height) {
+    if (radius == INFINITY || v3_len(center) <= radius)
+        return 1;       // unbounded, or the camera is inside
+    if (center[2] <= -radius)
+        return 0;       // behind the camera
+    if (center[2] <= radius)
+        return 1;       // reaches around the camera, assume the worst
+    double z = center[2];
+    double r = radius / sqrt(sqr(z) - sqr(radius));   // tangent of the angular radius
+    double x = center[0] / z, y = center[1] / z;
+    double ox = fmin(x + r, cam_width / 2) - fmax(x - r, -cam_width / 2);
+    double oy = fmin(y + r, cam_height / 2) - fmax(y - r, -cam_height / 2);
+    if (ox <= 0 || oy <= 0)
+        return 0;
+    return fmin(1, ox * oy * (M_PI / 4) / (cam_width * cam_height));
+}
+
+/**
+ * Predicts the rays, intersection tests and wall time of rendering the current scene
+ * @param width - frame width in pixels
+ * @param height - frame height in pixels
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param threads - render threads or worker processes the frame is split over, 1 for none
+ * @param costs - calibrated per operation costs
+ * @param est - filled in
+ */
+void estimate_render(int width, int height, scalar cam_width, scalar cam_height, int threads,
+                     render_costs *costs, render_estimate *est) {
+    memset(est, 0, sizeof(render_estimate));
+    est->width = width;
+    est->height = height;
+    est->threads = threads;
+
+    // what one ray costs against the whole scene
+    double miss_sphere = 1;     // share of the frame no sphere covers
+    double ray_ns = 0;
+    double ray_tests = 0;
+    for (int i=0; objects[i].type != 0; i++) {
+        if (objects[i].type == SPHERE) {
+            est->spheres++;
+            miss_sphere *= 1 - disk_coverage(objects[i].sphere.position, objects[i].sphere.radius,
+                                             cam_width, cam_height);
+            ray_ns += costs->sphere_ns;
+            ray_tests++;
+        }
+        else if (objects[i].type == PLANE) {
+            est->planes++;
+            ray_ns += costs->plane_ns;
+            ray_tests++;
+        }
+        else if (objects[i].type == INSTANCE) {
+            // a bound test, then the group's members for the rays that reach inside the bound
+            Instance *inst = &objects[i].instance;
+            Prototype *proto = &prototypes[inst->prototype];
+            scalar center[3];
+            v3_scale(proto->center, inst->scale, center);
+            v3_add(center, inst->translate, center);
+            double inside = disk_coverage(center, proto->radius * inst->scale, cam_width, cam_height);
+            est->instances++;
+            est->members += proto->nobjects;
+            ray_ns += costs->sphere_ns * (1 + inside * proto->nobjects);
+            ray_tests += 1 + inside * proto->nobjects;
+        }
+    }
+    for (int l=0; l<nlights; l++) {
+        if (lights[l].type == SPOTLIGHT)
+            est->spot_lights++;
+        else
+            est->point_lights++;
+    }
+    est->sphere_coverage = 1 - miss_sphere;
+
+    // probe rays for what can't be projected: planes and instances, shadows and spotlight cones
+    int probes = 0, other = 0, hits = 0, lit = 0, spot_probes = 0, in_cone = 0;
+    Ray ray = {.origin = {0, 0, 0}};
+    for (int i=0; i<ESTIMATE_PROBES; i++) {
+        for (int j=0; j<ESTIMATE_PROBES; j++) {
+            probes++;
+            get_primary_ray_dir(i, j, ESTIMATE_PROBES, ESTIMATE_PROBES, cam_width, cam_height, ray.direction);
+            int best_o;
+            scalar best_t;
+            get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+            if (best_o == -1)
+                continue;
+            hits++;
+            if (objects[best_o].type != SPHERE)
+                other++;
+            Ray shadow;
+            v3_scale(ray.direction, best_t, shadow.origin);
+            for (int l=0; l<nlights; l++) {
+                v3_sub(lights[l].position, shadow.origin, shadow.direction);
+                scalar distance_to_light = v3_len(shadow.direction);
+                normalize(shadow.direction);
+                if (lights[l].type == SPOTLIGHT && lights[l].direction != NULL) {
+                    spot_probes++;
+                    if (-v3_dot(lights[l].direction, shadow.direction) >= cos(lights[l].theta_deg * (M_PI / 180.0)))
+                        in_cone++;
+                }
+                int shadow_o;
+                scalar shadow_t;
+                get_dist_and_idx_closest_obj(&shadow, best_o, distance_to_light, &shadow_o, &shadow_t);
+                if (shadow_o == -1)
+                    lit++;
+            }
+        }
+    }
+    est->other_coverage = (double)other / probes;
+    est->hit_fraction = 1 - (1 - est->other_coverage) * miss_sphere;
+    est->lit_fraction = (hits > 0 && nlights > 0) ? (double)lit / (hits * nlights) : 1;
+    est->cone_coverage = (spot_probes > 0) ? (double)in_cone / spot_probes : 0;
+
+    // counts to time
+    double pixels = (double)width * height;
+    double hit_pixels = pixels * est->hit_fraction;
+    est->primary_rays = pixels;
+    est->shadow_rays = hit_pixels * nlights;
+    est->tests = (est->primary_rays + est->shadow_rays) * ray_tests;
+    // outside its cone a spotlight shades like a point light, the falloff is only paid inside
+    double spot_ns = est->cone_coverage * costs->shade_spot_ns + (1 - est->cone_coverage) * costs->shade_point_ns;
+    double ns = pixels * costs->pixel_ns
+                + (est->primary_rays + est->shadow_rays) * ray_ns
+                + hit_pixels * est->lit_fraction * (est->point_lights * costs->shade_point_ns +
+                                                    est->spot_lights * spot_ns);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int parallel = (cpus > 0 && threads > cpus) ? (int)cpus : threads;
+    est->seconds = costs->scale * ns * 1e-9 / (parallel > 0 ? parallel : 1);
+}
+
+/* prints what estimate_render found and predicts */
+void print_render_estimate(FILE *out, render_estimate *est) {
+    fprintf(out, "estimate for %dx%d, %d thread%s (scalar engine, ray traced shadows)\n",
+            est->width, est->height, est->threads, est->threads == 1 ? "" : "s");
+    fprintf(out, "  objects: %d spheres, %d planes, %d instances of %d members; lights: %d point, %d spot\n",
+            est->spheres, est->planes, est->instances, est->members, est->point_lights, est->spot_lights);
+    fprintf(out, "  coverage: spheres %.1f%%, planes and instances %.1f%%, any object %.1f%%\n",
+            100 * est->sphere_coverage, 100 * est->other_coverage, 100 * est->hit_fraction);
+    fprintf(out, "  shadow rays reaching their light %.1f%%", 100 * est->lit_fraction);
+    if (est->spot_lights > 0)
+        fprintf(out, ", visible points inside spotlight cones %.1f%%", 100 * est->cone_coverage);
+    fprintf(out, "\n");
+    fprintf(out, "  rays: %.0f primary, %.0f shadow, %.3g intersection tests\n",
+            est->primary_rays, est->shadow_rays, est->tests);
+    fprintf(out, "  time: %.3f s\n", est->seconds);
+}
@@ -0,0 +1,219 @@
+/* frustum.c - screen space bounds and tile binning for primary rays
+ *
+ * The camera sits at the origin looking down +z through the view plane at z = 1. A sphere
+ * that is entirely in front of the camera projects to an ellipse whose extent along x (or y)
+ * is given by the two planes through the camera that contain the y (or x) axis and touch
+ * the sphere. Each frame the spheres are binned into the tiles their bounds overlap, and a
+ * tile's primary rays only test those spheres plus the (unbounded) planes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/frustum.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/**
+ * Finds the slopes k of the two planes a = k*z tangent to a sphere, which bound the sphere's
+ * projection along one image axis
+ * @param a - sphere center along the image axis (x or y)
+ * @param z - sphere center along z
+ * @param r - sphere radius
+ * @param kmin - smaller slope
+ * @param kmax - larger slope
+ * @return - false if the sphere isn't entirely in front of the camera
+ */
+static boolean tangent_slopes(scalar a, scalar z, scalar r, scalar *kmin, scalar *kmax) {
+    scalar denom = sqr(z) - sqr(r);
+    if (z <= r || denom <= 0)
+        return false;
+    scalar root = r * sqrt(sqr(a) + denom);
+    *kmin = (a*z - root) / denom;
+    *kmax = (a*z + root) / denom;
+    return true;
+}
+
+/**
+ * Finds the rectangle of pixels whose primary rays could hit a sphere. The rectangle is
+ * conservative (padded by SCREEN_PAD) and clipped to the frame
+ * @param C - sphere center
+ * @param r - sphere radius
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param rect - output pixel rectangle. The whole frame if the sphere reaches behind the view plane
+ * @return - false if no pixel can see the sphere
+ */
+boolean sphere_screen_rect(scalar *C, scalar r, int full_width, int full_height,
+                           scalar cam_width, scalar cam_height, screen_rect *rect) {
+    scalar xmin, xmax, ymin, ymax;
+    if (!tangent_slopes(C[0], C[2], r, &xmin, &xmax) || !tangent_slopes(C[1], C[2], r, &ymin, &ymax)) {
+        rect->x0 = 0;
+        rect->y0 = 0;
+        rect->x1 = full_width;
+        rect->y1 = full_height;
+        return true;
+    }
+    scalar pixheight = cam_height / (scalar)full_height;
+    scalar pixwidth = cam_width / (scalar)full_width;
+
+    // pixel col's ray goes through x = -cam_width/2 + pixwidth*(col + 0.5) on the view plane,
+    // pixel row's ray through y = cam_height/2 - pixheight*(row + 0.5)
+    scalar c0 = ceil((xmin + cam_width/2.0) / pixwidth - 0.5) - SCREEN_PAD;
+    scalar c1 = floor((xmax + cam_width/2.0) / pixwidth - 0.5) + SCREEN_PAD + 1;
+    scalar r0 = ceil((cam_height/2.0 - ymax) / pixheight - 0.5) - SCREEN_PAD;
+    scalar r1 = floor((cam_height/2.0 - ymin) / pixheight - 0.5) + SCREEN_PAD + 1;
+    rect->x0 = (c0 < 0) ? 0 : (c0 > full_width) ? full_width : (int)c0;
+    rect->x1 = (c1 < 0) ? 0 : (c1 > full_width) ? full_width : (int)c1;
+    rect->y0 = (r0 < 0) ? 0 : (r0 > full_height) ? full_height : (int)r0;
+    rect->y1 = (r1 < 0) ? 0 : (r1 > full_height) ? full_height : (int)r1;
+    return rect->x0 < rect->x1 && rect->y0 < rect->y1;
+}
+
+/**
+ * Bins the frame's spheres into the tiles of a region that their screen rectangles overlap
+ * @param bins - bins to fill in
+ * @param pf - frame constants (the sphere list is taken from here)
+ * @param width - width of the region
+ * @param height - height of the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void bin_spheres(tile_bins *bins, primary_frame *pf, int width, int height, int full_width, int full_height,
+                 int x0, int y0, scalar cam_width, scalar cam_height) {
+    bins->tiles_x = (width + CULL_TILE - 1) / CULL_TILE;
+    bins->tiles_y = (height + CULL_TILE - 1) / CULL_TILE;
+    int ntiles = bins->tiles_x * bins->tiles_y;
+    bins->start = mem_calloc(MEM_ACCEL, ntiles + 1, sizeof(int));
+    screen_rect *tiles = mem_alloc(MEM_SCRATCH, sizeof(screen_rect) * (pf->nspheres + 1));  // tile range per sphere
+
+    // count how many spheres land in each tile
+    for (int k=0; k<pf->nspheres; k++) {
+        object *obj = &objects[pf->sphere_idx[k]];
+        screen_rect rect;
+        tiles[k].x0 = tiles[k].x1 = 0;
+        if (!sphere_screen_rect(obj->sphere.position, obj->sphere.radius, full_width, full_height,
+                                cam_width, cam_height, &rect))
+            continue;
+        // clip to the region and switch to region coordinates
+        int rx0 = (rect.x0 > x0) ? rect.x0 - x0 : 0;
+        int ry0 = (rect.y0 > y0) ? rect.y0 - y0 : 0;
+        int rx1 = (rect.x1 < x0 + width) ? rect.x1 - x0 : width;
+        int ry1 = (rect.y1 < y0 + height) ? rect.y1 - y0 : height;
+        if (rx0 >= rx1 || ry0 >= ry1)
+            continue;
+        tiles[k].x0 = rx0 / CULL_TILE;
+        tiles[k].y0 = ry0 / CULL_TILE;
+        tiles[k].x1 = (rx1 - 1) / CULL_TILE + 1;
+        tiles[k].y1 = (ry1 - 1) / CULL_TILE + 1;
+        for (int ty=tiles[k].y0; ty<tiles[k].y1; ty++)
+            for (int tx=tiles[k].x0; tx<tiles[k].x1; tx++)
+                bins->start[ty * bins->tiles_x + tx + 1]++;
+    }
+    for (int t=0; t<ntiles; t++)
+        bins->start[t + 1] += bins->start[t];
+
+    // fill the bins, spheres go in ascending order so ties resolve like the scalar path
+    bins->items = mem_alloc(MEM_ACCEL, sizeof(int) * (bins->start[ntiles] + 1));
+    int *fill = mem_alloc(MEM_SCRATCH, sizeof(int) * ntiles);
+    memcpy(fill, bins->start, sizeof(int) * ntiles);
+    for (int k=0; k<pf->nspheres; k++) {
+        for (int ty=tiles[k].y0; ty<tiles[k].y1; ty++)
+            for (int tx=tiles[k].x0; tx<tiles[k].x1; tx++)
+                bins->items[fill[ty * bins->tiles_x + tx]++] = k;
+    }
+    mem_free(fill);
+    mem_free(tiles);
+}
+
+void free_tile_bins(tile_bins *bins) {
+    mem_free(bins->start);
+    mem_free(bins->items);
+}
+
+/**
+ * Most bytes culled_region can allocate for a region this size, wherever it is in the frame
+ * @param width - width of the region
+ * @param height - height of the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+size_t culled_region_bytes(int width, int height, int full_width, int full_height,
+                           scalar cam_width, scalar cam_height) {
+    size_t tiles_x = (width + CULL_TILE - 1) / CULL_TILE;
+    size_t tiles_y = (height + CULL_TILE - 1) / CULL_TILE;
+    size_t items = 1;
+    for (int i=0; objects[i].type != 0; i++) {
+        screen_rect rect;
+        if (objects[i].type != SPHERE || !sphere_screen_rect(objects[i].sphere.position, objects[i].sphere.radius,
+                                                             full_width, full_height, cam_width, cam_height, &rect))
+            continue;
+        // a rectangle can straddle one more tile than it spans, depending on where the region starts
+        size_t sx = (rect.x1 - rect.x0 - 1) / CULL_TILE + 2;
+        size_t sy = (rect.y1 - rect.y0 - 1) / CULL_TILE + 2;
+        items += (sx < tiles_x ? sx : tiles_x) * (sy < tiles_y ? sy : tiles_y);
+    }
+    return primary_frame_bytes(width, height) + sizeof(int) * (2 * tiles_x * tiles_y + 1 + items) +
+           sizeof(screen_rect) * (MAX_OBJECTS + 1);
+}
+
+/**
+ * Renders a region of the frame with the primary visibility kernel, where each tile's rays
+ * only test the spheres binned into that tile. Same arguments and results as raycast_region
+ * @param img - image data for just the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void culled_region(image *img, int full_width, int full_height, int x0, int y0,
+                   scalar cam_width, scalar cam_height) {
+    primary_frame pf;
+    tile_bins bins;
+    prepare_primary_frame(&pf, img->width, img->height, full_width, full_height, x0, y0,
+                          cam_width, cam_height);
+    bin_spheres(&bins, &pf, img->width, img->height, full_width, full_height, x0, y0,
+                cam_width, cam_height);
+    Ray ray = {
+            .origin = {0, 0, 0},
+            .direction = {0, 0, 0}
+    };
+    for (int ty = 0; ty < bins.tiles_y; ty++) {
+        for (int tx = 0; tx < bins.tiles_x; tx++) {
+            int t = ty * bins.tiles_x + tx;
+            int *candidates = &bins.items[bins.start[t]];
+            int ncandidates = bins.start[t + 1] - bins.start[t];
+            int i1 = (ty + 1) * CULL_TILE < img->height ? (ty + 1) * CULL_TILE : img->height;
+            int j1 = (tx + 1) * CULL_TILE < img->width ? (tx + 1) * CULL_TILE : img->width;
+            for (int i = ty * CULL_TILE; i < i1; i++) {
+                for (int j = tx * CULL_TILE; j < j1; j++) {
+                    primary_ray_dir(&pf, i, j, ray.direction);
+                    scalar color[3] = {0, 0, 0};
+                    int best_o;
+                    scalar best_t;
+                    primary_closest_subset(&pf, ray.direction, candidates, ncandidates, &best_o, &best_t);
+                    if (best_o != -1) {
+                        shade(&ray, best_o, best_t, color);
+                        set_pixel_color(color, i, j, img);
+                    }
+                    else {
+                        set_pixel_color(background_color, i, j, img);
+                    }
+                }
+            }
+        }
+    }
+    free_tile_bins(&bins);
+    free_primary_frame(&pf);
+}
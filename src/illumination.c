@@ -11,7 +11,7 @@
  * @param color_val
  * @return the clamped color value
  */
-double clamp(double color_val){
+scalar clamp(scalar color_val){
     if (color_val < 0)
         return 0;
     else if (color_val > 1)
@@ -28,11 +28,11 @@ double clamp(double color_val){
  * @param KD - The diffuse color of the object
  * @param out_color - the resulting RGB color when we're done
  */
-void calculate_diffuse(double *N, double *L, double *IL, double *KD, double *out_color) {
+void calculate_diffuse(scalar *N, scalar *L, scalar *IL, scalar *KD, scalar *out_color) {
     // K_a*I_a should be added to the beginning of this whole thing, which is a constant and ambient light
-    double n_dot_l = v3_dot(N, L);
+    scalar n_dot_l = v3_dot(N, L);
     if (n_dot_l > 0) {
-        double diffuse_product[3];
+        scalar diffuse_product[3];
         diffuse_product[0] = KD[0] * IL[0];
         diffuse_product[1] = KD[1] * IL[1];
         diffuse_product[2] = KD[2] * IL[2];
@@ -58,12 +58,12 @@ void calculate_diffuse(double *N, double *L, double *IL, double *KD, double *out
  * @param IL - Illumination level of the light. In essence the "color" of the light
  * @param out_color - where we store the resulting RGB color value
  */
-void calculate_specular(double ns, double *L, double *R, double *N, double *V, double *KS, double *IL, double *out_color) {
-    double v_dot_r = v3_dot(V, R);
-    double n_dot_l = v3_dot(N, L);
+void calculate_specular(scalar ns, scalar *L, scalar *R, scalar *N, scalar *V, scalar *KS, scalar *IL, scalar *out_color) {
+    scalar v_dot_r = v3_dot(V, R);
+    scalar n_dot_l = v3_dot(N, L);
     if (v_dot_r > 0 && n_dot_l > 0) {
-        double vr_to_the_ns = pow(v_dot_r, ns);
-        double spec_product[3];
+        scalar vr_to_the_ns = fast_math ? fast_pow(v_dot_r, ns) : pow(v_dot_r, ns);
+        scalar spec_product[3];
         spec_product[0] = KS[0] * IL[0];
         spec_product[1] = KS[1] * IL[1];
         spec_product[2] = KS[2] * IL[2];
@@ -76,21 +76,20 @@ void calculate_specular(double ns, double *L, double *R, double *N, double *V, d
 
 /**
  * Calculates the angular attenuation of light based on predefined theta value and direction
- * @param light - light struct that we care about
+ * @param light - light struct that we care about (direction is normalized by read_json)
  * @param direction_to_object - direction vector from the light to the object
  * @return - returns the attenuation value
  */
-double calculate_angular_att(Light *light, double direction_to_object[3]) {
+scalar calculate_angular_att(Light *light, scalar direction_to_object[3]) {
     if (light->type != SPOTLIGHT)
         return 1.0;
     if (light->direction == NULL) {
         fprintf(stderr, "Error: calculate_angular_att: Can't have spotlight with no direction\n");
         exit(1);
     }
-    normalize(light->direction);
-    double theta_rad = light->theta_deg * (M_PI / 180.0);
-    double cos_theta = cos(theta_rad);
-    double vo_dot_vl = v3_dot(light->direction, direction_to_object);
+    scalar theta_rad = light->theta_deg * (M_PI / 180.0);
+    scalar cos_theta = cos(theta_rad);
+    scalar vo_dot_vl = v3_dot(light->direction, direction_to_object);
     if (vo_dot_vl < cos_theta)
         return 0.0;
     return pow(vo_dot_vl, light->ang_att0);
@@ -102,15 +101,23 @@ double calculate_angular_att(Light *light, double direction_to_object[3]) {
  * @param distance_to_light - distance from the object we're calculating this on to the light
  * @return - returns the attenuation value
  */
-double calculate_radial_att(Light *light, double distance_to_light) {
-    if (light->rad_att0 == 0 && light->rad_att1 == 0 && light->rad_att2 == 0) {
-        fprintf(stdout, "WARNING: calculate_radial_att: Found all 0s for attenuation. Assuming default values of radial attenuation\n");
-        light->rad_att2 = 1.0;
-    }
+scalar calculate_radial_att(Light *light, scalar distance_to_light) {
+    fix_radial_att(light);
     // if d_l == infinity, return 1
     if (distance_to_light > 99999999999999) return 1.0;
 
-    double dl_sqr = sqr(distance_to_light);
-    double denom = light->rad_att2 * dl_sqr + light->rad_att1 * distance_to_light + light->ang_att0;
+    scalar dl_sqr = sqr(distance_to_light);
+    scalar denom = light->rad_att2 * dl_sqr + light->rad_att1 * distance_to_light + light->ang_att0;
     return 1.0 / denom;
 }
+
+/**
+ * Gives a light with no radial attenuation coefficients the default ones
+ * @param light - light struct that we care about
+ */
+void fix_radial_att(Light *light) {
+    if (light->rad_att0 == 0 && light->rad_att1 == 0 && light->rad_att2 == 0) {
+        fprintf(stdout, "WARNING: calculate_radial_att: Found all 0s for attenuation. Assuming default values of radial attenuation\n");
+        light->rad_att2 = 1.0;
+    }
+}
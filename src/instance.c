@@ -0,0 +1,231 @@
+/* instance.c - ray traversal of instanced prototype groups
+ *
+ * An instance only stores a translation and a uniform scale, its spheres, planes and
+ * materials live once in the prototype group. Rays are moved into the instance's space
+ * instead of moving the geometry out: origin' = (origin - translate) / scale, and because the
+ * scale is uniform the unit direction stays the same and distances just divide by the scale.
+ * Every group has a bounding sphere so rays that miss a group skip all of its contents. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/instance.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/shadowmap.h"
+
+/**
+ * Tests whether a ray can hit anything in a group closer than max_t
+ * @param ray - ray in the group's space
+ * @param proto - the group
+ * @param max_t - only hits up to this distance count
+ * @return - false if the ray misses the group's bounding sphere or enters it too far away
+ */
+static boolean bound_hit(Ray *ray, Prototype *proto, scalar max_t) {
+    if (proto->radius == INFINITY)
+        return true;
+    scalar v[3];
+    v3_sub(ray->origin, proto->center, v);
+    scalar b = v3_dot(v, ray->direction);
+    scalar c = v3_dot(v, v) - sqr(proto->radius);
+    if (c > 0 && b > 0)
+        return false;   // outside and pointing away
+    scalar disc = sqr(b) - c;
+    if (disc < 0)
+        return false;
+    return -b - sqrt(disc) <= max_t;
+}
+
+/**
+ * Finds the closest hit of a ray against the contents of an instance
+ * @param ray - ray in the space the instance lives in
+ * @param inst - the instance
+ * @param exclude - path below this instance of a primitive to skip (the one a shadow ray
+ *                  leaves), NULL for none
+ * @param nexclude - entries in exclude
+ * @param max_t - only hits up to this distance count
+ * @param level - index in hit->path for this instance's objects
+ * @param hit - if not NULL, path and depth are filled in for the closest hit
+ * @return - distance to the closest hit in the outer space, -1 if there is none
+ */
+static scalar instance_closest(Ray *ray, Instance *inst, int *exclude, int nexclude, scalar max_t,
+                               int level, instance_hit *hit) {
+    scalar s = inst->scale;
+    Ray local;
+    v3_sub(ray->origin, inst->translate, local.origin);
+    v3_scale(local.origin, 1.0 / s, local.origin);
+    v3_copy(ray->direction, local.direction);
+    scalar local_max = max_t / s;
+
+    Prototype *proto = &prototypes[inst->prototype];
+    if (!bound_hit(&local, proto, local_max))
+        return -1;
+
+    scalar best_t = INFINITY;
+    for (int i=0; i<proto->nobjects; i++) {
+        object *obj = &proto->objects[i];
+        boolean on_path = exclude != NULL && exclude[0] == i;
+        if (on_path && nexclude == 1)
+            continue;   // the primitive itself
+        scalar t = -1;
+        switch (obj->type) {
+            case SPHERE:
+                t = sphere_intersect(&local, obj->sphere.position, obj->sphere.radius);
+                break;
+            case PLANE:
+                t = plane_intersect(&local, obj->plane.position, obj->plane.normal);
+                break;
+            case INSTANCE:
+                // only reports hits closer than the bound, so any hit is the new best
+                t = instance_closest(&local, &obj->instance, on_path ? exclude + 1 : NULL,
+                                     on_path ? nexclude - 1 : 0, best_t < local_max ? best_t : local_max,
+                                     level + 1, hit);
+                if (t > 0) {
+                    best_t = t;
+                    if (hit != NULL)
+                        hit->path[level] = i;
+                }
+                continue;
+            default:
+                break;
+        }
+        if (t > local_max)
+            continue;
+        if (t > 0 && t < best_t) {
+            best_t = t;
+            if (hit != NULL) {
+                hit->path[level] = i;
+                hit->depth = level + 1;
+            }
+        }
+    }
+    if (best_t == INFINITY)
+        return -1;
+    return best_t * s;
+}
+
+/**
+ * Closest hit of a ray against everything in an instance
+ * @param ray - world space ray
+ * @param inst - the instance
+ * @param max_t - only hits up to this distance count
+ * @return - distance to the hit, -1 if there is none
+ */
+scalar instance_intersect(Ray *ray, Instance *inst, scalar max_t) {
+    return instance_closest(ray, inst, NULL, 0, max_t, 1, NULL);
+}
+
+/**
+ * Follows a hit's path down the instance hierarchy and moves the primitive it ends on into
+ * world space. Colors and plane normals are shared with the prototype
+ * @param hit - hit with path and depth filled in
+ */
+void resolve_instance_hit(instance_hit *hit) {
+    scalar translate[3] = {0, 0, 0};
+    scalar s = 1;
+    object *obj = &objects[hit->path[0]];
+    for (int l=1; l<hit->depth; l++) {
+        scalar offset[3];
+        v3_scale(obj->instance.translate, s, offset);
+        v3_add(translate, offset, translate);
+        s *= obj->instance.scale;
+        obj = &prototypes[obj->instance.prototype].objects[hit->path[l]];
+    }
+    hit->leaf = *obj;
+    scalar *position = (obj->type == SPHERE) ? obj->sphere.position : obj->plane.position;
+    v3_scale(position, s, hit->position);
+    v3_add(hit->position, translate, hit->position);
+    if (obj->type == SPHERE) {
+        hit->leaf.sphere.position = hit->position;
+        hit->leaf.sphere.radius *= s;
+    }
+    else {
+        hit->leaf.plane.position = hit->position;
+    }
+}
+
+/**
+ * Shadow test for a point on an instanced primitive. Like a scalar shadow ray, everything but
+ * the primitive itself can block the light
+ * @param shadow_ray - ray from the point towards the light
+ * @param self - the primitive the point is on
+ * @param distance_to_light - distance from the point to the light
+ * @return - true if something is in the way
+ */
+static boolean instance_shadowed(Ray *shadow_ray, instance_hit *self, scalar distance_to_light) {
+    for (int i=0; objects[i].type != 0; i++) {
+        scalar t = -1;
+        switch (objects[i].type) {
+            case SPHERE:
+                t = sphere_intersect(shadow_ray, objects[i].sphere.position, objects[i].sphere.radius);
+                break;
+            case PLANE:
+                t = plane_intersect(shadow_ray, objects[i].plane.position, objects[i].plane.normal);
+                break;
+            case INSTANCE: {
+                boolean on_path = (i == self->path[0]);
+                t = instance_closest(shadow_ray, &objects[i].instance, on_path ? &self->path[1] : NULL,
+                                     on_path ? self->depth - 1 : 0, distance_to_light, 1, NULL);
+                break;
+            }
+            default:
+                break;
+        }
+        if (t > distance_to_light)
+            continue;
+        if (t > 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * shade for a hit on a scene instance: finds the primitive that was hit inside it and
+ * lights it like any other object
+ * @param ray - original ray
+ * @param obj_index - index of the instance in objects
+ * @param t - distance to the hit
+ * @param color - this will be the output color after shade calculations are done
+ */
+void shade_instance(Ray *ray, int obj_index, scalar t, scalar *color) {
+    instance_hit hit;
+    hit.path[0] = obj_index;
+    hit.depth = 1;
+    if (instance_closest(ray, &objects[obj_index].instance, NULL, 0, INFINITY, 1, &hit) < 0)
+        return;
+    resolve_instance_hit(&hit);
+
+    Ray ray_new;
+    v3_scale(ray->direction, t, ray_new.origin);
+    v3_add(ray_new.origin, ray->origin, ray_new.origin);
+    for (int r=0; r<nlight_runs; r++) {
+        light_kernel kernel = light_runs[r].shade;
+        for (int i=light_runs[r].first; i<light_runs[r].end; i++) {
+            v3_sub(lights[i].position, ray_new.origin, ray_new.direction);
+            scalar distance_to_light = v3_len(ray_new.direction);
+            normalize(ray_new.direction);
+
+            scalar visibility;
+            if (shadow_maps != NULL) {
+                // the map only knows the instance as a whole and takes it for the receiver itself,
+                // so the instance's other primitives are tested with a ray
+                visibility = shadow_map_visibility(i, obj_index, ray_new.origin, distance_to_light);
+                if (visibility > 0) {
+                    Ray shadow_test = ray_new;
+                    scalar test_distance = distance_to_light;
+                    offset_shadow_ray(&shadow_test, t, &test_distance);
+                    if (instance_closest(&shadow_test, &objects[obj_index].instance, &hit.path[1], hit.depth - 1,
+                                         test_distance, 1, NULL) > 0)
+                        visibility = 0;
+                }
+            }
+            else {
+                Ray shadow_test = ray_new;
+                scalar test_distance = distance_to_light;
+                offset_shadow_ray(&shadow_test, t, &test_distance);
+                visibility = instance_shadowed(&shadow_test, &hit, test_distance) ? 0 : 1;
+            }
+            kernel(ray, &hit.leaf, &ray_new, distance_to_light, &lights[i], visibility, color);
+        }
+    }
+}
@@ -8,20 +8,63 @@
 #include <strings.h>
 #include <ctype.h>
 #include "../include/json.h"
+#include "../include/vector_math.h"
+#include "../include/raycaster.h"
+#include "../include/memstats.h"
+#include "../include/primitives.h"
 
 /* global variables */
-int line = 1;                   // global var for line numbers as we parse
+_Thread_local int line = 1;     // line numbers as we parse, per parsing thread
 object objects[MAX_OBJECTS];    // allocate space for all objects in json file
 Light lights[MAX_OBJECTS];      // allocate space for lights
 int nlights;
 int nobjects;
+Material *materials;                    // material table, one entry per distinct material
+int nmaterials;
+Prototype prototypes[MAX_PROTOTYPES];   // prototype groups, referenced by instances
+int nprototypes;
+int ninstances;
+
+/* vectors parsed on this thread come from here instead of malloc when it's set */
+static _Thread_local json_arena *current_arena = NULL;
 
 /* helper functions */
 
+/**
+ * Makes this thread's parsed vectors come out of an arena (NULL goes back to malloc)
+ * @param arena - arena to allocate from, zeroed before first use
+ */
+void use_json_arena(json_arena *arena) {
+    current_arena = arena;
+}
+
+/* allocates memory for parsed data, from the thread's arena if it has one */
+void *json_alloc(size_t size) {
+    json_arena *arena = current_arena;
+    if (arena == NULL)
+        return mem_alloc(MEM_SCENE, size);
+    size = (size + 7) & ~(size_t)7;     // keep doubles aligned
+    if (arena->block == NULL || arena->used + size > arena->size) {
+        // the old block stays allocated, the scene points into it
+        arena->size = (size > JSON_ARENA_BLOCK) ? size : JSON_ARENA_BLOCK;
+        arena->block = mem_alloc(MEM_SCENE, arena->size);
+        arena->used = 0;
+    }
+    void *p = arena->block + arena->used;
+    arena->used += size;
+    return p;
+}
+
+/* releases temporary parsed data. Arena memory is only reclaimed with the whole arena */
+void json_free(void *p) {
+    if (current_arena == NULL)
+        mem_free(p);
+}
+
 // next_c wraps the getc function that provides error checking and line #
 // Problem: if we do ungetc, it could screw us up on the line #
 int next_c(FILE* json) {
-    int c = fgetc(json);
+    int c = getc_unlocked(json);   // every FILE is only read by one thread
 #ifdef DEBUG
     printf("next_c: '%c'\n", c);
 #endif
@@ -80,8 +123,8 @@ int check_light_color_val(double v) {
 }
 
 /* gets the next 3 values from FILE as vector coordinates */
-double* next_vector(FILE* json) {
-    double* v = malloc(sizeof(double)*3);
+scalar* next_vector(FILE* json) {
+    scalar* v = json_alloc(sizeof(scalar)*3);
     skip_ws(json);
     expect_c(json, '[');
     skip_ws(json);
@@ -100,8 +143,8 @@ double* next_vector(FILE* json) {
 }
 
 /* Checks that the next 3 values in the FILE are valid rgb numbers */
-double* next_color(FILE* json, boolean is_rgb) {
-    double* v = malloc(sizeof(double)*3);
+scalar* next_color(FILE* json, boolean is_rgb) {
+    scalar* v = json_alloc(sizeof(scalar)*3);
     skip_ws(json);
     expect_c(json, '[');
     skip_ws(json);
@@ -137,6 +180,14 @@ double* next_color(FILE* json, boolean is_rgb) {
     return v;
 }
 
+/* strdup counted against a memory category, released with mem_free */
+static char *copy_string(int category, const char *str) {
+    size_t size = strlen(str) + 1;
+    char *copy = mem_alloc(category, size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
 /* grabs a string wrapped in quotes from FILE */
 char* parse_string(FILE *json) {
     skip_ws(json);
@@ -157,325 +208,647 @@ char* parse_string(FILE *json) {
         c = next_c(json);
     }
     buffer[i] = 0;
-    return strdup(buffer); // returns a malloc'd version of buffer
+    return copy_string(MEM_IO, buffer); // returns a mem_alloc'd version of buffer
+}
+
+/* open addressing hash of material contents to their index, so interning stays O(1) */
+static int *material_slots;     // -1 for an empty slot
+static int material_capacity;   // materials allocated, the hash has twice as many slots
+
+/* FNV-1a over the bytes of a material */
+static unsigned int hash_material(Material *m) {
+    unsigned int h = 2166136261u;
+    unsigned char *bytes = (unsigned char*)m;
+    for (size_t i=0; i<sizeof(Material); i++) {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* puts material k into the hash, assumes there is room */
+static void hash_insert_material(int k) {
+    int nslots = 2 * material_capacity;
+    unsigned int slot = hash_material(&materials[k]) % nslots;
+    while (material_slots[slot] != -1)
+        slot = (slot + 1) % nslots;
+    material_slots[slot] = k;
 }
 
 /**
- * Reads all scene info from a json file and stores it in the global object
- * array. This does a lot of work...It checks for specific values and keys in
- * the file and places the values into the appropriate portion of the current
- * object.
- * @param json file handler with ASCII json data
+ * Finds the material with these colors in the material table, adding it if it's new
+ * @param diff_color - diffuse color
+ * @param spec_color - specular color
+ * @return - index of the material in materials
  */
-void read_json(FILE *json) {
-    //read in data from file
-    // expecting square bracket but we need to get rid of whitespace
-    skip_ws(json);
+int intern_material(scalar *diff_color, scalar *spec_color) {
+    Material m;
+    memset(&m, 0, sizeof(Material));
+    v3_copy(diff_color, m.diff_color);
+    v3_copy(spec_color, m.spec_color);
+    if (nmaterials > 0) {
+        int nslots = 2 * material_capacity;
+        unsigned int slot = hash_material(&m) % nslots;
+        while (material_slots[slot] != -1) {
+            if (memcmp(&materials[material_slots[slot]], &m, sizeof(Material)) == 0)
+                return material_slots[slot];
+            slot = (slot + 1) % nslots;
+        }
+    }
+    if (nmaterials == material_capacity) {
+        material_capacity = material_capacity ? 2 * material_capacity : 16;
+        materials = mem_realloc(MEM_MATERIALS, materials, sizeof(Material) * material_capacity);
+        mem_free(material_slots);
+        material_slots = mem_alloc(MEM_MATERIALS, sizeof(int) * 2 * material_capacity);
+        for (int i=0; i<2 * material_capacity; i++)
+            material_slots[i] = -1;
+        for (int i=0; i<nmaterials; i++)
+            hash_insert_material(i);
+    }
+    materials[nmaterials] = m;
+    hash_insert_material(nmaterials);
+    return nmaterials++;
+}
 
-    // find beginning of the list
-    int c  = next_c(json);
-    if (c != '[') {
-        fprintf(stderr, "Error: read_json: JSON file must begin with [\n");
+/**
+ * Finds a prototype group by name
+ * @param name - the group's name
+ * @return - index in prototypes, -1 if there's no such group
+ */
+int find_prototype(char *name) {
+    for (int i=0; i<nprototypes; i++) {
+        if (strcmp(prototypes[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Moves a parsed object out of the scene and into a prototype group, creating the group
+ * the first time it's named
+ * @param name - the group's name
+ * @param obj - sphere, plane or instance to add. It's copied, the caller clears it
+ */
+void add_to_prototype(char *name, object *obj) {
+    int k = find_prototype(name);
+    if (k == -1) {
+        if (nprototypes == MAX_PROTOTYPES) {
+            fprintf(stderr, "Error: add_to_prototype: Too many prototype groups: %d\n", line);
+            exit(1);
+        }
+        k = nprototypes++;
+        memset(&prototypes[k], 0, sizeof(Prototype));
+        prototypes[k].name = copy_string(MEM_SCENE, name);
+        prototypes[k].radius = -1;  // bounds are computed after parsing
+    }
+    Prototype *proto = &prototypes[k];
+    if (proto->sealed) {
+        fprintf(stderr, "Error: add_to_prototype: Group '%s' was already instanced and can't change: %d\n", name, line);
+        exit(1);
+    }
+    if (obj->type == INSTANCE) {
+        int depth = prototypes[obj->instance.prototype].depth + 1;
+        if (depth >= MAX_INSTANCE_DEPTH) {
+            fprintf(stderr, "Error: add_to_prototype: Instances nested more than %d deep: %d\n", MAX_INSTANCE_DEPTH, line);
+            exit(1);
+        }
+        if (depth > proto->depth)
+            proto->depth = depth;
+    }
+    // keep room for the type 0 terminator
+    if (proto->nobjects + 1 >= proto->capacity) {
+        int capacity = proto->capacity ? 2 * proto->capacity : 8;
+        proto->objects = mem_realloc(MEM_SCENE, proto->objects, sizeof(object) * capacity);
+        memset(&proto->objects[proto->capacity], 0, sizeof(object) * (capacity - proto->capacity));
+        proto->capacity = capacity;
+    }
+    proto->objects[proto->nobjects++] = *obj;
+}
+
+/**
+ * Computes the bounding sphere of a prototype group in its own space, from the bounds of
+ * its spheres and (transformed) instances. Groups with a plane are unbounded
+ * @param k - index in prototypes
+ */
+void bound_prototype(int k) {
+    Prototype *proto = &prototypes[k];
+    if (proto->radius >= 0)
+        return;     // done already
+    scalar lo[3] = {INFINITY, INFINITY, INFINITY};
+    scalar hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    // groups can hold a lot of objects, keep these off the stack
+    scalar (*centers)[3] = mem_alloc(MEM_SCRATCH, sizeof(scalar) * 3 * (proto->nobjects + 1));
+    scalar *radii = mem_alloc(MEM_SCRATCH, sizeof(scalar) * (proto->nobjects + 1));
+    for (int i=0; i<proto->nobjects; i++) {
+        object *obj = &proto->objects[i];
+        if (obj->type == SPHERE) {
+            v3_copy(obj->sphere.position, centers[i]);
+            radii[i] = obj->sphere.radius;
+        }
+        else if (obj->type == INSTANCE) {
+            Prototype *inner = &prototypes[obj->instance.prototype];
+            bound_prototype(obj->instance.prototype);
+            v3_scale(inner->center, obj->instance.scale, centers[i]);
+            v3_add(centers[i], obj->instance.translate, centers[i]);
+            radii[i] = inner->radius * obj->instance.scale;
+        }
+        else {
+            radii[i] = INFINITY;
+        }
+        if (radii[i] == INFINITY) {
+            v3_zero(proto->center);
+            proto->radius = INFINITY;
+            mem_free(centers);
+            mem_free(radii);
+            return;
+        }
+        for (int a=0; a<3; a++) {
+            if (centers[i][a] - radii[i] < lo[a]) lo[a] = centers[i][a] - radii[i];
+            if (centers[i][a] + radii[i] > hi[a]) hi[a] = centers[i][a] + radii[i];
+        }
+    }
+    for (int a=0; a<3; a++)
+        proto->center[a] = (lo[a] + hi[a]) / 2.0;
+    scalar radius = 0;
+    for (int i=0; i<proto->nobjects; i++) {
+        scalar d[3];
+        v3_sub(centers[i], proto->center, d);
+        if (v3_len(d) + radii[i] > radius)
+            radius = v3_len(d) + radii[i];
+    }
+    // pad a little so rounding never culls a real hit
+    proto->radius = radius * (1 + SCALAR_ROUNDING) + SCALAR_ROUNDING;
+    mem_free(centers);
+    mem_free(radii);
+}
+
+/**
+ * Normalizes plane normals and spotlight directions once after parsing. The intersection
+ * and shading code relies on these being unit vectors and never touches them again, so
+ * every pixel sees the same bits no matter which process or order it was rendered in.
+ */
+void normalize_scene() {
+    for (int i=0; i<MAX_OBJECTS && objects[i].type != 0; i++) {
+        if (objects[i].type == PLANE) {
+            if (objects[i].plane.normal == NULL) {
+                fprintf(stderr, "Error: normalize_scene: plane must have a normal\n");
+                exit(1);
+            }
+            normalize(objects[i].plane.normal);
+        }
+    }
+    for (int k=0; k<nprototypes; k++) {
+        for (int i=0; i<prototypes[k].nobjects; i++) {
+            if (prototypes[k].objects[i].type == PLANE) {
+                if (prototypes[k].objects[i].plane.normal == NULL) {
+                    fprintf(stderr, "Error: normalize_scene: plane in group '%s' must have a normal\n",
+                            prototypes[k].name);
+                    exit(1);
+                }
+                normalize(prototypes[k].objects[i].plane.normal);
+            }
+        }
+    }
+    for (int i=0; i<nlights; i++) {
+        if (lights[i].direction != NULL)
+            normalize(lights[i].direction);
+    }
+}
+
+/**
+ * Parses one object of the top-level array, from its '{' to its '}'. This checks for specific
+ * values and keys and places the values into the entry. Nothing global is touched besides
+ * the line counter, so separate parts of a file can be parsed on separate threads.
+ * @param json - file handler positioned at the object (leading whitespace is skipped)
+ * @param e - the parsed object, add_scene_entry puts it in the scene
+ */
+void parse_object(FILE *json, scene_entry *e) {
+    memset(e, 0, sizeof(scene_entry));
+    skip_ws(json);
+    expect_c(json, '{');
+    skip_ws(json);
+    char *key = parse_string(json);
+    if (strcmp(key, "type") != 0) {
+        fprintf(stderr, "Error: read_json: First key of an object must be 'type': %d\n", line);
         exit(1);
     }
+    mem_free(key);
+    skip_ws(json);
+    // get the colon
+    expect_c(json, ':');
     skip_ws(json);
-    c = next_c(json);
 
-    // check if file empty
-    if (c == ']' || c == EOF) {
-        fprintf(stderr, "Error: read_json: Empty json file\n");
+    char *type = parse_string(json);
+    if (strcmp(type, "camera") == 0) {
+        e->type = CAMERA;
+    }
+    else if (strcmp(type, "sphere") == 0) {
+        e->type = SPHERE;
+    }
+    else if (strcmp(type, "plane") == 0) {
+        e->type = PLANE;
+    }
+    else if (strcmp(type, "light") == 0) {
+        e->type = LIGHT;
+    }
+    else if (strcmp(type, "instance") == 0) {
+        e->type = INSTANCE;
+        e->obj.instance.scale = 1;
+    }
+    else {
+        fprintf(stderr, "Error: read_json: Unknown object type '%s': %d\n", type, line);
         exit(1);
     }
+    mem_free(type);
+    if (e->type != LIGHT)
+        e->obj.type = e->type;
+
     skip_ws(json);
 
-    int obj_counter = 0;
-    int light_counter = 0;
-    int obj_type;
-    boolean not_done = true;
-    // find the objects
-    while (not_done) {
-        //c  = next_c(json);
-        if (obj_counter > MAX_OBJECTS) {
-            fprintf(stderr, "Error: read_json: Number of objects is too large: %d\n", line);
-            exit(1);
-        }
-        if (c == ']') {
-            fprintf(stderr, "Error: read_json: Unexpected ']': %d\n", line);
-            fclose(json);
-            exit(1);
+    while (true) {
+        //  , }
+        int c = next_c(json);
+        if (c == '}') {
+            // stop parsing this object
+            break;
         }
-        if (c == '{') {     // found an object
+        else if (c == ',') {
+            // read another field
             skip_ws(json);
-            char *key = parse_string(json);
-            if (strcmp(key, "type") != 0) {
-                fprintf(stderr, "Error: read_json: First key of an object must be 'type': %d\n", line);
-                exit(1);
-            }
+            key = parse_string(json);
             skip_ws(json);
-            // get the colon
             expect_c(json, ':');
             skip_ws(json);
+            if (strcmp(key, "width") == 0) {
+                if (e->type != CAMERA) {
+                    fprintf(stderr, "Error: read_json: Width cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar temp = next_number(json);
+                if (temp <= 0) {
+                    fprintf(stderr, "Error: read_json: width must be positive: %d\n", line);
+                    exit(1);
+                }
+
+                e->obj.camera.width = temp;
 
-            char *type = parse_string(json);
-            if (strcmp(type, "camera") == 0) {
-                obj_type = CAMERA;
-                objects[obj_counter].type = CAMERA;
             }
-            else if (strcmp(type, "sphere") == 0) {
-                obj_type = SPHERE;
-                objects[obj_counter].type = SPHERE;
+            else if (strcmp(key, "height") == 0) {
+                if (e->type != CAMERA) {
+                    fprintf(stderr, "Error: read_json: Height cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar temp = next_number(json);
+                if (temp <= 0) {
+                    fprintf(stderr, "Error: read_json: height must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->obj.camera.height = temp;
             }
-            else if (strcmp(type, "plane") == 0) {
-                obj_type = PLANE;
-                objects[obj_counter].type = PLANE;
+            else if (strcmp(key, "radius") == 0) {
+                if (e->type != SPHERE) {
+                    fprintf(stderr, "Error: read_json: Radius cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar temp = next_number(json);
+                if (temp <= 0) {
+                    fprintf(stderr, "Error: read_json: radius must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->obj.sphere.radius = temp;
             }
-            else if (strcmp(type, "light") == 0) {
-                obj_type = LIGHT;
+            else if (strcmp(key, "theta") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: read_json: Theta cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar theta = next_number(json);
+                if (theta > 0.0) {
+                    e->light.type = SPOTLIGHT;
+                }
+                else if (theta < 0.0) {
+                    fprintf(stderr, "Error: read_json: theta must be >= 0: %d\n", line);
+                    exit(1);
+                }
+                e->light.theta_deg = theta;
             }
-            else {
-                exit(1);
+            else if (strcmp(key, "radial-a0") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: read_json: Radial-a0 cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar rad_a = next_number(json);
+                if (rad_a < 0) {
+                    fprintf(stderr, "Error: read_json: radial-a0 must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->light.rad_att0 = rad_a;
             }
-
-            skip_ws(json);
-
-            while (true) {
-                //  , }
-                c = next_c(json);
-                if (c == '}') {
-                    // stop parsing this object
-                    break;
-                }
-                else if (c == ',') {
-                    // read another field
-                    skip_ws(json);
-                    char* key = parse_string(json);
-                    skip_ws(json);
-                    expect_c(json, ':');
-                    skip_ws(json);
-                    if (strcmp(key, "width") == 0) {
-                        if (obj_type != CAMERA) {
-                            fprintf(stderr, "Error: read_json: Width cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double temp = next_number(json);
-                        if (temp <= 0) {
-                            fprintf(stderr, "Error: read_json: width must be positive: %d\n", line);
-                            exit(1);
-                        }
-
-                        objects[obj_counter].camera.width = temp;
-
-                    }
-                    else if (strcmp(key, "height") == 0) {
-                        if (obj_type != CAMERA) {
-                            fprintf(stderr, "Error: read_json: Height cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double temp = next_number(json);
-                        if (temp <= 0) {
-                            fprintf(stderr, "Error: read_json: height must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        objects[obj_counter].camera.height = temp;
-                    }
-                    else if (strcmp(key, "radius") == 0) {
-                        if (obj_type != SPHERE) {
-                            fprintf(stderr, "Error: read_json: Radius cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double temp = next_number(json);
-                        if (temp <= 0) {
-                            fprintf(stderr, "Error: read_json: radius must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        objects[obj_counter].sphere.radius = temp;
-                    }
-                    else if (strcmp(key, "theta") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: read_json: Theta cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double theta = next_number(json);
-                        if (theta > 0.0) {
-                            lights[light_counter].type = SPOTLIGHT;
-                        }
-                        else if (theta < 0.0) {
-                            fprintf(stderr, "Error: read_json: theta must be >= 0: %d\n", line);
-                            exit(1);
-                        }
-                        lights[light_counter].theta_deg = theta;
-                    }
-                    else if (strcmp(key, "radial-a0") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: read_json: Radial-a0 cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double rad_a = next_number(json);
-                        if (rad_a < 0) {
-                            fprintf(stderr, "Error: read_json: radial-a0 must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        lights[light_counter].rad_att0 = rad_a;
-                    }
-                    else if (strcmp(key, "radial-a1") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: read_json: Radial-a1 cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double rad_a = next_number(json);
-                        if (rad_a < 0) {
-                            fprintf(stderr, "Error: read_json: radial-a1 must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        lights[light_counter].rad_att1 = rad_a;
-                    }
-                    else if (strcmp(key, "radial-a2") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: read_json: Radial-a2 cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double rad_a = next_number(json);
-                        if (rad_a < 0) {
-                            fprintf(stderr, "Error: read_json: radial-a2 must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        lights[light_counter].rad_att2 = rad_a;
-                    }
-                    else if (strcmp(key, "angular-a0") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: read_json: Angular-a0 cannot be set on this type: %d\n", line);
-                            exit(1);
-                        }
-                        double ang_a = next_number(json);
-                        if (ang_a < 0) {
-                            fprintf(stderr, "Error: read_json: angular-a0 must be positive: %d\n", line);
-                            exit(1);
-                        }
-                        lights[light_counter].ang_att0 = ang_a;
-                    }
-                    else if (strcmp(key, "color") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: Just plain 'color' vector can only be applied to a light object\n");
-                            exit(1);
-                        }
-                        lights[light_counter].color = next_color(json, false);
-                    }
-                    else if (strcmp(key, "direction") == 0) {
-                        if (obj_type != LIGHT) {
-                            fprintf(stderr, "Error: Direction vector can only be applied to a light object\n");
-                            exit(1);
-                        }
-                        lights[light_counter].type = SPOTLIGHT;
-                        lights[light_counter].direction = next_vector(json);
-                    }
-                    else if (strcmp(key, "specular_color") == 0) {
-                        if (obj_type == SPHERE)
-                            objects[obj_counter].sphere.spec_color = next_color(json, true);
-                        else if (obj_type == PLANE)
-                            objects[obj_counter].plane.spec_color = next_color(json, true);
-                        else {
-                            fprintf(stderr, "Error: read_json: speculaor_color vector can't be applied here: %d\n", line);
-                            exit(1);
-                        }
-                    }
-                    else if (strcmp(key, "diffuse_color") == 0) {
-                        if (obj_type == SPHERE)
-                            objects[obj_counter].sphere.diff_color = next_color(json, true);
-                        else if (obj_type == PLANE)
-                            objects[obj_counter].plane.diff_color = next_color(json, true);
-                        else {
-                            fprintf(stderr, "Error: read_json: diffuse_color vector can't be applied here: %d\n", line);
-                            exit(1);
-                        }
-                    }
-                    else if (strcmp(key, "position") == 0) {
-                        if (obj_type == SPHERE)
-                            objects[obj_counter].sphere.position = next_vector(json);
-                        else if (obj_type == PLANE)
-                            objects[obj_counter].plane.position = next_vector(json);
-                        else if (obj_type == LIGHT)
-                            lights[light_counter].position = next_vector(json);
-                        else {
-                            fprintf(stderr, "Error: read_json: Position vector can't be applied here: %d\n", line);
-                            exit(1);
-                        }
-
-                    }
-                    else if (strcmp(key, "normal") == 0) {
-                        if (obj_type != PLANE) {
-                            fprintf(stderr, "Error: read_json: Normal vector can't be applied here: %d\n", line);
-                            exit(1);
-                        }
-                        else
-                            objects[obj_counter].plane.normal = next_vector(json);
-                    }
-                    else {
-                        fprintf(stderr, "Error: read_json: '%s' not a valid object: %d\n", key, line);
-                        exit(1);
-                    }
-                    skip_ws(json);
+            else if (strcmp(key, "radial-a1") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: read_json: Radial-a1 cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar rad_a = next_number(json);
+                if (rad_a < 0) {
+                    fprintf(stderr, "Error: read_json: radial-a1 must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->light.rad_att1 = rad_a;
+            }
+            else if (strcmp(key, "radial-a2") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: read_json: Radial-a2 cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar rad_a = next_number(json);
+                if (rad_a < 0) {
+                    fprintf(stderr, "Error: read_json: radial-a2 must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->light.rad_att2 = rad_a;
+            }
+            else if (strcmp(key, "angular-a0") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: read_json: Angular-a0 cannot be set on this type: %d\n", line);
+                    exit(1);
+                }
+                scalar ang_a = next_number(json);
+                if (ang_a < 0) {
+                    fprintf(stderr, "Error: read_json: angular-a0 must be positive: %d\n", line);
+                    exit(1);
+                }
+                e->light.ang_att0 = ang_a;
+            }
+            else if (strcmp(key, "color") == 0) {
+                if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: Just plain 'color' vector can only be applied to a light object\n");
+                    exit(1);
+                }
+                e->light.color = next_color(json, false);
+            }
+            else if (strcmp(key, "direction") == 0) {
+                if (e->type == CAMERA) {
+                    e->obj.camera.direction = next_vector(json);
+                }
+                else if (e->type != LIGHT) {
+                    fprintf(stderr, "Error: Direction vector can only be applied to a light or camera object\n");
+                    exit(1);
                 }
                 else {
-                    fprintf(stderr, "Error: read_json: Unexpected value '%c': %d\n", c, line);
+                    e->light.type = SPOTLIGHT;
+                    e->light.direction = next_vector(json);
+                }
+            }
+            else if (strcmp(key, "up") == 0) {
+                if (e->type != CAMERA) {
+                    fprintf(stderr, "Error: read_json: Up vector can only be applied to a camera: %d\n", line);
                     exit(1);
                 }
+                e->obj.camera.up = next_vector(json);
             }
-            skip_ws(json);
-            c = next_c(json);
-            if (c == ',') {
-                // noop
-                skip_ws(json);
+            else if (strcmp(key, "specular_color") == 0) {
+                if (e->type == SPHERE || e->type == PLANE) {
+                    scalar *v = next_color(json, true);
+                    v3_copy(v, e->spec_color);
+                    json_free(v);
+                    e->has_spec_color = true;
+                }
+                else {
+                    fprintf(stderr, "Error: read_json: speculaor_color vector can't be applied here: %d\n", line);
+                    exit(1);
+                }
             }
-            else if (c == ']') {
-                not_done = false;
+            else if (strcmp(key, "diffuse_color") == 0) {
+                if (e->type == SPHERE || e->type == PLANE) {
+                    scalar *v = next_color(json, true);
+                    v3_copy(v, e->diff_color);
+                    json_free(v);
+                    e->has_diff_color = true;
+                }
+                else {
+                    fprintf(stderr, "Error: read_json: diffuse_color vector can't be applied here: %d\n", line);
+                    exit(1);
+                }
             }
-            else {
-                fprintf(stderr, "Error: read_json: Expecting comma or ]: %d\n", line);
-                exit(1);
+            else if (strcmp(key, "position") == 0) {
+                if (e->type == SPHERE)
+                    e->obj.sphere.position = next_vector(json);
+                else if (e->type == PLANE)
+                    e->obj.plane.position = next_vector(json);
+                else if (e->type == LIGHT)
+                    e->light.position = next_vector(json);
+                else if (e->type == CAMERA)
+                    e->obj.camera.position = next_vector(json);
+                else {
+                    fprintf(stderr, "Error: read_json: Position vector can't be applied here: %d\n", line);
+                    exit(1);
+                }
+
             }
-        }
-        if (obj_type == LIGHT) {
-            if (lights[light_counter].type == SPOTLIGHT) {
-                if (lights[light_counter].direction == NULL) {
-                    fprintf(stderr, "Error: read_json: 'spotlight' light type must have a direction: %d\n", line);
+            else if (strcmp(key, "normal") == 0) {
+                if (e->type != PLANE) {
+                    fprintf(stderr, "Error: read_json: Normal vector can't be applied here: %d\n", line);
                     exit(1);
                 }
-                if (lights[light_counter].theta_deg == 0.0) {
-                    fprintf(stderr, "Error: read_json: 'spotlight' light type must have a theta value: %d\n", line);
+                else
+                    e->obj.plane.normal = next_vector(json);
+            }
+            else if (strcmp(key, "group") == 0) {
+                if (e->type != SPHERE && e->type != PLANE && e->type != INSTANCE) {
+                    fprintf(stderr, "Error: read_json: Only spheres, planes and instances can be in a group: %d\n", line);
                     exit(1);
                 }
+                mem_free(e->group);
+                e->group = parse_string(json);
             }
-            light_counter++;
-        }
-        else {
-            if (obj_type == SPHERE || obj_type == PLANE) {
-                if (objects[obj_counter].sphere.spec_color == NULL) {
-                    fprintf(stderr, "Error: read_json: object must have a specular color: %d\n", line);
+            else if (strcmp(key, "prototype") == 0) {
+                if (e->type != INSTANCE) {
+                    fprintf(stderr, "Error: read_json: Prototype can only be set on an instance: %d\n", line);
                     exit(1);
                 }
-                if (objects[obj_counter].sphere.diff_color == NULL) {
-                    fprintf(stderr, "Error: read_json: object must have a diffuse color: %d\n", line);
+                mem_free(e->prototype);
+                e->prototype = parse_string(json);   // looked up when the object is added
+            }
+            else if (strcmp(key, "translate") == 0) {
+                if (e->type != INSTANCE) {
+                    fprintf(stderr, "Error: read_json: Translate can only be set on an instance: %d\n", line);
                     exit(1);
                 }
+                scalar *v = next_vector(json);
+                v3_copy(v, e->obj.instance.translate);
+                json_free(v);
             }
-            if (obj_type == CAMERA) {
-                if (objects[obj_counter].camera.width == 0) {
-                    fprintf(stderr, "Error: read_json: camera must have a width: %d\n", line);
+            else if (strcmp(key, "scale") == 0) {
+                if (e->type != INSTANCE) {
+                    fprintf(stderr, "Error: read_json: Scale can only be set on an instance: %d\n", line);
                     exit(1);
                 }
-                if (objects[obj_counter].camera.height == 0) {
-                    fprintf(stderr, "Error: read_json: camera must have a height: %d\n", line);
+                scalar temp = next_number(json);
+                if (temp <= 0) {
+                    fprintf(stderr, "Error: read_json: scale must be positive: %d\n", line);
                     exit(1);
                 }
+                e->obj.instance.scale = temp;
+            }
+            else {
+                fprintf(stderr, "Error: read_json: '%s' not a valid object: %d\n", key, line);
+                exit(1);
             }
-            obj_counter++;
+            mem_free(key);
+            skip_ws(json);
+        }
+        else {
+            fprintf(stderr, "Error: read_json: Unexpected value '%c': %d\n", c, line);
+            exit(1);
+        }
+    }
+
+    if (e->type == LIGHT) {
+        if (e->light.type == SPOTLIGHT) {
+            if (e->light.direction == NULL) {
+                fprintf(stderr, "Error: read_json: 'spotlight' light type must have a direction: %d\n", line);
+                exit(1);
+            }
+            if (e->light.theta_deg == 0.0) {
+                fprintf(stderr, "Error: read_json: 'spotlight' light type must have a theta value: %d\n", line);
+                exit(1);
+            }
+        }
+    }
+    if (e->type == SPHERE || e->type == PLANE) {
+        if (!e->has_spec_color) {
+            fprintf(stderr, "Error: read_json: object must have a specular color: %d\n", line);
+            exit(1);
+        }
+        if (!e->has_diff_color) {
+            fprintf(stderr, "Error: read_json: object must have a diffuse color: %d\n", line);
+            exit(1);
+        }
+    }
+    if (e->type == CAMERA) {
+        if (e->obj.camera.width == 0) {
+            fprintf(stderr, "Error: read_json: camera must have a width: %d\n", line);
+            exit(1);
+        }
+        if (e->obj.camera.height == 0) {
+            fprintf(stderr, "Error: read_json: camera must have a height: %d\n", line);
+            exit(1);
+        }
+    }
+    if (e->type == INSTANCE && e->prototype == NULL) {
+        fprintf(stderr, "Error: read_json: instance must have a prototype: %d\n", line);
+        exit(1);
+    }
+    e->line = line;
+}
+
+/**
+ * Adds a parsed object to the scene: lights to lights, objects to objects or to their
+ * prototype group. Entries must be added in file order, since instances refer to groups
+ * defined before them
+ * @param e - entry filled in by parse_object
+ */
+void add_scene_entry(scene_entry *e) {
+    line = e->line;     // errors point at the object
+    if (e->type == LIGHT) {
+        if (nlights == MAX_OBJECTS) {
+            fprintf(stderr, "Error: read_json: Number of lights is too large: %d\n", line);
+            exit(1);
+        }
+        lights[nlights++] = e->light;
+        return;
+    }
+
+    object obj = e->obj;
+    if (e->type == SPHERE || e->type == PLANE) {
+        // the union puts the plane's material index in the same place
+        obj.sphere.material = intern_material(e->diff_color, e->spec_color);
+    }
+    if (e->type == INSTANCE) {
+        int k = find_prototype(e->prototype);
+        if (k == -1) {
+            fprintf(stderr, "Error: read_json: Unknown prototype group '%s', groups must come before their instances: %d\n", e->prototype, line);
+            exit(1);
+        }
+        prototypes[k].sealed = true;
+        obj.instance.prototype = k;
+        mem_free(e->prototype);
+    }
+    if (e->group != NULL) {
+        // belongs to a prototype group, not the scene itself
+        add_to_prototype(e->group, &obj);
+        mem_free(e->group);
+        return;
+    }
+    // the last slot stays empty, the renderer stops at the first object of type 0
+    if (nobjects == MAX_OBJECTS - 1) {
+        fprintf(stderr, "Error: read_json: Number of objects is too large: %d\n", line);
+        exit(1);
+    }
+    if (e->type == INSTANCE)
+        ninstances++;
+    objects[nobjects++] = obj;
+}
+
+/**
+ * Prepares the scene for rendering once every object is in: unit normals and directions,
+ * bounds for the prototype groups, the lights grouped for shading and the primitives bucketed
+ */
+void finish_scene() {
+    // normals and bounds are set up exactly even with fast_math, bounds must not come out short
+    boolean fast = fast_math;
+    fast_math = false;
+    normalize_scene();
+    for (int k=0; k<nprototypes; k++)
+        bound_prototype(k);
+    compile_lights();
+    compile_primitives();
+    fast_math = fast;
+}
+
+/**
+ * Reads all scene info from a json file and stores it in the global object
+ * array, one object at a time.
+ * @param json file handler with ASCII json data
+ */
+void read_json(FILE *json) {
+    //read in data from file
+    // expecting square bracket but we need to get rid of whitespace
+    skip_ws(json);
+
+    // find beginning of the list
+    int c  = next_c(json);
+    if (c != '[') {
+        fprintf(stderr, "Error: read_json: JSON file must begin with [\n");
+        exit(1);
+    }
+    skip_ws(json);
+    c = next_c(json);
+
+    // check if file empty
+    if (c == ']' || c == EOF) {
+        fprintf(stderr, "Error: read_json: Empty json file\n");
+        exit(1);
+    }
+    ungetc(c, json);
+
+    // find the objects
+    scene_entry e;
+    while (true) {
+        parse_object(json, &e);
+        add_scene_entry(&e);
+        skip_ws(json);
+        c = next_c(json);
+        if (c == ']')
+            break;
+        if (c != ',') {
+            fprintf(stderr, "Error: read_json: Expecting comma or ]: %d\n", line);
+            exit(1);
         }
-        if (not_done)
-            c = next_c(json);
     }
     fclose(json);
-    nlights = light_counter;
-    nobjects = obj_counter;
+    finish_scene();
 }
 
 /**
@@ -483,6 +856,12 @@ void read_json(FILE *json) {
  */
 void init_objects() {
     memset(objects, '\0', sizeof(objects));
+    nobjects = 0;
+    nmaterials = 0;
+    for (int i=0; i<2 * material_capacity; i++)
+        material_slots[i] = -1;
+    nprototypes = 0;
+    ninstances = 0;
 }
 
 /**
@@ -490,6 +869,7 @@ void init_objects() {
  */
 void init_lights() {
     memset(lights, '\0', sizeof(lights));
+    nlights = 0;
 }
 
 /* testing/debug functions */
@@ -503,18 +883,18 @@ void print_objects(object *obj) {
         }
             // TODO: add printing of diffuse colors as well
         else if (obj[i].type == SPHERE) {
-            printf("color: %lf %lf %lf\n", obj[i].sphere.spec_color[0],
-                   obj[i].sphere.spec_color[1],
-                   obj[i].sphere.spec_color[2]);
+            printf("color: %lf %lf %lf\n", materials[obj[i].sphere.material].spec_color[0],
+                   materials[obj[i].sphere.material].spec_color[1],
+                   materials[obj[i].sphere.material].spec_color[2]);
             printf("position: %lf %lf %lf\n", obj[i].sphere.position[0],
                    obj[i].sphere.position[1],
                    obj[i].sphere.position[2]);
             printf("radius: %lf\n", obj[i].sphere.radius);
         }
         else if (obj[i].type == PLANE) {
-            printf("color: %lf %lf %lf\n", obj[i].plane.spec_color[0],
-                   obj[i].plane.spec_color[1],
-                   obj[i].plane.spec_color[2]);
+            printf("color: %lf %lf %lf\n", materials[obj[i].plane.material].spec_color[0],
+                   materials[obj[i].plane.material].spec_color[1],
+                   materials[obj[i].plane.material].spec_color[2]);
             printf("position: %lf %lf %lf\n", obj[i].plane.position[0],
                    obj[i].plane.position[1],
                    obj[i].plane.position[2]);
@@ -0,0 +1,208 @@
+/* json_parallel.c - parses the top-level array of a scene file on several threads
+ *
+ * The file is memory mapped and a quick structural scan finds where each object of the
+ * top-level array starts and ends, keeping track of strings and nesting so braces inside
+ * them don't count. The objects are split into one contiguous run per thread, each thread
+ * parses its run with parse_object into its own entries and arena, and the entries are then
+ * added to the scene in file order, so object indices and materials come out exactly as
+ * they do from read_json. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/json_parallel.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/* one parsing thread's share of the objects */
+typedef struct parse_job_t {
+    pthread_t thread;
+    const char *data;
+    json_span *spans;
+    scene_entry *entries;   // entry k is the object of spans[k]
+    int count;
+    json_arena arena;
+} parse_job;
+
+/**
+ * Finds every object of the top-level array with a structural scan, without parsing them
+ * @param data - the file's contents
+ * @param length - bytes in data
+ * @param count - output number of objects found
+ * @return - malloc'd spans of the objects in file order
+ */
+json_span *scan_top_level(const char *data, size_t length, int *count) {
+    int line_no = 1;
+    size_t i = 0;
+    while (i < length && isspace((unsigned char)data[i])) {
+        if (data[i] == '\n')
+            line_no++;
+        i++;
+    }
+    if (i == length || data[i] != '[') {
+        fprintf(stderr, "Error: scan_top_level: JSON file must begin with [\n");
+        exit(1);
+    }
+    i++;
+
+    int capacity = 1024;
+    int n = 0;
+    json_span *spans = mem_alloc(MEM_IO, sizeof(json_span) * capacity);
+    int depth = 1;          // inside the top-level array
+    boolean in_string = false;
+    boolean expect_object = true;
+    boolean closed = false;
+    for (; i < length && !closed; i++) {
+        char c = data[i];
+        if (c == '\n')
+            line_no++;
+        if (in_string) {
+            if (c == '\\')
+                i++;        // skip the escaped character
+            else if (c == '"')
+                in_string = false;
+            continue;
+        }
+        if (depth > 1) {
+            if (c == '"')
+                in_string = true;
+            else if (c == '{' || c == '[')
+                depth++;
+            else if (c == '}' || c == ']') {
+                depth--;
+                if (depth == 1)
+                    spans[n++].end = i + 1;
+            }
+            continue;
+        }
+        // between the objects of the top-level array
+        if (isspace((unsigned char)c))
+            continue;
+        if (c == '{' && expect_object) {
+            if (n == capacity) {
+                capacity *= 2;
+                spans = mem_realloc(MEM_IO, spans, sizeof(json_span) * capacity);
+            }
+            spans[n].start = i;
+            spans[n].line = line_no;
+            depth++;
+            expect_object = false;
+        }
+        else if (c == ',' && !expect_object) {
+            expect_object = true;
+        }
+        else if (c == ']' && !expect_object) {
+            closed = true;
+        }
+        else if (c == ']' && n == 0) {
+            fprintf(stderr, "Error: scan_top_level: Empty json file\n");
+            exit(1);
+        }
+        else {
+            fprintf(stderr, "Error: scan_top_level: Unexpected '%c' in the top-level array: %d\n", c, line_no);
+            exit(1);
+        }
+    }
+    if (!closed) {
+        fprintf(stderr, "Error: scan_top_level: Unexpected EOF: %d\n", line_no);
+        exit(1);
+    }
+    *count = n;
+    return spans;
+}
+
+/* parsing thread: parses its run of objects into its own entries and arena */
+static void *parse_main(void *arg) {
+    parse_job *job = arg;
+    size_t base = job->spans[0].start;
+    size_t length = job->spans[job->count - 1].end - base;
+    FILE *f = fmemopen((void*)(job->data + base), length, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: parse_main: Failed to open objects at line %d\n", job->spans[0].line);
+        exit(1);
+    }
+    use_json_arena(&job->arena);
+    for (int k=0; k<job->count; k++) {
+        // step over the separator, the scan already checked it. Seeking would throw
+        // away the stream's buffer every time
+        if (k > 0) {
+            for (size_t skip = job->spans[k].start - job->spans[k - 1].end; skip > 0; skip--)
+                fgetc(f);
+        }
+        line = job->spans[k].line;
+        parse_object(f, &job->entries[k]);
+    }
+    use_json_arena(NULL);
+    fclose(f);
+    return NULL;
+}
+
+/**
+ * Reads all scene info from a json file like read_json, parsing on several threads
+ * @param path - scene file name
+ * @param nthreads - number of parsing threads
+ */
+void read_json_parallel(const char *path, int nthreads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: read_json_parallel: Failed to open input file '%s'\n", path);
+        exit(1);
+    }
+    size_t length = st.st_size;
+    if (length == 0) {
+        fprintf(stderr, "Error: read_json_parallel: Empty json file\n");
+        exit(1);
+    }
+    char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: read_json_parallel: Failed to map input file '%s'\n", path);
+        exit(1);
+    }
+
+    int count;
+    json_span *spans = scan_top_level(data, length, &count);
+    scene_entry *entries = mem_alloc(MEM_IO, sizeof(scene_entry) * count);
+
+    // contiguous runs of about the same number of bytes
+    if (nthreads > count)
+        nthreads = count;
+    parse_job jobs[MAX_PARSE_THREADS];
+    size_t bytes = spans[count - 1].end - spans[0].start;
+    int first = 0;
+    for (int t=0; t<nthreads; t++) {
+        size_t goal = spans[0].start + bytes / nthreads * (t + 1);
+        int last = first + 1;
+        while (last < count && (t == nthreads - 1 || spans[last].start < goal))
+            last++;
+        if (count - last < nthreads - 1 - t)
+            last = count - (nthreads - 1 - t);   // leave at least one object for each later thread
+        memset(&jobs[t], 0, sizeof(parse_job));
+        jobs[t].data = data;
+        jobs[t].spans = &spans[first];
+        jobs[t].entries = &entries[first];
+        jobs[t].count = last - first;
+        first = last;
+        if (pthread_create(&jobs[t].thread, NULL, parse_main, &jobs[t]) != 0) {
+            fprintf(stderr, "Error: read_json_parallel: Failed to start parsing thread\n");
+            exit(1);
+        }
+    }
+    for (int t=0; t<nthreads; t++)
+        pthread_join(jobs[t].thread, NULL);
+
+    // merge in file order so indices and materials match a sequential parse
+    for (int k=0; k<count; k++)
+        add_scene_entry(&entries[k]);
+    finish_scene();
+
+    mem_free(entries);
+    mem_free(spans);
+    munmap(data, length);
+}
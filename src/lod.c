@@ -0,0 +1,134 @@
+/* lod.c - level of detail for spheres that project to less than a pixel
+ *
+ * Before the frame renders, every sphere's radius is projected onto the view plane (z = 1) and
+ * measured in pixels. Spheres below the threshold are moved behind the objects array's
+ * terminator: every intersection loop stops there, so neither primary nor shadow rays test
+ * them any more, yet shade still finds them by index. After the frame is rendered they are
+ * splatted far to near. Each one is shaded once at the point facing the camera and blended
+ * into the 2x2 pixels around its projected center, weighted by how far the center is from
+ * each pixel and by how much of a pixel the projected disk covers. One ray from the camera
+ * towards the center stands in for the depth test. Splatted spheres cast no shadows. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/lod.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/illumination.h"
+#include "../include/primitives.h"
+
+/* the splatted spheres sit at objects[lod_first] to objects[lod_first + lod_count - 1] */
+static int lod_first = 0;
+static int lod_count = 0;
+
+/* projected radius of a sphere in pixels along x and y, 0 if it isn't fully in front of the camera */
+static void projected_radius(object *obj, int width, int height, scalar cam_width, scalar cam_height,
+                             scalar *rx, scalar *ry) {
+    scalar z = obj->sphere.position[2];
+    if (z <= obj->sphere.radius) {
+        *rx = *ry = 0;
+        return;
+    }
+    *rx = obj->sphere.radius / z * width / cam_width;
+    *ry = obj->sphere.radius / z * height / cam_height;
+}
+
+/**
+ * Moves the spheres that project smaller than max_radius pixels out of the ray traced set.
+ * Must run after the scene is read and before shadow maps are built or the frame renders
+ * @param width - frame width in pixels
+ * @param height - frame height in pixels
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param max_radius - projected radius in pixels below which a sphere is splatted
+ * @return - number of spheres that will be splatted
+ */
+int split_lod_spheres(int width, int height, scalar cam_width, scalar cam_height, scalar max_radius) {
+    static object splats[MAX_OBJECTS];
+    int kept = 0, nsplats = 0;
+    for (int i=0; objects[i].type != 0; i++) {
+        scalar rx = 0, ry = 0;
+        if (objects[i].type == SPHERE)
+            projected_radius(&objects[i], width, height, cam_width, cam_height, &rx, &ry);
+        if (rx > 0 && rx < max_radius && ry < max_radius)
+            splats[nsplats++] = objects[i];
+        else
+            objects[kept++] = objects[i];
+    }
+    // terminator, then the splats where the intersection loops never look
+    memset(&objects[kept], 0, sizeof(object));
+    memcpy(&objects[kept + 1], splats, sizeof(object) * nsplats);
+    nobjects = kept;
+    lod_first = kept + 1;
+    lod_count = nsplats;
+    compile_primitives();
+    return nsplats;
+}
+
+static int farther_first(const void *a, const void *b) {
+    scalar za = ((const object *)a)->sphere.position[2];
+    scalar zb = ((const object *)b)->sphere.position[2];
+    return (za < zb) - (za > zb);
+}
+
+/* blends color over a pixel with the given weight */
+static void blend_pixel(image *img, int row, int col, scalar *color, scalar weight) {
+    RGBPixel *p = &img->pixmap[(size_t)row * img->width + col];
+    scalar mixed[3] = {
+            (1 - weight) * p->r / MAX_COLOR_VAL + weight * clamp(color[0]),
+            (1 - weight) * p->g / MAX_COLOR_VAL + weight * clamp(color[1]),
+            (1 - weight) * p->b / MAX_COLOR_VAL + weight * clamp(color[2])
+    };
+    for (int k=0; k<3; k++)
+        mixed[k] += (scalar)0.5 / MAX_COLOR_VAL;   // round rather than truncate the blend
+    set_pixel_color(mixed, row, col, img);
+}
+
+/**
+ * Splats the spheres split_lod_spheres took out into a rendered frame
+ * @param img - the rendered frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void splat_lod_spheres(image *img, scalar cam_width, scalar cam_height) {
+    qsort(&objects[lod_first], lod_count, sizeof(object), farther_first);
+    scalar pixwidth = cam_width / img->width;
+    scalar pixheight = cam_height / img->height;
+    for (int s=lod_first; s<lod_first + lod_count; s++) {
+        object *obj = &objects[s];
+        scalar *c = obj->sphere.position;
+        // pixel coordinates of the projected center, pixel centers at whole numbers
+        scalar px = (c[0] / c[2] + cam_width / 2) / pixwidth - (scalar)0.5;
+        scalar py = (cam_height / 2 - c[1] / c[2]) / pixheight - (scalar)0.5;
+        int col = (int)floor(px), row = (int)floor(py);
+        if (col < -1 || col >= img->width || row < -1 || row >= img->height)
+            continue;
+
+        Ray ray = {.origin = {0, 0, 0}};
+        v3_copy(c, ray.direction);
+        normalize(ray.direction);
+        scalar t = v3_len(c) - obj->sphere.radius;
+        int best_o;
+        scalar best_t;
+        get_dist_and_idx_closest_obj(&ray, -1, t, &best_o, &best_t);
+        if (best_o != -1)
+            continue;   // something traced is in front
+
+        scalar color[3] = {0, 0, 0};
+        shade(&ray, s, t, color);
+        scalar rx, ry;
+        projected_radius(obj, img->width, img->height, cam_width, cam_height, &rx, &ry);
+        scalar coverage = M_PI * rx * ry;   // the disk's area in pixels, spread over the four
+        scalar fx = px - col, fy = py - row;
+        scalar weights[2][2] = {{(1 - fx) * (1 - fy), fx * (1 - fy)}, {(1 - fx) * fy, fx * fy}};
+        for (int dy=0; dy<2; dy++) {
+            for (int dx=0; dx<2; dx++) {
+                int y = row + dy, x = col + dx;
+                if (y >= 0 && y < img->height && x >= 0 && x < img->width && weights[dy][dx] > 0)
+                    blend_pixel(img, y, x, color, fmin(1, coverage * weights[dy][dx]));
+            }
+        }
+    }
+}
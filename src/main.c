@@ -7,17 +7,79 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <time.h>
 #include "../include/json.h"
 #include "../include/vector_math.h"
 #include "../include/raycaster.h"
 #include "../include/ppmrw.h"
+#include "../include/distributed.h"
+#include "../include/writer.h"
+#include "../include/shadowmap.h"
+#include "../include/json_parallel.h"
+#include "../include/watch.h"
+#include "../include/sequence.h"
+#include "../include/estimate.h"
+#include "../include/mipmap.h"
+#include "../include/preview.h"
+#include "../include/lod.h"
+#include "../include/tiles.h"
+#include "../include/views.h"
 #include "../include/base.h"
+#include "../include/memstats.h"
+
+/* example usage: raycast width height input.json out.ppm [options]
+ *   --region x0,y0,x1,y1   only render this part of the frame, out.ppm gets its offset in a comment
+ *   --workers N            fork N worker processes and stitch their fragments into out.ppm
+ *   --worker-cmd CMD       drive another worker started by CMD (e.g. ssh host raycast ... --worker)
+ *   --worker               be a worker: read regions on stdin, write fragments to stdout
+ *   --mmap                 render straight into a memory mapped out.ppm instead of a malloc'd buffer
+ *   --format p6|p3|p6gz    output encoding (p6gz is gzip compressed P6)
+ *   --async-write          encode and write finished rows on a writer thread while rendering
+ *   --engine NAME          renderer to use: scalar (default), wavefront, primary, culled or raster
+ *   --shadow-maps RES      approximate shadow rays with RESxRES depth maps rendered from each light
+ *   --pcf N                filter shadow map lookups over NxN texels
+ *   --shadow-error         also render with ray traced shadows and report the shadow maps' pixel error
+ *   --parse-threads N      parse the scene file on N threads
+ *   --watch                keep running, re-render out.ppm whenever input.json changes
+ *   --frames N             render an animation: input.json and out.ppm are patterns with a %d for
+ *                          frames 0 to N-1, and each frame reuses what it can from the one before
+ *   --compare REF.ppm      report the pixel difference between the render and a reference image,
+ *                          e.g. the single precision build against the double precision one
+ *   --fast-math            render with approximate square roots and powers (vector_math.h)
+ *   --fast-math-error N    also render exactly, report the fast math error and fail if any channel
+ *                          is off by more than N levels
+ *   --estimate COSTS.cal   predict rays and wall time from scene statistics and the benchmark's
+ *                          calibration (bench --calibrate COSTS.cal) without rendering
+ *   --estimate-error COSTS.cal  predict, then render and report how far off the prediction was
+ *   --mips N               also write N half size levels, out.mip1.ppm to out.mipN.ppm, filtered
+ *                          from the rows on a second thread while the frame renders
+ *   --mip-filter box|tent  filter for --mips: 2x2 average (default) or a wider, smoother tent
+ *   --preview checker|quarter  trace half or a quarter of the pixels and fill in the rest from
+ *                          neighbours that agree on object and depth, tracing the ones that don't
+ *   --lod PX               splat spheres that project smaller than PX pixels in radius (e.g. 0.5)
+ *                          instead of ray tracing them
+ *   --stats                print current and peak memory per category on exit
+ *   --mem-limit MB         fail as soon as tracked memory would go over MB megabytes
+ *   --threads N            render in tiles on N threads
+ *   --tile SIZE|auto       tile size for --threads (default 32), or auto to try a few sizes and
+ *                          orders on a sparse subset of tiles and keep the fastest
+ *   --tile-order NAME      order tiles are taken in: scanline (default), morton, hilbert or center
+ *   --tile-cache FILE      where --tile auto keeps its choice per scene (default .tile_tuning)
+ *   --views                render every camera in the scene, with its position, direction and up,
+ *                          to out.view0.ppm, out.view1.ppm, ... sharing one scene build and one
+ *                          tile queue (--threads, --tile and --tile-order apply) */
+/* atexit handler for --stats, so every way out of main reports. Not from forked workers */
+static pid_t stats_pid;
+static void print_stats_on_exit(void) {
+    if (getpid() == stats_pid)
+        print_mem_stats(stdout);
+}
 
-/* example usage: raycast width height input.json out.ppm */
 int main(int argc, char *argv[]) {
     /* testing that we can read json objects */
-    if (argc != 5) {
-        fprintf(stderr, "Error: main: You must have 4 arguments\n");
+    if (argc < 5) {
+        fprintf(stderr, "Error: main: You must have at least 4 arguments\n");
         exit(1);
     }
     /* test dimensions */
@@ -26,44 +88,603 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /* open the input json file */
-    FILE *json = fopen(argv[3], "rb");
-    if (json == NULL) {
-        fprintf(stderr, "Error: main: Failed to open input file '%s'\n", argv[3]);
+    /* create image */
+    image img;
+    img.width = atoi(argv[1]);
+    img.height = atoi(argv[2]);
+    img.max_color_val = MAX_COLOR_VAL;
+
+    /* options */
+    char *region_str = NULL;
+    int nlocal = 0;
+    char *worker_cmds[MAX_WORKERS];
+    int ncmds = 0;
+    boolean is_worker = false;
+    boolean use_mmap = false;
+    boolean async_write = false;
+    int format = FORMAT_P6;
+    int shadow_res = 0;
+    int pcf = DEFAULT_SHADOW_PCF;
+    boolean shadow_error = false;
+    int parse_threads = 1;
+    boolean watch = false;
+    int frames = 0;
+    char *compare_path = NULL;
+    boolean fast = false;
+    int fast_error = -1;
+    char *costs_path = NULL;
+    boolean estimate_error = false;
+    int mips = 0;
+    int mip_filter = MIP_BOX;
+    int preview = 0;
+    double lod_radius = 0;
+    boolean stats = false;
+    int threads = 0;
+    tile_plan plan = {DEFAULT_TILE_SIZE, TILE_SCANLINE};
+    boolean tile_auto = false;
+    char *tile_cache = DEFAULT_TILE_CACHE;
+    boolean multi_view = false;
+    for (int i=5; i<argc; i++) {
+        if (strcmp(argv[i], "--region") == 0 && i + 1 < argc) {
+            region_str = argv[++i];
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            nlocal = atoi(argv[++i]);
+            if (nlocal <= 0 || nlocal > MAX_WORKERS) {
+                fprintf(stderr, "Error: main: --workers must be 1-%d\n", MAX_WORKERS);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--worker-cmd") == 0 && i + 1 < argc) {
+            if (ncmds == MAX_WORKERS) {
+                fprintf(stderr, "Error: main: Too many --worker-cmd options\n");
+                exit(1);
+            }
+            worker_cmds[ncmds++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--worker") == 0) {
+            is_worker = true;
+        }
+        else if (strcmp(argv[i], "--mmap") == 0) {
+            use_mmap = true;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format = parse_format(argv[++i]);
+            if (format < 0)
+                exit(1);
+        }
+        else if (strcmp(argv[i], "--async-write") == 0) {
+            async_write = true;
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            render_engine = parse_engine(argv[++i]);
+            if (render_engine < 0)
+                exit(1);
+        }
+        else if (strcmp(argv[i], "--shadow-maps") == 0 && i + 1 < argc) {
+            shadow_res = atoi(argv[++i]);
+            if (shadow_res <= 0) {
+                fprintf(stderr, "Error: main: --shadow-maps resolution must be > 0\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--pcf") == 0 && i + 1 < argc) {
+            pcf = atoi(argv[++i]);
+            if (pcf <= 0) {
+                fprintf(stderr, "Error: main: --pcf must be > 0\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--shadow-error") == 0) {
+            shadow_error = true;
+        }
+        else if (strcmp(argv[i], "--parse-threads") == 0 && i + 1 < argc) {
+            parse_threads = atoi(argv[++i]);
+            if (parse_threads <= 0 || parse_threads > MAX_PARSE_THREADS) {
+                fprintf(stderr, "Error: main: --parse-threads must be 1-%d\n", MAX_PARSE_THREADS);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+            if (frames <= 0) {
+                fprintf(stderr, "Error: main: --frames must be > 0\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            compare_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fast-math") == 0) {
+            fast = true;
+        }
+        else if (strcmp(argv[i], "--fast-math-error") == 0 && i + 1 < argc) {
+            fast_error = atoi(argv[++i]);
+            if (fast_error < 0) {
+                fprintf(stderr, "Error: main: --fast-math-error must be >= 0\n");
+                exit(1);
+            }
+            fast = true;
+        }
+        else if ((strcmp(argv[i], "--estimate") == 0 || strcmp(argv[i], "--estimate-error") == 0) && i + 1 < argc) {
+            estimate_error = (strcmp(argv[i], "--estimate-error") == 0);
+            costs_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mips") == 0 && i + 1 < argc) {
+            mips = atoi(argv[++i]);
+            if (mips <= 0 || mips > MAX_MIP_LEVELS) {
+                fprintf(stderr, "Error: main: --mips must be 1-%d\n", MAX_MIP_LEVELS);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc) {
+            mip_filter = parse_mip_filter(argv[++i]);
+            if (mip_filter < 0)
+                exit(1);
+        }
+        else if (strcmp(argv[i], "--preview") == 0 && i + 1 < argc) {
+            preview = parse_preview_mode(argv[++i]);
+            if (preview < 0)
+                exit(1);
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        }
+        else if (strcmp(argv[i], "--mem-limit") == 0 && i + 1 < argc) {
+            double mb = atof(argv[++i]);
+            if (mb <= 0) {
+                fprintf(stderr, "Error: main: --mem-limit must be > 0\n");
+                exit(1);
+            }
+            set_mem_limit((size_t)(mb * 1048576));
+        }
+        else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc) {
+            lod_radius = atof(argv[++i]);
+            if (lod_radius <= 0) {
+                fprintf(stderr, "Error: main: --lod must be > 0\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0 || threads > MAX_RENDER_THREADS) {
+                fprintf(stderr, "Error: main: --threads must be 1-%d\n", MAX_RENDER_THREADS);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "auto") == 0)
+                tile_auto = true;
+            else if ((plan.size = atoi(argv[i])) <= 0) {
+                fprintf(stderr, "Error: main: --tile must be a size > 0 or auto\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--tile-order") == 0 && i + 1 < argc) {
+            plan.order = parse_tile_order(argv[++i]);
+            if (plan.order < 0)
+                exit(1);
+        }
+        else if (strcmp(argv[i], "--tile-cache") == 0 && i + 1 < argc) {
+            tile_cache = argv[++i];
+        }
+        else if (strcmp(argv[i], "--views") == 0) {
+            multi_view = true;
+        }
+        else {
+            fprintf(stderr, "Error: main: Unknown or incomplete option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (use_mmap && (async_write || format != FORMAT_P6)) {
+        fprintf(stderr, "Error: main: --mmap already is the P6 output, it can't be combined with --format or --async-write\n");
+        exit(1);
+    }
+    if (async_write && (nlocal > 0 || ncmds > 0)) {
+        fprintf(stderr, "Error: main: --async-write needs rows in order, it can't be combined with workers\n");
         exit(1);
     }
 
+    if (shadow_error && shadow_res == 0)
+        shadow_res = DEFAULT_SHADOW_RES;
+    if (shadow_error && (use_mmap || async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker)) {
+        fprintf(stderr, "Error: main: --shadow-error renders in this process only, it can't be combined with other modes\n");
+        exit(1);
+    }
+
+    if (costs_path != NULL && (region_str != NULL || is_worker || frames > 0)) {
+        fprintf(stderr, "Error: main: --estimate is for whole frames, it can't be combined with --region, --worker or --frames\n");
+        exit(1);
+    }
+    if (estimate_error && (async_write || ncmds > 0 || shadow_error || fast_error >= 0 || watch)) {
+        fprintf(stderr, "Error: main: --estimate-error times a plain render, it can't be combined with --async-write, --worker-cmd, --shadow-error, --fast-math-error or --watch\n");
+        exit(1);
+    }
+
+    if (fast_error >= 0 && (use_mmap || async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+                            shadow_error)) {
+        fprintf(stderr, "Error: main: --fast-math-error renders in this process only, it can't be combined with other modes\n");
+        exit(1);
+    }
+
+    if (watch && (use_mmap || async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+                  shadow_error || fast_error >= 0 || parse_threads > 1)) {
+        fprintf(stderr, "Error: main: --watch re-renders in this process only, it can't be combined with other modes\n");
+        exit(1);
+    }
+
+    if (compare_path != NULL && (async_write || region_str != NULL || is_worker || frames > 0)) {
+        fprintf(stderr, "Error: main: --compare needs the whole frame in memory, it can't be combined with --async-write, --region, --worker or --frames\n");
+        exit(1);
+    }
+
+    if (mips > 0 && (region_str != NULL || is_worker || frames > 0 || watch)) {
+        fprintf(stderr, "Error: main: --mips is for a single whole frame, it can't be combined with --region, --worker, --frames or --watch\n");
+        exit(1);
+    }
+
+    if (preview > 0 && (async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+                        shadow_error || fast_error >= 0 || frames > 0 || watch)) {
+        fprintf(stderr, "Error: main: --preview renders whole frames in this process only, it can't be combined with other modes\n");
+        exit(1);
+    }
+
+    if (lod_radius > 0 && (async_write || ncmds > 0 || region_str != NULL || is_worker || shadow_error ||
+                           fast_error >= 0 || frames > 0 || watch)) {
+        fprintf(stderr, "Error: main: --lod splats into the finished frame in this process, it can't be combined with --async-write, --worker-cmd, --region, --worker, --shadow-error, --fast-math-error, --frames or --watch\n");
+        exit(1);
+    }
+
+    if (threads > 0 && (async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+                        shadow_error || fast_error >= 0 || preview > 0 || frames > 0 || watch)) {
+        fprintf(stderr, "Error: main: --threads renders a single whole frame in this process, it can't be combined with other modes\n");
+        exit(1);
+    }
+
+    if (multi_view && (use_mmap || async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+                       shadow_error || fast_error >= 0 || frames > 0 || watch || preview > 0 || lod_radius > 0 ||
+                       mips > 0 || compare_path != NULL || costs_path != NULL || tile_auto)) {
+        fprintf(stderr, "Error: main: --views writes plain frames of every camera, it can only be combined with --format, --shadow-maps, --pcf, --parse-threads, --fast-math, --stats, --mem-limit, --threads, --tile SIZE and --tile-order\n");
+        exit(1);
+    }
+
+    /* the scene's fixed size arrays are there from the start, everything else counts as it's allocated */
+    mem_add(MEM_SCENE, sizeof(objects) + sizeof(lights) + sizeof(prototypes));
+    if (stats) {
+        stats_pid = getpid();
+        atexit(print_stats_on_exit);
+    }
+
+    if (frames > 0) {
+        if (use_mmap || async_write || nlocal > 0 || ncmds > 0 || region_str != NULL || is_worker ||
+            shadow_error || fast_error >= 0 || parse_threads > 1 || watch) {
+            fprintf(stderr, "Error: main: --frames renders in this process only, it can't be combined with other modes\n");
+            exit(1);
+        }
+        if (check_frame_pattern(argv[3]) < 0 || check_frame_pattern(argv[4]) < 0)
+            exit(1);
+        fast_math = fast;
+        render_sequence(argv[3], argv[4], frames, format, &img, shadow_res, pcf);
+        return 0;
+    }
+
+    region r;
+    if (region_str != NULL && parse_region(region_str, img.width, img.height, &r) < 0)
+        exit(1);
+
     /* initialize object and light arrays to have all null values */
     init_lights();
     init_objects();
 
     /* fill object and light arrays with scene info */
-    read_json(json);
+    if (parse_threads > 1) {
+        read_json_parallel(argv[3], parse_threads);
+    }
+    else {
+        /* open the input json file */
+        FILE *json = fopen(argv[3], "rb");
+        if (json == NULL) {
+            fprintf(stderr, "Error: main: Failed to open input file '%s'\n", argv[3]);
+            exit(1);
+        }
+        read_json(json);
+    }
 
-    /* create image */
-    image img;
-    img.width = atoi(argv[1]);
-    img.height = atoi(argv[2]);
-    img.pixmap = (RGBPixel*) malloc(sizeof(RGBPixel)*img.width*img.height);
-    //print_pixels(img.pixmap, img.width, img.height);
     int pos = get_camera(objects);
     if (pos == -1) {
         fprintf(stderr, "Error: main: No camera object found in data\n");
         exit(1);
     }
+    if (!multi_view && camera_is_posed(&objects[pos])) {
+        fprintf(stderr, "Error: main: The camera has a position, direction or up vector, only --views renders those\n");
+        exit(1);
+    }
+    double cam_width = objects[pos].camera.width;
+    double cam_height = objects[pos].camera.height;
 
-    /* fill the img->pixmap with colors by raycasting the objects */
-    raycast_scene(&img, objects[pos].camera.width, objects[pos].camera.height, objects);
+    /* sub-pixel spheres leave the ray traced set before anything is built from it */
+    if (lod_radius > 0) {
+        int splats = split_lod_spheres(img.width, img.height, cam_width, cam_height, lod_radius);
+        printf("lod: splatting %d of %d objects\n", splats, splats + nobjects);
+    }
+
+    /* shadow maps are rendered once up front, forked workers inherit them */
+    if (shadow_res > 0)
+        build_shadow_maps(shadow_res, pcf);
+
+    /* every camera's view of the one scene build, all their tiles in one queue */
+    if (multi_view) {
+        view views[MAX_VIEWS];
+        int nviews = find_views(views, MAX_VIEWS);
+        if (nviews < 0)
+            exit(1);
+        fast_math = fast;
+        image *imgs = mem_alloc(MEM_FRAMEBUFFER, sizeof(image) * nviews);
+        for (int k=0; k<nviews; k++) {
+            imgs[k] = img;
+            imgs[k].pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel)*img.width*img.height);
+        }
+        if (threads == 0)
+            threads = 1;
+        mem_check(tile_render_bytes(&img, nviews, cam_width, cam_height, threads, &plan) + 3 * (size_t)img.width,
+                  "the views");
+        printf("views: %d cameras, %d threads, %dx%d %s\n", nviews, threads, plan.size, plan.size,
+               tile_order_name(plan.order));
+        render_view_tiles(imgs, views, nviews, threads, &plan);
+        if (write_views(imgs, nviews, argv[4], format) < 0)
+            exit(1);
+        for (int k=0; k<nviews; k++)
+            mem_free(imgs[k].pixmap);
+        mem_free(imgs);
+        return 0;
+    }
+    fast_math = fast;
+
+    /* predict the render's cost from the scene, and stop there unless the prediction gets checked */
+    render_costs costs;
+    render_estimate est;
+    if (costs_path != NULL) {
+        if (read_render_costs(costs_path, &costs) < 0)
+            exit(1);
+        // render threads and worker processes can't be combined, whichever is set splits the frame
+        int parallel = (threads > 0) ? threads : (nlocal > 0) ? nlocal : 1;
+        estimate_render(img.width, img.height, cam_width, cam_height, parallel, &costs, &est);
+        print_render_estimate(stdout, &est);
+        if (!estimate_error)
+            return 0;
+    }
+
+    if (is_worker) {
+        /* stdout carries fragments, so anything else printed goes to stderr instead */
+        FILE *fragments = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        serve_regions(stdin, fragments, img.width, img.height, cam_width, cam_height);
+        fclose(fragments);
+        return 0;
+    }
+
+    if (region_str != NULL) {
+        /* render just the region of interest as a fragment */
+        FILE *out = fopen(argv[4], "wb");
+        if (out == NULL) {
+            fprintf(stderr, "Error: main: Failed to create output file '%s'\n", argv[4]);
+            exit(1);
+        }
+        mem_check(sizeof(RGBPixel) * (r.x1 - r.x0) * (r.y1 - r.y0) +
+                  region_bytes(r.x1 - r.x0, r.y1 - r.y0, img.width, img.height, cam_width, cam_height), "the region");
+        render_region_to_file(out, &r, img.width, img.height, cam_width, cam_height);
+        fclose(out);
+        return 0;
+    }
 
-    /* create output file and write image data */
-    FILE *out = fopen(argv[4], "wb");
-    if (out == NULL) {
-        fprintf(stderr, "Error: main: Failed to create output file '%s'\n", argv[4]);
+    /* create the framebuffer, either in memory or mapped onto the output file */
+    ppm_map map;
+    if (use_mmap) {
+        if (map_ppm(argv[4], &img, &map) < 0)
+            exit(1);
+    }
+    else {
+        img.pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel)*img.width*img.height);
+    }
+    //print_pixels(img.pixmap, img.width, img.height);
+
+    /* levels below the full frame, filtered on their own thread when the frame comes in bands */
+    mip_pyramid pyramid;
+    if (mips > 0 && init_mips(&pyramid, &img, mips, mip_filter) < 0)
         exit(1);
+
+    /* what the render allocates as it goes has to fit too, before it starts. Same cases as below */
+    size_t band = region_bytes(img.width, WRITER_BAND_ROWS, img.width, img.height, cam_width, cam_height);
+    size_t whole = region_bytes(img.width, img.height, img.width, img.height, cam_width, cam_height);
+    size_t scratch;
+    if (async_write)
+        scratch = band;
+    else if (shadow_error || fast_error >= 0)
+        scratch = sizeof(RGBPixel) * img.width * img.height + whole;     // and the reference frame
+    else if (nlocal > 0 || ncmds > 0)
+        scratch = distributed_bytes(&img, cam_width, cam_height, nlocal, ncmds);
+    else if (preview > 0)
+        scratch = preview_bytes(&img);
+    else if (threads > 0)
+        scratch = tile_render_bytes(&img, 0, cam_width, cam_height, threads, tile_auto ? NULL : &plan);
+    else if (mips > 0 && lod_radius == 0)
+        scratch = band;
+    else
+        scratch = whole;
+    if (compare_path != NULL)
+        scratch += sizeof(RGBPixel) * img.width * img.height;           // the image it's compared with
+    if (!use_mmap && !async_write)
+        scratch += 3 * (size_t)img.width;                               // the row buffer it's written out through
+    mem_check(scratch, "the render");
+
+    if (async_write) {
+        /* render and write at the same time, finished bands go to the writer thread */
+        band_writer writer;
+        if (open_writer(&writer, argv[4], format, &img) < 0)
+            exit(1);
+        start_writer(&writer);
+        if (mips > 0) {
+            pyramid.writer = &writer;
+            start_mips(&pyramid);
+            raycast_scene_bands(&img, cam_width, cam_height, objects, WRITER_BAND_ROWS, mip_band_done, &pyramid);
+            finish_mips(&pyramid);
+        }
+        else
+            raycast_scene_bands(&img, cam_width, cam_height, objects, WRITER_BAND_ROWS, band_done, &writer);
+        if (finish_writer(&writer) < 0)
+            exit(1);
+        if (mips > 0 && write_mips(&pyramid, argv[4], format) < 0)
+            exit(1);
+        return 0;
+    }
+
+    /* fill the img->pixmap with colors by raycasting the objects */
+    int status = 0;
+    struct timespec render_start;
+    clock_gettime(CLOCK_MONOTONIC, &render_start);
+    if (shadow_error) {
+        /* reference render with ray traced shadows to measure the maps against */
+        image ref = img;
+        ref.pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel)*img.width*img.height);
+        shadow_map *maps = shadow_maps;
+        shadow_maps = NULL;
+        raycast_scene(&ref, cam_width, cam_height, objects);
+        shadow_maps = maps;
+        raycast_scene(&img, cam_width, cam_height, objects);
+        image_diff diff;
+        diff_images(&ref, &img, &diff);
+        printf("shadow maps %dx%d, pcf %d\n", shadow_res, shadow_res, pcf);
+        print_image_diff(stdout, "error vs ray traced shadows", &diff);
+        mem_free(ref.pixmap);
+    }
+    else if (fast_error >= 0) {
+        /* exact reference render to hold the approximations to */
+        image ref = img;
+        ref.pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel)*img.width*img.height);
+        fast_math = false;
+        raycast_scene(&ref, cam_width, cam_height, objects);
+        fast_math = true;
+        raycast_scene(&img, cam_width, cam_height, objects);
+        image_diff diff;
+        diff_images(&ref, &img, &diff);
+        print_image_diff(stdout, "fast math error vs exact", &diff);
+        mem_free(ref.pixmap);
+        if (diff.max_diff > fast_error) {
+            fprintf(stderr, "Error: main: Fast math is off by %d levels in '%s', more than the %d allowed\n",
+                    diff.max_diff, argv[3], fast_error);
+            status = 1;
+        }
+    }
+    else if (nlocal > 0 || ncmds > 0)
+        render_distributed(&img, cam_width, cam_height, nlocal, worker_cmds, ncmds);
+    else if (preview > 0) {
+        preview_stats stats;
+        preview_scene(&img, cam_width, cam_height, preview, &stats);
+        print_preview_stats(stdout, preview, &stats);
     }
-    create_ppm(out, 6, &img);
-    /* cleanup */
-    fclose(out);
+    else if (threads > 0) {
+        /* a tuned plan is reused only for a job whose pixels cost the same */
+        tune_key key = {hash_scene_file(argv[3]), img.width, img.height, threads, render_engine, shadow_res,
+                        shadow_res > 0 ? pcf : 0, fast, lod_radius};
+        if (tile_auto && load_tile_plan(tile_cache, &key, &plan) == 0)
+            printf("tiles: %d threads, %dx%d %s (cached)\n", threads, plan.size, plan.size,
+                   tile_order_name(plan.order));
+        else if (tile_auto) {
+            double ns = autotune_tiles(&img, cam_width, cam_height, threads, &plan);
+            if (ns < 0)
+                printf("tiles: %d threads, %dx%d %s (frame too small to tune)\n", threads, plan.size, plan.size,
+                       tile_order_name(plan.order));
+            else {
+                printf("tiles: %d threads, %dx%d %s (tuned, %.1f ns/pixel)\n", threads, plan.size, plan.size,
+                       tile_order_name(plan.order), ns);
+                save_tile_plan(tile_cache, &key, &plan);
+            }
+        }
+        else
+            printf("tiles: %d threads, %dx%d %s\n", threads, plan.size, plan.size, tile_order_name(plan.order));
+        render_tiles(&img, cam_width, cam_height, threads, &plan);
+    }
+    else if (mips > 0 && lod_radius == 0) {
+        start_mips(&pyramid);
+        raycast_scene_bands(&img, cam_width, cam_height, objects, WRITER_BAND_ROWS, mip_band_done, &pyramid);
+        finish_mips(&pyramid);
+    }
+    else
+        raycast_scene(&img, cam_width, cam_height, objects);
+    if (lod_radius > 0)
+        splat_lod_spheres(&img, cam_width, cam_height);
+    /* the other renders finish the frame in one go, so the levels are filtered afterwards */
+    if (mips > 0 && (shadow_error || fast_error >= 0 || nlocal > 0 || ncmds > 0 || preview > 0 || lod_radius > 0 ||
+                     threads > 0))
+        build_mips(&pyramid);
+
+    if (estimate_error) {
+        struct timespec render_end;
+        clock_gettime(CLOCK_MONOTONIC, &render_end);
+        double seconds = (render_end.tv_sec - render_start.tv_sec) + (render_end.tv_nsec - render_start.tv_nsec) * 1e-9;
+        /* the rays the scalar engine cast: one per pixel, and one per light from each pixel that hit */
+        double hits = 0;
+        for (int i=0; i<img.height; i++) {
+            for (int j=0; j<img.width; j++) {
+                Ray ray = {.origin = {0, 0, 0}};
+                get_primary_ray_dir(i, j, img.width, img.height, cam_width, cam_height, ray.direction);
+                int best_o;
+                scalar best_t;
+                get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+                if (best_o != -1)
+                    hits++;
+            }
+        }
+        double rays = (double)img.width * img.height + hits * nlights;
+        double predicted = est.primary_rays + est.shadow_rays;
+        printf("  actual: %.0f rays, %.3f s\n", rays, seconds);
+        printf("  prediction error: rays %+.1f%%, time %+.1f%%\n",
+               100 * (predicted - rays) / rays, 100 * (est.seconds - seconds) / seconds);
+    }
+
+    if (compare_path != NULL) {
+        image ref;
+        if (read_ppm(compare_path, &ref) < 0)
+            exit(1);
+        if (ref.width != img.width || ref.height != img.height) {
+            fprintf(stderr, "Error: main: '%s' is %dx%d, the render is %dx%d\n", compare_path,
+                    ref.width, ref.height, img.width, img.height);
+            exit(1);
+        }
+        image_diff diff;
+        diff_images(&ref, &img, &diff);
+        printf("%s precision\n", sizeof(scalar) == sizeof(float) ? "single" : "double");
+        print_image_diff(stdout, compare_path, &diff);
+        mem_free(ref.pixmap);
+    }
+
+    /* write image data. A mapped framebuffer already is the file */
+    if (use_mmap) {
+        if (unmap_ppm(&map) < 0)
+            exit(1);
+    }
+    else {
+        band_writer writer;
+        if (open_writer(&writer, argv[4], format, &img) < 0)
+            exit(1);
+        write_band(&writer, 0, img.height);
+        if (close_writer(&writer) < 0)
+            exit(1);
+    }
+    if (mips > 0) {
+        if (write_mips(&pyramid, argv[4], format) < 0)
+            exit(1);
+        free_mips(&pyramid);
+    }
+
+    /* keep the output in step with edits to the scene, never returns */
+    if (watch)
+        watch_scene(argv[3], argv[4], format, &img, shadow_res, pcf);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,157 @@
+/* memstats.c - memory accounting
+ *
+ * mem_alloc and friends put a small header in front of every block recording its size and
+ * category, so mem_free can take it off the right count without being told. Counts are
+ * atomic because the writer and filter threads allocate too. Memory that doesn't come from
+ * here (the static scene arrays, a mapped output file) is added with mem_add. With a limit
+ * set, an allocation that would take the total over it fails at once with an error. The
+ * scene, framebuffer and shadow maps are allocated before the first ray, and the scratch a
+ * render allocates as it goes is checked against the limit up front with mem_check, so a
+ * render that can't fit stops before it starts. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "../include/memstats.h"
+
+/* keeps what follows it aligned for any type */
+typedef union mem_header_t {
+    struct {
+        size_t size;
+        int category;
+    } info;
+    max_align_t align;
+} mem_header;
+
+static const char *category_names[MEM_CATEGORIES] = {
+        "scene", "materials", "acceleration", "framebuffer", "i/o buffers", "scratch"
+};
+
+/* per category, the last entry is the total */
+static atomic_size_t current[MEM_CATEGORIES + 1];
+static atomic_size_t peak[MEM_CATEGORIES + 1];
+static size_t limit = 0;    // 0 for none
+
+static void raise_peak(int index, size_t now) {
+    size_t old = atomic_load_explicit(&peak[index], memory_order_relaxed);
+    while (now > old && !atomic_compare_exchange_weak(&peak[index], &old, now));
+}
+
+/* adds (or with a negative count, takes away) bytes, failing if they take the total over the limit */
+static void count_bytes(int category, ptrdiff_t bytes) {
+    size_t total = atomic_fetch_add(&current[MEM_CATEGORIES], (size_t)bytes) + (size_t)bytes;
+    if (bytes > 0 && limit > 0 && total > limit) {
+        atomic_fetch_sub(&current[MEM_CATEGORIES], (size_t)bytes);
+        fprintf(stderr, "Error: count_bytes: %zu more bytes of %s would use %zu bytes, over the limit of %zu\n",
+                (size_t)bytes, category_names[category], total, limit);
+        exit(1);
+    }
+    size_t now = atomic_fetch_add(&current[category], (size_t)bytes) + (size_t)bytes;
+    if (bytes > 0) {
+        raise_peak(category, now);
+        raise_peak(MEM_CATEGORIES, total);
+    }
+}
+
+/**
+ * Allocates a tracked block, exits if it's out of memory or over the limit
+ * @param category - MEM_ constant the bytes count against
+ * @param size - bytes wanted
+ * @return - the block, to be released with mem_free
+ */
+void *mem_alloc(int category, size_t size) {
+    count_bytes(category, (ptrdiff_t)size);
+    mem_header *h = malloc(sizeof(mem_header) + size);
+    if (h == NULL) {
+        fprintf(stderr, "Error: mem_alloc: Out of memory allocating %zu bytes of %s\n", size, category_names[category]);
+        exit(1);
+    }
+    h->info.size = size;
+    h->info.category = category;
+    return h + 1;
+}
+
+/* mem_alloc for count zeroed elements */
+void *mem_calloc(int category, size_t count, size_t size) {
+    count_bytes(category, (ptrdiff_t)(count * size));
+    mem_header *h = calloc(1, sizeof(mem_header) + count * size);
+    if (h == NULL) {
+        fprintf(stderr, "Error: mem_calloc: Out of memory allocating %zu bytes of %s\n", count * size,
+                category_names[category]);
+        exit(1);
+    }
+    h->info.size = count * size;
+    h->info.category = category;
+    return h + 1;
+}
+
+/**
+ * Resizes a tracked block like realloc
+ * @param category - MEM_ constant, used when ptr is NULL
+ * @param ptr - block from mem_alloc, or NULL
+ * @param size - new size in bytes
+ * @return - the block, possibly moved
+ */
+void *mem_realloc(int category, void *ptr, size_t size) {
+    if (ptr == NULL)
+        return mem_alloc(category, size);
+    mem_header *h = (mem_header *)ptr - 1;
+    category = h->info.category;
+    count_bytes(category, (ptrdiff_t)size - (ptrdiff_t)h->info.size);
+    h = realloc(h, sizeof(mem_header) + size);
+    if (h == NULL) {
+        fprintf(stderr, "Error: mem_realloc: Out of memory allocating %zu bytes of %s\n", size, category_names[category]);
+        exit(1);
+    }
+    h->info.size = size;
+    return h + 1;
+}
+
+/* releases a block from mem_alloc, mem_calloc or mem_realloc. NULL is ignored */
+void mem_free(void *ptr) {
+    if (ptr == NULL)
+        return;
+    mem_header *h = (mem_header *)ptr - 1;
+    count_bytes(h->info.category, -(ptrdiff_t)h->info.size);
+    free(h);
+}
+
+/**
+ * Counts memory that wasn't allocated here, e.g. static arrays or a mapped file
+ * @param category - MEM_ constant
+ * @param bytes - bytes taken, negative when they're given back
+ */
+void mem_add(int category, ptrdiff_t bytes) {
+    count_bytes(category, bytes);
+}
+
+/**
+ * Fails at once if bytes more than are in use now would take the total over the limit. Called
+ * with the most a render can allocate while it runs, so one that can't fit stops before the
+ * first ray instead of partway through the frame
+ * @param bytes - bytes that may be wanted later
+ * @param what - what wants them, for the message
+ */
+void mem_check(size_t bytes, const char *what) {
+    size_t total = atomic_load(&current[MEM_CATEGORIES]);
+    if (limit > 0 && total + bytes > limit) {
+        fprintf(stderr, "Error: mem_check: %s needs up to %zu more bytes on top of %zu, over the limit of %zu\n",
+                what, bytes, total, limit);
+        exit(1);
+    }
+}
+
+/* sets the most tracked memory there may be in use at once, 0 for no limit */
+void set_mem_limit(size_t bytes) {
+    limit = bytes;
+}
+
+/* prints current and peak bytes per category */
+void print_mem_stats(FILE *out) {
+    fprintf(out, "memory            current          peak\n");
+    for (int c=0; c<=MEM_CATEGORIES; c++) {
+        fprintf(out, "  %-12s %10.1f KB %10.1f KB\n", c < MEM_CATEGORIES ? category_names[c] : "total",
+                atomic_load(&current[c]) / 1024.0, atomic_load(&peak[c]) / 1024.0);
+    }
+    if (limit > 0)
+        fprintf(out, "  limit        %10.1f KB\n", limit / 1024.0);
+}
@@ -0,0 +1,202 @@
+/* mipmap.c - builds a pyramid of half, quarter, ... size copies of the frame from one render
+ *
+ * Each level is filtered from the level above it. A level's rows can be made as soon as the
+ * rows of the level above that its filter reads are done, so the pyramid follows the render
+ * down the frame: the renderer hands finished bands to a filter thread through a lock-free
+ * queue (the same single producer/single consumer scheme as writer.c), and the thread
+ * brings every level up to date before taking the next band. Level sizes round up, taps
+ * past the edge repeat the last row or column. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "../include/mipmap.h"
+#include "../include/memstats.h"
+
+/**
+ * Turns a filter name into one of the MIP_ constants
+ * @param str - "box" or "tent"
+ * @return - the filter, -1 if it's unknown
+ */
+int parse_mip_filter(char *str) {
+    if (strcmp(str, "box") == 0)
+        return MIP_BOX;
+    if (strcmp(str, "tent") == 0)
+        return MIP_TENT;
+    fprintf(stderr, "Error: parse_mip_filter: Unknown filter '%s' (box|tent)\n", str);
+    return -1;
+}
+
+/**
+ * Sets up the levels below a frame. Stops early once a level is down to one pixel
+ * @param m - pyramid to set up
+ * @param img - the full frame, filled in by the renderer
+ * @param nlevels - levels wanted below the full frame (1 to MAX_MIP_LEVELS)
+ * @param filter - MIP_BOX or MIP_TENT
+ * @return - 0 on success, -1 on error
+ */
+int init_mips(mip_pyramid *m, image *img, int nlevels, int filter) {
+    memset(m, 0, sizeof(mip_pyramid));
+    m->filter = filter;
+    m->levels[0] = *img;
+    atomic_init(&m->head, 0);
+    atomic_init(&m->tail, 0);
+    for (int k=1; k<=nlevels; k++) {
+        image *above = &m->levels[k - 1];
+        if (above->width == 1 && above->height == 1)
+            break;
+        image *level = &m->levels[k];
+        level->width = (above->width + 1) / 2;
+        level->height = (above->height + 1) / 2;
+        level->max_color_val = img->max_color_val;
+        level->pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel) * level->width * level->height);
+        m->nlevels = k;
+    }
+    return 0;
+}
+
+static inline int clamp_index(int i, int n) {
+    return (i < 0) ? 0 : (i >= n ? n - 1 : i);
+}
+
+/**
+ * Filters rows [r0, r1) of level k from level k-1
+ * @param m - pyramid
+ * @param k - level to fill in (>= 1)
+ * @param r0 - first row
+ * @param r1 - one past the last row
+ */
+static void filter_rows(mip_pyramid *m, int k, int r0, int r1) {
+    static const int box[2] = {1, 1};
+    static const int tent[4] = {1, 3, 3, 1};
+    const int *weights = (m->filter == MIP_TENT) ? tent : box;
+    int taps = (m->filter == MIP_TENT) ? 4 : 2;
+    int first = (m->filter == MIP_TENT) ? -1 : 0;     // offset of the first tap from 2r
+    int total = (m->filter == MIP_TENT) ? 64 : 4;      // sum of all tap weights in 2D
+
+    image *src = &m->levels[k - 1];
+    image *dst = &m->levels[k];
+    for (int r=r0; r<r1; r++) {
+        for (int c=0; c<dst->width; c++) {
+            int sum[3] = {0, 0, 0};
+            for (int ty=0; ty<taps; ty++) {
+                RGBPixel *row = &src->pixmap[(size_t)clamp_index(2*r + first + ty, src->height) * src->width];
+                for (int tx=0; tx<taps; tx++) {
+                    int w = weights[ty] * weights[tx];
+                    RGBPixel *p = &row[clamp_index(2*c + first + tx, src->width)];
+                    sum[0] += w * p->r;
+                    sum[1] += w * p->g;
+                    sum[2] += w * p->b;
+                }
+            }
+            RGBPixel *out = &dst->pixmap[(size_t)r * dst->width + c];
+            out->r = (sum[0] + total / 2) / total;
+            out->g = (sum[1] + total / 2) / total;
+            out->b = (sum[2] + total / 2) / total;
+        }
+    }
+}
+
+/* rows of level k whose taps only read rows of level k-1 that are done */
+static int rows_ready(mip_pyramid *m, int k) {
+    int src_done = m->done[k - 1];
+    if (src_done == m->levels[k - 1].height)
+        return m->levels[k].height;
+    int reach = (m->filter == MIP_TENT) ? 2 : 1;      // row r reads down to row 2r + reach
+    if (src_done - 1 - reach < 0)
+        return 0;
+    int ready = (src_done - 1 - reach) / 2 + 1;
+    return (ready < m->levels[k].height) ? ready : m->levels[k].height;
+}
+
+/* rows [0, y1) of the full frame are done, brings every level as far as that allows */
+static void advance_mips(mip_pyramid *m, int y1) {
+    m->done[0] = y1;
+    for (int k=1; k<=m->nlevels; k++) {
+        int ready = rows_ready(m, k);
+        if (ready > m->done[k]) {
+            filter_rows(m, k, m->done[k], ready);
+            m->done[k] = ready;
+        }
+    }
+}
+
+/* filter thread: pops bands in order until it sees the stop band */
+static void *mips_main(void *arg) {
+    mip_pyramid *m = arg;
+    while (true) {
+        size_t head = atomic_load_explicit(&m->head, memory_order_relaxed);
+        while (head == atomic_load_explicit(&m->tail, memory_order_acquire))
+            sched_yield();  // nothing finished yet
+        band b = m->queue[head % MIP_QUEUE_SIZE];
+        atomic_store_explicit(&m->head, head + 1, memory_order_release);
+        if (b.y0 < 0)
+            break;
+        advance_mips(m, b.y1);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the filter thread. Bands must then come in order through mip_band_done
+ * @param m - pyramid set up by init_mips
+ */
+void start_mips(mip_pyramid *m) {
+    if (pthread_create(&m->thread, NULL, mips_main, m) != 0) {
+        fprintf(stderr, "Error: start_mips: Failed to start filter thread\n");
+        exit(1);
+    }
+}
+
+/* hands a finished band to the filter thread. Blocks while the queue is full */
+static void push_mip_band(mip_pyramid *m, int y0, int y1) {
+    size_t tail = atomic_load_explicit(&m->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&m->head, memory_order_acquire) == MIP_QUEUE_SIZE)
+        sched_yield();  // filter thread is behind, let it catch up
+    m->queue[tail % MIP_QUEUE_SIZE].y0 = y0;
+    m->queue[tail % MIP_QUEUE_SIZE].y1 = y1;
+    atomic_store_explicit(&m->tail, tail + 1, memory_order_release);
+}
+
+/* band callback for raycast_scene_bands, arg is the running mip_pyramid */
+void mip_band_done(int y0, int y1, void *arg) {
+    mip_pyramid *m = arg;
+    if (m->writer != NULL)
+        push_band(m->writer, y0, y1);
+    push_mip_band(m, y0, y1);
+}
+
+/**
+ * Waits for the filter thread to finish every level
+ * @param m - running pyramid
+ */
+void finish_mips(mip_pyramid *m) {
+    push_mip_band(m, -1, -1);
+    pthread_join(m->thread, NULL);
+}
+
+/**
+ * Filters every level from a finished frame, for renders that don't come in bands
+ * @param m - pyramid set up by init_mips
+ */
+void build_mips(mip_pyramid *m) {
+    advance_mips(m, m->levels[0].height);
+}
+
+/**
+ * Writes each level below the full frame to its own file: out.ppm gives out.mip1.ppm,
+ * out.mip2.ppm, ...
+ * @param m - finished pyramid
+ * @param out_path - file name of the full frame
+ * @param format - output encoding
+ * @return - 0 on success, -1 on error
+ */
+int write_mips(mip_pyramid *m, const char *out_path, int format) {
+    return write_numbered(&m->levels[1], m->nlevels, out_path, "mip", 1, format);
+}
+
+/* frees the levels below the full frame */
+void free_mips(mip_pyramid *m) {
+    for (int k=1; k<=m->nlevels; k++)
+        mem_free(m->levels[k].pixmap);
+}
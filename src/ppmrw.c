@@ -3,6 +3,7 @@
 //
 
 #include "../include/ppmrw.h"
+#include "../include/memstats.h"
 /** ppmrw program for reading and writing images in ppm format
  * Author: Michael Gilbert
  * CS430 - Computer Graphics
@@ -16,6 +17,11 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// map_ppm hands out the raw P6 bytes as RGBPixels
+_Static_assert(sizeof(RGBPixel) == 3, "RGBPixel must be exactly 3 bytes");
 
 /*******************************************************//**
  * Utility functions
@@ -203,9 +209,9 @@ int write_p6_data(FILE *fh, image *img) {
     int i,j;
     for (i=0; i<(img->height); i++) {
         for (j=0; j<(img->width); j++) {
-            fwrite(&(img->pixmap[i * img->width + j].r), 1, 1, fh);
-            fwrite(&(img->pixmap[i * img->width + j].g), 1, 1, fh);
-            fwrite(&(img->pixmap[i * img->width + j].b), 1, 1, fh);
+            fwrite(&(img->pixmap[(size_t)i * img->width + j].r), 1, 1, fh);
+            fwrite(&(img->pixmap[(size_t)i * img->width + j].g), 1, 1, fh);
+            fwrite(&(img->pixmap[(size_t)i * img->width + j].b), 1, 1, fh);
         }
     }
     return 0;
@@ -274,7 +280,7 @@ int read_p6_data(FILE *fh, image *img) {
                     px.b = num;
                 }
             }
-            img->pixmap[i * img->width + j] = px;
+            img->pixmap[(size_t)i * img->width + j] = px;
         }
     }
     // check if there's still data left
@@ -366,7 +372,7 @@ int read_p3_data(FILE *fh, image *img) {
                 else {
                     px.b = atoi(num);
                 }
-                img->pixmap[i * img->width + j] = px;
+                img->pixmap[(size_t)i * img->width + j] = px;
             }
         }
     }
@@ -392,9 +398,9 @@ int write_p3_data(FILE *fh, image *img) {
     int i,j;
     for (i=0; i<(img->height); i++) {
         for (j=0; j<(img->width); j++) {
-            fprintf(fh, "%d ", img->pixmap[i * img->width + j].r);
-            fprintf(fh, "%d ", img->pixmap[i * img->width + j].g);
-            fprintf(fh, "%d\n", img->pixmap[i * img->width + j].b);
+            fprintf(fh, "%d ", img->pixmap[(size_t)i * img->width + j].r);
+            fprintf(fh, "%d ", img->pixmap[(size_t)i * img->width + j].g);
+            fprintf(fh, "%d\n", img->pixmap[(size_t)i * img->width + j].b);
         }
     }
     return 0;
@@ -460,15 +466,226 @@ void create_ppm(FILE *fh, int type, image *img) {
         write_p6_data(fh, img);
 }
 
+/**
+ * Reads a P3 or P6 ppm file into a newly allocated image
+ * @param path - file name
+ * @param img - filled in, pixmap is malloc'd
+ * @return 0 on success, -1 on error
+ */
+int read_ppm(const char *path, image *img) {
+    FILE *fh = fopen(path, "rb");
+    if (fh == NULL) {
+        fprintf(stderr, "Error: read_ppm: Failed to open '%s'\n", path);
+        return -1;
+    }
+    header hdr;
+    if (read_header(fh, &hdr) < 0) {
+        fclose(fh);
+        return -1;
+    }
+    img->width = hdr.width;
+    img->height = hdr.height;
+    img->max_color_val = hdr.max_color_val;
+    img->pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel) * img->width * img->height);
+    int res;
+    if (hdr.file_type == 3) {
+        res = read_p3_data(fh, img);
+    }
+    else {
+        // the header's comment check also skips whitespace, which can be the first byte of the
+        // pixels, so they're taken from the end of the file. Read straight into the pixmap so
+        // big frames don't go through a buffer on the stack like read_p6_data
+        size_t n = (size_t)img->width * img->height;
+        res = 0;
+        if (fseek(fh, -(long)(3 * n), SEEK_END) < 0 || fread(img->pixmap, sizeof(RGBPixel), n, fh) != n) {
+            fprintf(stderr, "Error: read_ppm: Image data in '%s' doesn't match header dimensions\n", path);
+            res = -1;
+        }
+    }
+    fclose(fh);
+    if (res < 0) {
+        mem_free(img->pixmap);
+        img->pixmap = NULL;
+    }
+    return res;
+}
+
+/**
+ * Writes a region of a larger frame as a P6 file. The region's offset and the size of the
+ * full frame go in a "# region" comment so fragments can be stitched back together later
+ * @param fh - file handler to output data to
+ * @param img - image data for just the region
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ */
+void create_ppm_region(FILE *fh, image *img, int x0, int y0, int full_width, int full_height) {
+    int res = fprintf(fh, "P6\n# region %d %d %d %d %d %d\n%d %d\n%d\n",
+                      x0, y0, x0 + img->width, y0 + img->height, full_width, full_height,
+                      img->width, img->height, 255);
+    if (res < 0) {
+        fprintf(stderr, "Error: create_ppm_region: Problem writing header to file\n");
+        exit(1);
+    }
+    write_p6_data(fh, img);
+}
+
+/**
+ * Reads the header of a fragment written by create_ppm_region
+ * @param fh - file handler positioned at the start of the fragment
+ * @param hdr - where the region info is stored
+ * @return 0 on success, -1 on error
+ */
+int read_region_header(FILE *fh, region_header *hdr) {
+    int width, height, max_color_val;
+    int res = fscanf(fh, "P6 # region %d %d %d %d %d %d %d %d %d",
+                     &hdr->x0, &hdr->y0, &hdr->x1, &hdr->y1, &hdr->full_width, &hdr->full_height,
+                     &width, &height, &max_color_val);
+    if (res != 9) {
+        fprintf(stderr, "Error: read_region_header: Missing or invalid region header\n");
+        return -1;
+    }
+    // exactly one whitespace character separates the header from the pixel data
+    if (check_for_newline(fgetc(fh)) < 0)
+        return -1;
+    if (width != hdr->x1 - hdr->x0 || height != hdr->y1 - hdr->y0 || max_color_val != 255 ||
+        hdr->x0 < 0 || hdr->y0 < 0 || hdr->x1 > hdr->full_width || hdr->y1 > hdr->full_height) {
+        fprintf(stderr, "Error: read_region_header: Region doesn't fit its frame\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the pixels of a fragment straight into their place in the full frame
+ * @param fh - file handler positioned right after the region header
+ * @param hdr - region info from read_region_header
+ * @param frame - full frame image the fragment is stitched into
+ * @return 0 on success, -1 on error
+ */
+int read_region_data(FILE *fh, region_header *hdr, image *frame) {
+    if (hdr->full_width != frame->width || hdr->full_height != frame->height) {
+        fprintf(stderr, "Error: read_region_data: Fragment belongs to a %dx%d frame, not %dx%d\n",
+                hdr->full_width, hdr->full_height, frame->width, frame->height);
+        return -1;
+    }
+    int width = hdr->x1 - hdr->x0;
+    unsigned char *row = mem_alloc(MEM_IO, 3 * (size_t)width);
+    for (int i=hdr->y0; i<hdr->y1; i++) {
+        if (fread(row, 3, width, fh) != (size_t)width) {
+            fprintf(stderr, "Error: read_region_data: Fragment is missing pixel data\n");
+            mem_free(row);
+            return -1;
+        }
+        RGBPixel *dest = &frame->pixmap[(size_t)i * frame->width + hdr->x0];
+        for (int j=0; j<width; j++) {
+            dest[j].r = row[3*j];
+            dest[j].g = row[3*j + 1];
+            dest[j].b = row[3*j + 2];
+        }
+    }
+    mem_free(row);
+    return 0;
+}
+
+/**
+ * Creates a P6 file sized for the whole image and maps it into memory so rendering writes
+ * pixels straight into the page cache. img->pixmap points at the mapped pixel data, so
+ * there is no separate write pass; unmap_ppm finishes the file.
+ * @param path - output file name
+ * @param img - image whose width and height are set. pixmap is filled in on success
+ * @param map - mapping info needed by unmap_ppm
+ * @return 0 on success, -1 on error
+ */
+int map_ppm(const char *path, image *img, ppm_map *map) {
+    char hdr[64];
+    int hdr_len = snprintf(hdr, sizeof(hdr), "P6\n%d %d\n%d\n", img->width, img->height, 255);
+    size_t data_len = (size_t)img->width * img->height * sizeof(RGBPixel);
+    mem_add(MEM_FRAMEBUFFER, (ptrdiff_t)(hdr_len + data_len));  // counted (and limited) like a malloc'd frame
+
+    map->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (map->fd < 0) {
+        fprintf(stderr, "Error: map_ppm: Failed to create output file '%s'\n", path);
+        return -1;
+    }
+    map->length = hdr_len + data_len;
+    if (write(map->fd, hdr, hdr_len) != hdr_len || ftruncate(map->fd, (off_t)map->length) < 0) {
+        fprintf(stderr, "Error: map_ppm: Failed to size output file '%s'\n", path);
+        close(map->fd);
+        return -1;
+    }
+    map->base = mmap(NULL, map->length, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+    if (map->base == MAP_FAILED) {
+        fprintf(stderr, "Error: map_ppm: Failed to map output file '%s'\n", path);
+        close(map->fd);
+        return -1;
+    }
+    img->pixmap = (RGBPixel*)((unsigned char*)map->base + hdr_len);
+    return 0;
+}
+
+/**
+ * Unmaps a file created by map_ppm. The kernel writes the dirty pages back on its own time
+ * @param map - mapping info from map_ppm
+ * @return 0 on success, -1 on error
+ */
+int unmap_ppm(ppm_map *map) {
+    int res = munmap(map->base, map->length);
+    mem_add(MEM_FRAMEBUFFER, -(ptrdiff_t)map->length);
+    if (close(map->fd) < 0 || res < 0) {
+        fprintf(stderr, "Error: unmap_ppm: Problem finishing output file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Compares two images of the same size channel by channel
+ * @param a - first image
+ * @param b - second image
+ * @param diff - where the statistics are stored
+ */
+void diff_images(image *a, image *b, image_diff *diff) {
+    if (a->width != b->width || a->height != b->height) {
+        fprintf(stderr, "Error: diff_images: Images must be the same size\n");
+        exit(1);
+    }
+    diff->max_diff = 0;
+    diff->pixels_differing = 0;
+    diff->pixels = (size_t)a->width * a->height;
+    double total = 0;
+    for (size_t p=0; p<diff->pixels; p++) {
+        int d[3] = {abs(a->pixmap[p].r - b->pixmap[p].r),
+                    abs(a->pixmap[p].g - b->pixmap[p].g),
+                    abs(a->pixmap[p].b - b->pixmap[p].b)};
+        if (d[0] || d[1] || d[2])
+            diff->pixels_differing++;
+        for (int k=0; k<3; k++) {
+            total += d[k];
+            if (d[k] > diff->max_diff)
+                diff->max_diff = d[k];
+        }
+    }
+    diff->mean_diff = total / (3.0 * diff->pixels);
+}
+
+/* prints the statistics from diff_images on one line */
+void print_image_diff(FILE *fh, const char *label, image_diff *diff) {
+    fprintf(fh, "%s: max channel error %d, mean channel error %.4f, %zu of %zu pixels differ (%.2f%%)\n",
+            label, diff->max_diff, diff->mean_diff, diff->pixels_differing, diff->pixels,
+            100.0 * diff->pixels_differing / diff->pixels);
+}
+
 /* TESTING helper functions */
 void print_pixels(RGBPixel *pixmap, int width, int height) {
     int counter = 0;
     for (int i=0; i<height; i++) {
         for (int j=0; j<width; j++) {
             counter++;
-            printf("r: %d, ", pixmap[i * width + j].r);
-            printf("g: %d ,", pixmap[i * width + j].g);
-            printf("b: %d\n", pixmap[i * width + j].b);
+            printf("r: %d, ", pixmap[(size_t)i * width + j].r);
+            printf("g: %d ,", pixmap[(size_t)i * width + j].g);
+            printf("b: %d\n", pixmap[(size_t)i * width + j].b);
         }
     }
     printf("print_pixels count: %d\n", counter);
@@ -0,0 +1,160 @@
+/* preview.c - quick preview frames from half or a quarter of the primary rays
+ *
+ * The first pass traces and shades a checkerboard or one pixel of every 2x2 block, keeping the
+ * object each one hit and how far away. Every other pixel then looks at its traced neighbours
+ * in the surrounding 3x3 block: four of them on the checkerboard, two or four in a 2x2 grid.
+ * If they all show the same object at about the same depth the pixel sits inside a surface
+ * and gets their average colour. If they show different objects, or the same object across a
+ * jump in depth, the pixel is on a silhouette and is traced like any other. So is a pixel whose
+ * neighbours' colours are far apart, which catches most shadow and spotlight edges inside one
+ * surface; the fainter ones are blended and come out a little soft. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/preview.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/memstats.h"
+
+/**
+ * Turns a preview mode name into one of the PREVIEW_ constants
+ * @param str - "checker" or "quarter"
+ * @return - the mode, -1 if it's unknown
+ */
+int parse_preview_mode(char *str) {
+    if (strcmp(str, "checker") == 0)
+        return PREVIEW_CHECKER;
+    if (strcmp(str, "quarter") == 0)
+        return PREVIEW_QUARTER;
+    fprintf(stderr, "Error: parse_preview_mode: Unknown preview mode '%s' (checker|quarter)\n", str);
+    return -1;
+}
+
+static inline boolean traced_first(int mode, int i, int j) {
+    if (mode == PREVIEW_CHECKER)
+        return ((i + j) & 1) == 0;
+    return (i & 1) == 0 && (j & 1) == 0;
+}
+
+/**
+ * Traces and shades one pixel the way raycast_region does
+ * @param img - the frame
+ * @param i - row
+ * @param j - column
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param obj - set to the object hit, -1 for the background
+ * @param depth - set to the distance to the hit
+ */
+static void trace_pixel(image *img, int i, int j, scalar cam_width, scalar cam_height, int *obj, scalar *depth) {
+    Ray ray = {.origin = {0, 0, 0}};
+    get_primary_ray_dir(i, j, img->width, img->height, cam_width, cam_height, ray.direction);
+    int best_o;
+    scalar best_t;
+    get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+    if (best_t > 0 && best_t != INFINITY && best_o != -1) {
+        scalar color[3] = {0, 0, 0};
+        shade(&ray, best_o, best_t, color);
+        set_pixel_color(color, i, j, img);
+        *obj = best_o;
+        *depth = best_t;
+    }
+    else {
+        set_pixel_color(background_color, i, j, img);
+        *obj = -1;
+        *depth = INFINITY;
+    }
+}
+
+/* bytes preview_scene allocates for a frame this size */
+size_t preview_bytes(image *img) {
+    return (sizeof(int) + sizeof(scalar)) * img->width * img->height;
+}
+
+/**
+ * Renders a preview frame, tracing a subset of the pixels and filling in the rest where the
+ * traced neighbours agree. Always uses the scalar loop
+ * @param img - the frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param mode - PREVIEW_CHECKER or PREVIEW_QUARTER
+ * @param stats - filled in
+ */
+void preview_scene(image *img, scalar cam_width, scalar cam_height, int mode, preview_stats *stats) {
+    memset(stats, 0, sizeof(preview_stats));
+    size_t npixels = (size_t)img->width * img->height;
+    int *obj = mem_alloc(MEM_SCRATCH, sizeof(int) * npixels);
+    scalar *depth = mem_alloc(MEM_SCRATCH, sizeof(scalar) * npixels);
+    stats->pixels = npixels;
+
+    for (int i=0; i<img->height; i++) {
+        for (int j=0; j<img->width; j++) {
+            if (!traced_first(mode, i, j))
+                continue;
+            size_t p = (size_t)i * img->width + j;
+            trace_pixel(img, i, j, cam_width, cam_height, &obj[p], &depth[p]);
+            stats->traced++;
+        }
+    }
+
+    for (int i=0; i<img->height; i++) {
+        for (int j=0; j<img->width; j++) {
+            if (traced_first(mode, i, j))
+                continue;
+            int n = 0;
+            int first_obj = -1;
+            scalar near = INFINITY, far = 0;
+            boolean agree = true;
+            int sum[3] = {0, 0, 0};
+            int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+            for (int y=i-1; y<=i+1 && agree; y++) {
+                for (int x=j-1; x<=j+1 && agree; x++) {
+                    if (y < 0 || y >= img->height || x < 0 || x >= img->width || !traced_first(mode, y, x))
+                        continue;
+                    size_t q = (size_t)y * img->width + x;
+                    if (n == 0)
+                        first_obj = obj[q];
+                    agree = (obj[q] == first_obj);
+                    near = fmin(near, depth[q]);
+                    far = fmax(far, depth[q]);
+                    unsigned char c[3] = {img->pixmap[q].r, img->pixmap[q].g, img->pixmap[q].b};
+                    for (int k=0; k<3; k++) {
+                        sum[k] += c[k];
+                        low[k] = (c[k] < low[k]) ? c[k] : low[k];
+                        high[k] = (c[k] > high[k]) ? c[k] : high[k];
+                    }
+                    n++;
+                }
+            }
+            int spread = 0;
+            for (int k=0; k<3; k++)
+                spread = (high[k] - low[k] > spread) ? high[k] - low[k] : spread;
+            // background neighbours all sit at INFINITY, so only surfaces get the depth test
+            if (agree && n > 0 && (first_obj == -1 || far <= near * PREVIEW_DEPTH_RATIO) &&
+                spread <= PREVIEW_COLOR_SPREAD) {
+                RGBPixel *out = &img->pixmap[(size_t)i * img->width + j];
+                out->r = (sum[0] + n / 2) / n;
+                out->g = (sum[1] + n / 2) / n;
+                out->b = (sum[2] + n / 2) / n;
+                stats->filled++;
+            }
+            else {
+                // on an edge, so trace it. Its hit isn't kept, later pixels only read the first pass
+                int o;
+                scalar t;
+                trace_pixel(img, i, j, cam_width, cam_height, &o, &t);
+                stats->retraced++;
+            }
+        }
+    }
+    mem_free(obj);
+    mem_free(depth);
+}
+
+/* prints how much of a preview frame was traced */
+void print_preview_stats(FILE *out, int mode, preview_stats *stats) {
+    fprintf(out, "preview %s: traced %zu of %zu pixels (%.1f%%), filled %zu, traced on edges %zu\n",
+            mode == PREVIEW_CHECKER ? "checker" : "quarter", stats->traced + stats->retraced, stats->pixels,
+            100.0 * (stats->traced + stats->retraced) / stats->pixels, stats->filled, stats->retraced);
+}
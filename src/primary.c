@@ -0,0 +1,217 @@
+/* primary.c - primary visibility kernel
+ *
+ * Primary rays all leave the camera at the origin, so for spheres origin - center and
+ * c = |origin - center|^2 - r^2, and for planes (position - origin) . normal are the same for
+ * every ray in the frame. The x and y components of the unnormalized ray direction only
+ * depend on the column and row. With those computed once, testing one object is a dot
+ * product and a few multiply-adds. Values are computed exactly like sphere_intersect and
+ * plane_intersect do, so the hits are identical to the scalar path. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/primary.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/**
+ * Computes the per-frame object constants and the per-row/per-column direction components
+ * for a region of the frame
+ * @param pf - frame constants to fill in
+ * @param width - width of the region
+ * @param height - height of the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void prepare_primary_frame(primary_frame *pf, int width, int height, int full_width, int full_height,
+                           int x0, int y0, scalar cam_width, scalar cam_height) {
+    scalar origin[3] = {0, 0, 0};   // camera position
+    pf->sphere_idx = mem_alloc(MEM_ACCEL, sizeof(int) * MAX_OBJECTS);
+    pf->sx = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->sy = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->sz = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->sc = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->plane_idx = mem_alloc(MEM_ACCEL, sizeof(int) * MAX_OBJECTS);
+    pf->nx = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->ny = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->nz = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->pn = mem_alloc(MEM_ACCEL, sizeof(scalar) * MAX_OBJECTS);
+    pf->col_x = mem_alloc(MEM_ACCEL, sizeof(scalar) * width);
+    pf->col_x2 = mem_alloc(MEM_ACCEL, sizeof(scalar) * width);
+    pf->row_y = mem_alloc(MEM_ACCEL, sizeof(scalar) * height);
+    pf->row_y2 = mem_alloc(MEM_ACCEL, sizeof(scalar) * height);
+
+    pf->nspheres = 0;
+    pf->nplanes = 0;
+    for (int i=0; i<MAX_OBJECTS && objects[i].type != 0; i++) {
+        if (objects[i].type == SPHERE) {
+            int k = pf->nspheres++;
+            scalar v[3];
+            v3_sub(origin, objects[i].sphere.position, v);
+            pf->sphere_idx[k] = i;
+            pf->sx[k] = v[0];
+            pf->sy[k] = v[1];
+            pf->sz[k] = v[2];
+            pf->sc[k] = sqr(v[0]) + sqr(v[1]) + sqr(v[2]) - sqr(objects[i].sphere.radius);
+        }
+        else if (objects[i].type == PLANE) {
+            int k = pf->nplanes++;
+            scalar *N = objects[i].plane.normal;
+            scalar v[3];
+            v3_sub(objects[i].plane.position, origin, v);
+            pf->plane_idx[k] = i;
+            pf->nx[k] = N[0];
+            pf->ny[k] = N[1];
+            pf->nz[k] = N[2];
+            pf->pn[k] = v3_dot(v, N);
+        }
+    }
+
+    // same expressions as get_primary_ray_dir, split by which index they depend on
+    scalar vp_pos[3] = {0, 0, 1};   // view plane position
+    scalar pixheight = (scalar)cam_height / (scalar)full_height;
+    scalar pixwidth = (scalar)cam_width / (scalar)full_width;
+    pf->width = width;
+    pf->height = height;
+    for (int j=0; j<width; j++) {
+        pf->col_x[j] = vp_pos[0] - cam_width/2.0 + pixwidth*(x0 + j + 0.5);
+        pf->col_x2[j] = sqr(pf->col_x[j]);
+    }
+    for (int i=0; i<height; i++) {
+        pf->row_y[i] = -(vp_pos[1] - cam_height/2.0 + pixheight*(y0 + i + 0.5));
+        pf->row_y2[i] = sqr(pf->row_y[i]);
+    }
+}
+
+void free_primary_frame(primary_frame *pf) {
+    mem_free(pf->sphere_idx);
+    mem_free(pf->sx);
+    mem_free(pf->sy);
+    mem_free(pf->sz);
+    mem_free(pf->sc);
+    mem_free(pf->plane_idx);
+    mem_free(pf->nx);
+    mem_free(pf->ny);
+    mem_free(pf->nz);
+    mem_free(pf->pn);
+    mem_free(pf->col_x);
+    mem_free(pf->col_x2);
+    mem_free(pf->row_y);
+    mem_free(pf->row_y2);
+}
+
+/* bytes prepare_primary_frame allocates for a region this size */
+size_t primary_frame_bytes(int width, int height) {
+    return (sizeof(int) * 2 + sizeof(scalar) * 8) * MAX_OBJECTS + sizeof(scalar) * 2 * ((size_t)width + height);
+}
+
+/**
+ * Normalized primary ray direction for a pixel of the region, from the precomputed components
+ * @param pf - frame constants
+ * @param i - row within the region
+ * @param j - column within the region
+ * @param direction - output ray direction
+ */
+void primary_ray_dir(primary_frame *pf, int i, int j, scalar *direction) {
+    if (fast_math) {
+        // same steps as normalize takes with fast_math
+        scalar inv = fast_rsqrt(pf->col_x2[j] + pf->row_y2[i] + 1.0);
+        direction[0] = pf->col_x[j] * inv;
+        direction[1] = pf->row_y[i] * inv;
+        direction[2] = 1.0 * inv;
+        return;
+    }
+    scalar len = sqrt(pf->col_x2[j] + pf->row_y2[i] + 1.0);  // view plane is at z = 1
+    direction[0] = pf->col_x[j] / len;
+    direction[1] = pf->row_y[i] / len;
+    direction[2] = 1.0 / len;
+}
+
+/**
+ * Finds the closest object along a primary ray using the per-frame constants, testing only
+ * some of the spheres (and all of the planes)
+ * @param pf - frame constants
+ * @param d - normalized ray direction
+ * @param spheres - ascending indices into the frame's sphere arrays, NULL tests every sphere
+ * @param nspheres - number of entries in spheres
+ * @param ret_index - the index in objects array of the closest object, -1 for none
+ * @param ret_best_t - the distance of the closest object
+ */
+void primary_closest_subset(primary_frame *pf, scalar *d, int *spheres, int nspheres,
+                            int *ret_index, scalar *ret_best_t) {
+    int best_o = -1;
+    scalar best_t = INFINITY;
+    for (int m=0; m<nspheres; m++) {
+        int k = (spheres == NULL) ? m : spheres[m];
+        scalar t = primary_sphere_t(pf, k, d);
+        if (t > 0 && t < best_t) {
+            best_t = t;
+            best_o = pf->sphere_idx[k];
+        }
+    }
+    for (int k=0; k<pf->nplanes; k++) {
+        scalar t = primary_plane_t(pf, k, d);
+        // scalar path walks objects in index order and keeps the first of equal hits
+        if (t > 0 && (t < best_t || (t == best_t && pf->plane_idx[k] < best_o))) {
+            best_t = t;
+            best_o = pf->plane_idx[k];
+        }
+    }
+    (*ret_index) = best_o;
+    (*ret_best_t) = best_t;
+}
+
+/**
+ * Finds the closest object along a primary ray using the per-frame constants
+ * @param pf - frame constants
+ * @param d - normalized ray direction
+ * @param ret_index - the index in objects array of the closest object, -1 for none
+ * @param ret_best_t - the distance of the closest object
+ */
+void primary_closest(primary_frame *pf, scalar *d, int *ret_index, scalar *ret_best_t) {
+    primary_closest_subset(pf, d, NULL, pf->nspheres, ret_index, ret_best_t);
+}
+
+/**
+ * Renders a region of the frame with the primary visibility kernel and the usual shading.
+ * Same arguments and results as raycast_region
+ * @param img - image data for just the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void primary_region(image *img, int full_width, int full_height, int x0, int y0,
+                    scalar cam_width, scalar cam_height) {
+    primary_frame pf;
+    prepare_primary_frame(&pf, img->width, img->height, full_width, full_height, x0, y0,
+                          cam_width, cam_height);
+    Ray ray = {
+            .origin = {0, 0, 0},
+            .direction = {0, 0, 0}
+    };
+    for (int i = 0; i < img->height; i++) {
+        for (int j = 0; j < img->width; j++) {
+            primary_ray_dir(&pf, i, j, ray.direction);
+            scalar color[3] = {0, 0, 0};
+            int best_o;
+            scalar best_t;
+            primary_closest(&pf, ray.direction, &best_o, &best_t);
+            if (best_o != -1) {
+                shade(&ray, best_o, best_t, color);
+                set_pixel_color(color, i, j, img);
+            }
+            else {
+                set_pixel_color(background_color, i, j, img);
+            }
+        }
+    }
+    free_primary_frame(&pf);
+}
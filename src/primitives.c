@@ -0,0 +1,117 @@
+/* primitives.c - the scene's primitives compiled into buckets by kind
+ *
+ * Once the scene is read, every sphere and plane goes into the bucket for its kind, laid out
+ * as one array per field: spheres keep their squared radius, and planes whose normal lies along
+ * an axis (every plane in the bundled scenes) keep only the axis and their position along it,
+ * so their test is one subtraction and one divide instead of two dot products. The closest hit
+ * search runs each bucket's kernel over the bucket. The kernels compute exactly what
+ * sphere_intersect and plane_intersect do, and ties go to the lowest object index as they do
+ * when walking objects, so the hits are identical. Scenes with instances keep walking objects. */
+#include "../include/primitives.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+
+/* the current scene's buckets, see compile_primitives */
+primitive_buckets primitives;
+
+/* the axis of a unit normal that is exactly +-x, +-y or +-z, -1 for any other */
+static int normal_axis(scalar *n) {
+    for (int k=0; k<3; k++) {
+        if (fabs(n[k]) == 1 && n[(k + 1) % 3] == 0 && n[(k + 2) % 3] == 0)
+            return k;
+    }
+    return -1;
+}
+
+/**
+ * Sorts the scene's spheres and planes into buckets. Called whenever objects changes: by
+ * finish_scene, and again when lod takes spheres out
+ */
+void compile_primitives() {
+    primitives.usable = (ninstances == 0);
+    primitives.spheres.count = 0;
+    primitives.axis_planes.count = 0;
+    primitives.planes.count = 0;
+    for (int i=0; objects[i].type != 0; i++) {
+        object *obj = &objects[i];
+        if (obj->type == SPHERE) {
+            sphere_bucket *b = &primitives.spheres;
+            int k = b->count++;
+            b->index[k] = i;
+            b->cx[k] = obj->sphere.position[0];
+            b->cy[k] = obj->sphere.position[1];
+            b->cz[k] = obj->sphere.position[2];
+            b->r2[k] = sqr(obj->sphere.radius);
+        }
+        else if (obj->type == PLANE && normal_axis(obj->plane.normal) >= 0) {
+            axis_plane_bucket *b = &primitives.axis_planes;
+            int k = b->count++;
+            int axis = normal_axis(obj->plane.normal);
+            b->index[k] = i;
+            b->axis[k] = axis;
+            b->offset[k] = obj->plane.position[axis];
+        }
+        else if (obj->type == PLANE) {
+            plane_bucket *b = &primitives.planes;
+            int k = b->count++;
+            b->index[k] = i;
+            b->px[k] = obj->plane.position[0];
+            b->py[k] = obj->plane.position[1];
+            b->pz[k] = obj->plane.position[2];
+            b->nx[k] = obj->plane.normal[0];
+            b->ny[k] = obj->plane.normal[1];
+            b->nz[k] = obj->plane.normal[2];
+        }
+        else if (obj->type == INSTANCE)
+            primitives.usable = false;
+    }
+}
+
+/* keeps hit (t, i) if it's nearer than the best so far, or as near with a lower index */
+static inline void keep_closest(scalar t, int i, scalar max_distance, int *best_o, scalar *best_t) {
+    if (t > 0 && t <= max_distance && (t < *best_t || (t == *best_t && i < *best_o))) {
+        *best_t = t;
+        *best_o = i;
+    }
+}
+
+/**
+ * get_dist_and_idx_closest_obj over the buckets, for scenes where primitives.usable is set
+ * @param ray - the ray to test
+ * @param self_index - object to skip (the one a shadow ray leaves), -1 for none
+ * @param max_distance - hits farther than this don't count
+ * @param ret_index - index in objects of the closest hit, -1 for none
+ * @param ret_best_t - its distance, INFINITY for none
+ */
+void closest_primitive(Ray *ray, int self_index, scalar max_distance, int *ret_index, scalar *ret_best_t) {
+    int best_o = -1;
+    scalar best_t = INFINITY;
+    scalar *o = ray->origin, *d = ray->direction;
+
+    sphere_bucket *s = &primitives.spheres;
+    for (int k=0; k<s->count; k++) {
+        if (s->index[k] == self_index) continue;
+        scalar t = sphere_r2_intersect(o, d, s->cx[k], s->cy[k], s->cz[k], s->r2[k]);
+        keep_closest(t, s->index[k], max_distance, &best_o, &best_t);
+    }
+
+    axis_plane_bucket *a = &primitives.axis_planes;
+    for (int k=0; k<a->count; k++) {
+        if (a->index[k] == self_index) continue;
+        scalar t = axis_plane_intersect(o, d, a->axis[k], a->offset[k]);
+        keep_closest(t, a->index[k], max_distance, &best_o, &best_t);
+    }
+
+    plane_bucket *p = &primitives.planes;
+    for (int k=0; k<p->count; k++) {
+        if (p->index[k] == self_index) continue;
+        // plane_intersect, term for term
+        scalar vd = p->nx[k]*d[0] + p->ny[k]*d[1] + p->nz[k]*d[2];
+        if (fabs(vd) < 0.0001) continue;
+        scalar t = ((p->px[k] - o[0])*p->nx[k] + (p->py[k] - o[1])*p->ny[k] + (p->pz[k] - o[2])*p->nz[k]) / vd;
+        keep_closest(t, p->index[k], max_distance, &best_o, &best_t);
+    }
+
+    (*ret_index) = best_o;
+    (*ret_best_t) = best_t;
+}
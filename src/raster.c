@@ -0,0 +1,141 @@
+/* raster.c - hybrid rasterization for primary visibility
+ *
+ * Each tile keeps a depth (hit t) and object ID buffer. Objects are drawn into it one at a
+ * time in scene order: a sphere only touches the pixels inside its projected screen
+ * rectangle (see sphere_screen_rect), where the analytic ray/sphere distance gives the exact
+ * depth, and a plane covers every pixel it isn't parallel to. So primary visibility costs
+ * covered pixels instead of pixels x objects. The resulting buffer entries go through the
+ * normal shade() for lighting and shadows. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/raster.h"
+#include "../include/primary.h"
+#include "../include/frustum.h"
+#include "../include/raycaster.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/* bytes raster_region allocates for a region this size */
+size_t raster_region_bytes(int width, int height) {
+    return primary_frame_bytes(width, height) + sizeof(screen_rect) * (MAX_OBJECTS + 1) +
+           (sizeof(scalar) * 4 + sizeof(int)) * RASTER_TILE * RASTER_TILE;
+}
+
+/**
+ * Renders a region of the frame by rasterizing primary visibility tile by tile.
+ * Same arguments and results as raycast_region
+ * @param img - image data for just the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void raster_region(image *img, int full_width, int full_height, int x0, int y0,
+                   scalar cam_width, scalar cam_height) {
+    primary_frame pf;
+    prepare_primary_frame(&pf, img->width, img->height, full_width, full_height, x0, y0,
+                          cam_width, cam_height);
+
+    // screen rectangle of every sphere in region coordinates (empty if it can't be seen)
+    screen_rect *rects = mem_alloc(MEM_SCRATCH, sizeof(screen_rect) * (pf.nspheres + 1));
+    scalar *dirs = mem_alloc(MEM_SCRATCH, sizeof(scalar) * 3 * RASTER_TILE * RASTER_TILE);
+    scalar *depth = mem_alloc(MEM_SCRATCH, sizeof(scalar) * RASTER_TILE * RASTER_TILE);
+    int *ids = mem_alloc(MEM_SCRATCH, sizeof(int) * RASTER_TILE * RASTER_TILE);
+    for (int k=0; k<pf.nspheres; k++) {
+        object *obj = &objects[pf.sphere_idx[k]];
+        screen_rect rect;
+        if (!sphere_screen_rect(obj->sphere.position, obj->sphere.radius, full_width, full_height,
+                                cam_width, cam_height, &rect)) {
+            rects[k].x0 = rects[k].x1 = rects[k].y0 = rects[k].y1 = 0;
+            continue;
+        }
+        rects[k].x0 = rect.x0 - x0;
+        rects[k].x1 = rect.x1 - x0;
+        rects[k].y0 = rect.y0 - y0;
+        rects[k].y1 = rect.y1 - y0;
+    }
+
+    Ray ray = {
+            .origin = {0, 0, 0},
+            .direction = {0, 0, 0}
+    };
+    for (int ty = 0; ty < img->height; ty += RASTER_TILE) {
+        for (int tx = 0; tx < img->width; tx += RASTER_TILE) {
+            int th = (ty + RASTER_TILE > img->height) ? img->height - ty : RASTER_TILE;
+            int tw = (tx + RASTER_TILE > img->width) ? img->width - tx : RASTER_TILE;
+
+            // clear the buffers and set up the tile's ray directions
+            for (int i = 0; i < th; i++) {
+                for (int j = 0; j < tw; j++) {
+                    int p = i * RASTER_TILE + j;
+                    depth[p] = INFINITY;
+                    ids[p] = -1;
+                    primary_ray_dir(&pf, ty + i, tx + j, &dirs[3*p]);
+                }
+            }
+
+            // draw objects in scene order so equal depths keep the first object, like the scalar path
+            int ks = 0;
+            int kp = 0;
+            while (ks < pf.nspheres || kp < pf.nplanes) {
+                boolean sphere_next = kp >= pf.nplanes ||
+                                      (ks < pf.nspheres && pf.sphere_idx[ks] < pf.plane_idx[kp]);
+                if (sphere_next) {
+                    int k = ks++;
+                    int i0 = (rects[k].y0 > ty) ? rects[k].y0 - ty : 0;
+                    int i1 = (rects[k].y1 < ty + th) ? rects[k].y1 - ty : th;
+                    int j0 = (rects[k].x0 > tx) ? rects[k].x0 - tx : 0;
+                    int j1 = (rects[k].x1 < tx + tw) ? rects[k].x1 - tx : tw;
+                    for (int i = i0; i < i1; i++) {
+                        for (int j = j0; j < j1; j++) {
+                            int p = i * RASTER_TILE + j;
+                            scalar t = primary_sphere_t(&pf, k, &dirs[3*p]);
+                            if (t > 0 && t < depth[p]) {
+                                depth[p] = t;
+                                ids[p] = pf.sphere_idx[k];
+                            }
+                        }
+                    }
+                }
+                else {
+                    int k = kp++;
+                    for (int i = 0; i < th; i++) {
+                        for (int j = 0; j < tw; j++) {
+                            int p = i * RASTER_TILE + j;
+                            scalar t = primary_plane_t(&pf, k, &dirs[3*p]);
+                            if (t > 0 && t < depth[p]) {
+                                depth[p] = t;
+                                ids[p] = pf.plane_idx[k];
+                            }
+                        }
+                    }
+                }
+            }
+
+            // shade the buffer
+            for (int i = 0; i < th; i++) {
+                for (int j = 0; j < tw; j++) {
+                    int p = i * RASTER_TILE + j;
+                    if (ids[p] == -1) {
+                        set_pixel_color(background_color, ty + i, tx + j, img);
+                        continue;
+                    }
+                    scalar color[3] = {0, 0, 0};
+                    ray.direction[0] = dirs[3*p];
+                    ray.direction[1] = dirs[3*p + 1];
+                    ray.direction[2] = dirs[3*p + 2];
+                    shade(&ray, ids[p], depth[p], color);
+                    set_pixel_color(color, ty + i, tx + j, img);
+                }
+            }
+        }
+    }
+    mem_free(rects);
+    mem_free(dirs);
+    mem_free(depth);
+    mem_free(ids);
+    free_primary_frame(&pf);
+}
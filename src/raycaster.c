@@ -6,6 +6,13 @@
 #include "../include/vector_math.h"
 #include "../include/json.h"
 #include "../include/illumination.h"
+#include "../include/wavefront.h"
+#include "../include/primary.h"
+#include "../include/frustum.h"
+#include "../include/raster.h"
+#include "../include/shadowmap.h"
+#include "../include/instance.h"
+#include "../include/primitives.h"
 
 /* raycast.c - provides raycasting functionality */
 #include <stdio.h>
@@ -18,6 +25,36 @@
 /* overall background color for the image */
 V3 background_color = {0, 0, 0};
 
+/* which renderer raycast_region uses (ENGINE_*) */
+int render_engine = ENGINE_SCALAR;
+
+/* approximate square roots and powers while rendering, see vector_math.h */
+boolean fast_math = false;
+
+/* the scene's lights split into runs of one type, see compile_lights */
+light_run light_runs[MAX_OBJECTS];
+int nlight_runs = 0;
+
+/**
+ * Turns an engine name into one of the ENGINE_ constants
+ * @param str - "scalar", "wavefront", "primary", "culled" or "raster"
+ * @return - the engine, -1 if it's unknown
+ */
+int parse_engine(char *str) {
+    if (strcmp(str, "scalar") == 0)
+        return ENGINE_SCALAR;
+    if (strcmp(str, "wavefront") == 0)
+        return ENGINE_WAVEFRONT;
+    if (strcmp(str, "primary") == 0)
+        return ENGINE_PRIMARY;
+    if (strcmp(str, "culled") == 0)
+        return ENGINE_CULLED;
+    if (strcmp(str, "raster") == 0)
+        return ENGINE_RASTER;
+    fprintf(stderr, "Error: parse_engine: Unknown engine '%s' (scalar|wavefront|primary|culled|raster)\n", str);
+    return -1;
+}
+
 /**
  * Finds and gets the index in objects that has the camera width and height
  * @param objects - array of object types that represent the scene
@@ -42,31 +79,33 @@ int get_camera(object *objects) {
  * @param col - which column the pixel is on
  * @param img - image struct that allows for indexing the appropriate spot
  */
-void set_pixel_color(double *color, int row, int col, image *img) {
+void set_pixel_color(scalar *color, int row, int col, image *img) {
     // fill in pixel color values
     // the color vals are stored as values between 0 and 1, so we need to adjust
-    img->pixmap[row * img->width + col].r = (unsigned char)(MAX_COLOR_VAL * clamp(color[0]));
-    img->pixmap[row * img->width + col].g = (unsigned char)(MAX_COLOR_VAL * clamp(color[1]));
-    img->pixmap[row * img->width + col].b = (unsigned char)(MAX_COLOR_VAL * clamp(color[2]));
+    // index in 64 bits, row * width overflows an int past ~2 gigapixels
+    size_t idx = (size_t)row * img->width + col;
+    img->pixmap[idx].r = (unsigned char)(MAX_COLOR_VAL * clamp(color[0]));
+    img->pixmap[idx].g = (unsigned char)(MAX_COLOR_VAL * clamp(color[1]));
+    img->pixmap[idx].b = (unsigned char)(MAX_COLOR_VAL * clamp(color[2]));
 }
 
 /** Tests for an intersection between a ray and a plane
  * @param Ro - 3d vector of ray origin
  * @param Rd - 3d vector of ray direction
  * @param Pos - 3d vector of the plane's position
- * @param Norm - 3d vector of the normal to the plane
+ * @param Norm - 3d unit vector of the normal to the plane
  * @return - distance to the object if intersects, otherwise, -1
  */
-double plane_intersect(Ray *ray, double *Pos, double *Norm) {
-    normalize(Norm);
+scalar plane_intersect(Ray *ray, scalar *Pos, scalar *Norm) {
+    // Norm is normalized once by read_json
     // determine if plane is parallel to the ray
-    double vd = v3_dot(Norm, ray->direction);
+    scalar vd = v3_dot(Norm, ray->direction);
 
     if (fabs(vd) < 0.0001) return -1;
 
-    double vector[3];
+    scalar vector[3];
     v3_sub(Pos, ray->origin, vector);
-    double t = v3_dot(vector, Norm) / vd;
+    scalar t = v3_dot(vector, Norm) / vd;
 
     // no intersection
     if (t < 0.0)
@@ -83,9 +122,9 @@ double plane_intersect(Ray *ray, double *Pos, double *Norm) {
  * @param r - radius of the sphere
  * @return - distance to the object if intersects, otherwise, -1
  */
-double sphere_intersect(Ray *ray, double *C, double r) {
-    double b, c;
-    double vector_diff[3];
+scalar sphere_intersect(Ray *ray, scalar *C, scalar r) {
+    scalar b, c;
+    scalar vector_diff[3];
     //v3_sub(ray->direction, C, vector_diff);
     v3_sub(ray->origin, C, vector_diff);
 
@@ -94,8 +133,8 @@ double sphere_intersect(Ray *ray, double *C, double r) {
     c = sqr(vector_diff[0]) + sqr(vector_diff[1]) + sqr(vector_diff[2]) - sqr(r);
 
     // check that discriminant is <, =, or > 0
-    double disc = sqr(b) - 4*c;
-    double t;  // solutions
+    scalar disc = sqr(b) - 4*c;
+    scalar t;  // solutions
     if (disc < 0) {
         return -1; // no solution
     }
@@ -117,16 +156,21 @@ double sphere_intersect(Ray *ray, double *C, double r) {
  * @param ret_index - the index in objects array of the closest object we intersected
  * @param ret_best_t - the distance of the closest object
  */
-void get_dist_and_idx_closest_obj(Ray *ray, int self_index, double max_distance, int *ret_index, double *ret_best_t) {
+void get_dist_and_idx_closest_obj(Ray *ray, int self_index, scalar max_distance, int *ret_index, scalar *ret_best_t) {
+    // the same search over the compiled buckets, see primitives.c
+    if (primitives.usable) {
+        closest_primitive(ray, self_index, max_distance, ret_index, ret_best_t);
+        return;
+    }
     int best_o = -1;
-    double best_t = INFINITY;
+    scalar best_t = INFINITY;
     for (int i=0; objects[i].type != 0; i++) {
         // if self_index was passed in as > 0, we must ignore object i because we are checking distance to another
         // object from the one at self_index.
         if (self_index == i) continue;
 
         // we need to run intersection test on each object
-        double t = 0;
+        scalar t = 0;
         switch(objects[i].type) {
             case 0:
                 printf("no object found\n");
@@ -141,6 +185,9 @@ void get_dist_and_idx_closest_obj(Ray *ray, int self_index, double max_distance,
                 t = plane_intersect(ray, objects[i].plane.position,
                                     objects[i].plane.normal);
                 break;
+            case INSTANCE:
+                t = instance_intersect(ray, &objects[i].instance, best_t < max_distance ? best_t : max_distance);
+                break;
             default:
                 // Error
                 exit(1);
@@ -157,22 +204,152 @@ void get_dist_and_idx_closest_obj(Ray *ray, int self_index, double max_distance,
 }
 
 
+/**
+ * Adds the light from one light source to a point that is known to see that light. Inlined
+ * into one kernel per light type, spot is a constant there so the cone test folds away
+ * @param ray - original ray that hit the object
+ * @param obj - the object that was hit
+ * @param shadow_ray - ray from the hit point towards the light (direction normalized)
+ * @param distance_to_light - distance from the hit point to the light
+ * @param light - the light we are adding
+ * @param color - the light's contribution is added to this color
+ * @param spot - true for spotlights, false for point lights
+ */
+static inline void shade_light(Ray *ray, object *obj, Ray *shadow_ray, scalar distance_to_light, Light *light,
+                               scalar *color, const boolean spot) {
+    scalar normal[3];
+    Material *material;
+    v3_zero(normal); // zero out these vectors each time
+
+    // find normal and material
+    if (obj->type == PLANE) {
+        v3_copy(obj->plane.normal, normal);
+        material = &materials[obj->plane.material];
+    } else if (obj->type == SPHERE) {
+        // find normal of our current intersection on the sphere
+        v3_sub(shadow_ray->origin, obj->sphere.position, normal);
+        material = &materials[obj->sphere.material];
+    } else {
+        fprintf(stderr, "Error: shade: Trying to shade unsupported type of object\n");
+        exit(1);
+    }
+    normalize(normal);
+    // find light, reflection and camera vectors
+    scalar L[3];
+    scalar R[3];
+    scalar V[3];
+    v3_copy(shadow_ray->direction, L);
+    normalize(L);
+    v3_reflect(L, normal, R);
+    v3_copy(ray->direction, V);
+    scalar diffuse[3];
+    scalar specular[3];
+    v3_zero(diffuse);
+    v3_zero(specular);
+    calculate_diffuse(normal, L, light->color, material->diff_color, diffuse);
+    calculate_specular(SHININESS, L, R, normal, V, material->spec_color, light->color, specular);
+
+    // calculate the angular and radial attenuation
+    scalar fang = 1.0;
+    scalar frad;
+    if (spot) {
+        // get the vector from the object to the light
+        scalar light_to_obj_dir[3];
+        v3_copy(L, light_to_obj_dir);
+        v3_scale(light_to_obj_dir, -1, light_to_obj_dir);
+        fang = spot_angular_att(light, light_to_obj_dir);
+    }
+    frad = radial_att(light, distance_to_light);
+    color[0] += frad * fang * (specular[0] + diffuse[0]);
+    color[1] += frad * fang * (specular[1] + diffuse[1]);
+    color[2] += frad * fang * (specular[2] + diffuse[2]);
+}
+
+/**
+ * Adds the light from one light source to a point that sees only part of it
+ * @param ray - original ray that hit the object
+ * @param obj - the object that was hit
+ * @param shadow_ray - ray from the hit point towards the light (direction normalized)
+ * @param distance_to_light - distance from the hit point to the light
+ * @param light - the light we are adding
+ * @param visibility - fraction of the light that reaches the point (0-1)
+ * @param color - the light's contribution is added to this color
+ * @param spot - true for spotlights, false for point lights
+ */
+static inline void shade_light_visible(Ray *ray, object *obj, Ray *shadow_ray, scalar distance_to_light,
+                                       Light *light, scalar visibility, scalar *color, const boolean spot) {
+    if (visibility <= 0)
+        return;     // it's shadow
+    if (visibility >= 1) {
+        shade_light(ray, obj, shadow_ray, distance_to_light, light, color, spot);
+        return;
+    }
+    scalar partial[3] = {0, 0, 0};
+    shade_light(ray, obj, shadow_ray, distance_to_light, light, partial, spot);
+    color[0] += visibility * partial[0];
+    color[1] += visibility * partial[1];
+    color[2] += visibility * partial[2];
+}
+
+/* light_kernel for point lights: no cone test */
+void shade_point_light(Ray *ray, object *obj, Ray *shadow_ray, scalar distance_to_light, Light *light,
+                       scalar visibility, scalar *color) {
+    shade_light_visible(ray, obj, shadow_ray, distance_to_light, light, visibility, color, false);
+}
+
+/* light_kernel for spotlights: cone test against the precomputed cosine */
+void shade_spot_light(Ray *ray, object *obj, Ray *shadow_ray, scalar distance_to_light, Light *light,
+                      scalar visibility, scalar *color) {
+    shade_light_visible(ray, obj, shadow_ray, distance_to_light, light, visibility, color, true);
+}
+
+/**
+ * Prepares the lights for shading once the scene is read: fixes up radial attenuation,
+ * precomputes the spotlights' cosine cutoff and splits the lights into runs of one type, so
+ * shading loops pick a kernel per run instead of checking the type of every light. The runs
+ * keep the lights in order so colors add up exactly as they would one light at a time
+ */
+void compile_lights() {
+    nlight_runs = 0;
+    for (int i=0; i<nlights; i++) {
+        Light *light = &lights[i];
+        fix_radial_att(light);
+        light_kernel kernel = shade_point_light;
+        if (light->type == SPOTLIGHT) {
+            light->cos_theta = cos(light->theta_deg * (M_PI / 180.0));
+            kernel = shade_spot_light;
+        }
+        if (nlight_runs > 0 && light_runs[nlight_runs - 1].shade == kernel) {
+            light_runs[nlight_runs - 1].end = i + 1;
+            continue;
+        }
+        light_runs[nlight_runs].first = i;
+        light_runs[nlight_runs].end = i + 1;
+        light_runs[nlight_runs].shade = kernel;
+        nlight_runs++;
+    }
+}
+
 /**
  * @param ray - original ray -- starting point for testing shade
  * @param obj_index  - index of the current object we are running shade on
  * @param t - distance to the object
  * @param color - this will be the output color after shade calculations are done
  */
-void shade(Ray *ray, int obj_index, double t, double color[3]) {
+void shade(Ray *ray, int obj_index, scalar t, scalar *color) {
     // loop through lights and do shadow test
-    double new_origin[3];
-    double new_dir[3];
+    scalar new_origin[3];
+    scalar new_dir[3] = {0, 0, 0};
 
     // find new ray origin
     if (ray == NULL) {
         fprintf(stderr, "Error: shade: Ray had no data\n");
         exit(1);
     }
+    if (objects[obj_index].type == INSTANCE) {
+        shade_instance(ray, obj_index, t, color);
+        return;
+    }
     v3_scale(ray->direction, t, new_origin);
     v3_add(new_origin, ray->origin, new_origin);
 
@@ -181,93 +358,144 @@ void shade(Ray *ray, int obj_index, double t, double color[3]) {
             .direction = {new_dir[0], new_dir[1], new_dir[2]}
     };
 
-    for (int i=0; i<nlights; i++) {
-        // find new ray direction
-        v3_sub(lights[i].position, ray_new.origin, ray_new.direction);
-        double distance_to_light = v3_len(ray_new.direction);
-        normalize(ray_new.direction);
-
-        int best_o;     // index of closest object
-        double best_t;  // distance of closest object
-
-        // new check new ray for intersections with other objects
-        get_dist_and_idx_closest_obj(&ray_new, obj_index, distance_to_light, &best_o, &best_t);
-
-        double normal[3];
-        double obj_diff_color[3];
-        double obj_spec_color[3];
-        if (best_o == -1) { // this means there was no object in the way between the current one and the light
-            v3_zero(normal); // zero out these vectors each time
-            v3_zero(obj_diff_color);
-            v3_zero(obj_spec_color);
-
-            // find normal and color
-            if (objects[obj_index].type == PLANE) {
-                v3_copy(objects[obj_index].plane.normal, normal);
-                v3_copy(objects[obj_index].plane.diff_color, obj_diff_color);
-                v3_copy(objects[obj_index].plane.spec_color, obj_spec_color);
-            } else if (objects[obj_index].type == SPHERE) {
-                // find normal of our current intersection on the sphere
-                v3_sub(ray_new.origin, objects[obj_index].sphere.position, normal);
-                // copy the colors into temp variables
-                v3_copy(objects[obj_index].sphere.diff_color, obj_diff_color);
-                v3_copy(objects[obj_index].sphere.spec_color, obj_spec_color);
-            } else {
-                fprintf(stderr, "Error: shade: Trying to shade unsupported type of object\n");
-                exit(1);
+    for (int r=0; r<nlight_runs; r++) {
+        light_kernel kernel = light_runs[r].shade;
+        for (int i=light_runs[r].first; i<light_runs[r].end; i++) {
+            // find new ray direction
+            v3_sub(lights[i].position, ray_new.origin, ray_new.direction);
+            scalar distance_to_light = v3_len(ray_new.direction);
+            normalize(ray_new.direction);
+
+            if (shadow_maps != NULL) {
+                // approximate the shadow ray with the light's shadow map
+                scalar visibility = shadow_map_visibility(i, obj_index, ray_new.origin, distance_to_light);
+                kernel(ray, &objects[obj_index], &ray_new, distance_to_light, &lights[i], visibility, color);
+                continue;
             }
-            normalize(normal);
-            // find light, reflection and camera vectors
-            double L[3];
-            double R[3];
-            double V[3];
-            v3_copy(ray_new.direction, L);
-            normalize(L);
-            v3_reflect(L, normal, R);
-            v3_copy(ray->direction, V);
-            double diffuse[3];
-            double specular[3];
-            v3_zero(diffuse);
-            v3_zero(specular);
-            calculate_diffuse(normal, L, lights[i].color, obj_diff_color, diffuse);
-            calculate_specular(SHININESS, L, R, normal, V, obj_spec_color, lights[i].color, specular);
-
-            // calculate the angular and radial attenuation
-            double fang;
-            double frad;
-            // get the vector from the object to the light
-            double light_to_obj_dir[3];
-            v3_copy(L, light_to_obj_dir);
-            v3_scale(light_to_obj_dir, -1, light_to_obj_dir);
-
-            fang = calculate_angular_att(&lights[i], light_to_obj_dir);
-            frad = calculate_radial_att(&lights[i], distance_to_light);
-            color[0] += frad * fang * (specular[0] + diffuse[0]);
-            color[1] += frad * fang * (specular[1] + diffuse[1]);
-            color[2] += frad * fang * (specular[2] + diffuse[2]);
+
+            int best_o;     // index of closest object
+            scalar best_t;  // distance of closest object
+
+            // new check new ray for intersections with other objects
+            Ray shadow_test = ray_new;
+            scalar test_distance = distance_to_light;
+            offset_shadow_ray(&shadow_test, t, &test_distance);
+            get_dist_and_idx_closest_obj(&shadow_test, obj_index, test_distance, &best_o, &best_t);
+
+            if (best_o == -1) // this means there was no object in the way between the current one and the light
+                kernel(ray, &objects[obj_index], &ray_new, distance_to_light, &lights[i], 1.0, color);
+            // there was an object in the way, so we don't do anything. It's shadow
         }
-        // there was an object in the way, so we don't do anything. It's shadow
     }
 }
 
 /**
- * Shoots out rays over a viewplane of dimensions stored in img and looks through
- * the array of objects for an intersection for each pixel.
- * @param img - image data (width, height, pixmap...)
+ * Finds the normalized direction of the primary ray through the center of a pixel
+ * @param row - which row of the full frame the pixel is on
+ * @param col - which column of the full frame the pixel is on
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param direction - output ray direction
+ */
+void get_primary_ray_dir(int row, int col, int full_width, int full_height,
+                         scalar cam_width, scalar cam_height, scalar *direction) {
+    scalar vp_pos[3] = {0, 0, 1};   // view plane position
+    scalar pixheight = (scalar)cam_height / (scalar)full_height;
+    scalar pixwidth = (scalar)cam_width / (scalar)full_width;
+
+    direction[0] = vp_pos[0] - cam_width/2.0 + pixwidth*(col + 0.5);
+    direction[1] = -(vp_pos[1] - cam_height/2.0 + pixheight*(row + 0.5));
+    direction[2] = vp_pos[2];    // set intersecting point Z to viewplane Z
+    normalize(direction);
+}
+
+/**
+ * Estimates how expensive a pixel is to render, in intersection tests. Every primary ray
+ * tests every object and a hit adds one shadow ray per light on top of that.
+ * @param row - which row of the full frame the pixel is on
+ * @param col - which column of the full frame the pixel is on
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @return - estimated number of intersection tests for the pixel
+ */
+double estimate_pixel_cost(int row, int col, int full_width, int full_height,
+                           scalar cam_width, scalar cam_height) {
+    Ray ray = {
+            .origin = {0, 0, 0},
+            .direction = {0, 0, 0}
+    };
+    get_primary_ray_dir(row, col, full_width, full_height, cam_width, cam_height, ray.direction);
+
+    int best_o;
+    scalar best_t;
+    get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+    if (best_o == -1)
+        return nobjects;
+    return nobjects * (1.0 + nlights);
+}
+
+/**
+ * Most bytes raycast_region can allocate for a region this size with the current engine
+ * @param width - width of the region
+ * @param height - height of the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+size_t region_bytes(int width, int height, int full_width, int full_height, scalar cam_width, scalar cam_height) {
+    int engine = (ninstances > 0) ? ENGINE_SCALAR : render_engine;
+    if (engine == ENGINE_WAVEFRONT)
+        return wavefront_region_bytes();
+    if (engine == ENGINE_PRIMARY)
+        return primary_frame_bytes(width, height);
+    if (engine == ENGINE_CULLED)
+        return culled_region_bytes(width, height, full_width, full_height, cam_width, cam_height);
+    if (engine == ENGINE_RASTER)
+        return raster_region_bytes(width, height);
+    return 0;   // the scalar loop only uses the stack
+}
+
+/**
+ * Shoots out rays over a rectangular region of the viewplane and looks through the array
+ * of objects for an intersection for each pixel. Pixels come out exactly the same as they
+ * would in a full frame render, so regions can be rendered separately and stitched.
+ * @param img - image data for just the region (width and height are the region's size)
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
  * @param cam_width - camera width
  * @param cam_height - camera height
  * @param objects - array of objects in the scene
  */
-void raycast_scene(image *img, double cam_width, double cam_height, object *objects) {
+void raycast_region(image *img, int full_width, int full_height, int x0, int y0,
+                    scalar cam_width, scalar cam_height, object *objects) {
+    // the other engines only know spheres and planes, instanced scenes always use the scalar loop
+    int engine = (ninstances > 0) ? ENGINE_SCALAR : render_engine;
+    if (engine == ENGINE_WAVEFRONT) {
+        wavefront_region(img, full_width, full_height, x0, y0, cam_width, cam_height);
+        return;
+    }
+    if (engine == ENGINE_PRIMARY) {
+        primary_region(img, full_width, full_height, x0, y0, cam_width, cam_height);
+        return;
+    }
+    if (engine == ENGINE_CULLED) {
+        culled_region(img, full_width, full_height, x0, y0, cam_width, cam_height);
+        return;
+    }
+    if (engine == ENGINE_RASTER) {
+        raster_region(img, full_width, full_height, x0, y0, cam_width, cam_height);
+        return;
+    }
+
     // loop over all pixels and test for intesections with objects.
     // store results in pixmap
-    double vp_pos[3] = {0, 0, 1};   // view plane position
-    //double Ro[3] = {0, 0, 0};       // camera position (ray origin)
-    double point[3] = {0, 0, 0};    // point on viewplane where intersection happens
-
-    double pixheight = (double)cam_height / (double)img->height;
-    double pixwidth = (double)cam_width / (double)img->width;
-
     Ray ray = {
             .origin = {0, 0, 0},
             .direction = {0, 0, 0}
@@ -276,17 +504,12 @@ void raycast_scene(image *img, double cam_width, double cam_height, object *obje
     for (int i = 0; i < img->height; i++) {
         for (int j = 0; j < img->width; j++) {
             v3_zero(ray.origin);
-            v3_zero(ray.direction);
-            point[0] = vp_pos[0] - cam_width/2.0 + pixwidth*(j + 0.5);
-            point[1] = -(vp_pos[1] - cam_height/2.0 + pixheight*(i + 0.5));
-            point[2] = vp_pos[2];    // set intersecting point Z to viewplane Z
-            normalize(point);   // normalize the point
-            // store normalized point as our ray direction
-            v3_copy(point, ray.direction);
-            double color[3] = {0, 0, 0};
+            // store normalized point on the viewplane as our ray direction
+            get_primary_ray_dir(y0 + i, x0 + j, full_width, full_height, cam_width, cam_height, ray.direction);
+            scalar color[3] = {0, 0, 0};
 
             int best_o;     // index of 'best' or closest object
-            double best_t;  // closest distance
+            scalar best_t;  // closest distance
             get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
 
             // set ambient color
@@ -299,4 +522,39 @@ void raycast_scene(image *img, double cam_width, double cam_height, object *obje
             }
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Shoots out rays over a viewplane of dimensions stored in img and looks through
+ * the array of objects for an intersection for each pixel.
+ * @param img - image data (width, height, pixmap...)
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param objects - array of objects in the scene
+ */
+void raycast_scene(image *img, scalar cam_width, scalar cam_height, object *objects) {
+    raycast_region(img, img->width, img->height, 0, 0, cam_width, cam_height, objects);
+}
+
+/**
+ * Same as raycast_scene but renders the frame in bands of rows and calls done after each
+ * band is finished, so the rows can be consumed (e.g. written out) while rendering goes on
+ * @param img - image data (width, height, pixmap...)
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param objects - array of objects in the scene
+ * @param band_rows - rows per band
+ * @param done - called with the finished rows [y0, y1) and arg
+ * @param arg - passed through to done
+ */
+void raycast_scene_bands(image *img, scalar cam_width, scalar cam_height, object *objects,
+                         int band_rows, band_callback done, void *arg) {
+    for (int y0 = 0; y0 < img->height; y0 += band_rows) {
+        int rows = (y0 + band_rows > img->height) ? img->height - y0 : band_rows;
+        image band_img = *img;
+        band_img.pixmap = &img->pixmap[(size_t)y0 * img->width];
+        band_img.height = rows;
+        raycast_region(&band_img, img->width, img->height, 0, y0, cam_width, cam_height, objects);
+        done(y0, y0 + rows, arg);
+    }
+}
@@ -0,0 +1,268 @@
+/* scene_diff.c - compares two parses of the scene
+ *
+ * A snapshot holds the scene's arrays from one parse. The vectors they point to are left alone
+ * by the next parse, which allocates its own, so the old scene can be compared against the new
+ * one and freed afterwards. An object is the same in both when its type, geometry and material
+ * (or its instance transform and everything in its prototype) are equal, and every object that
+ * isn't contributes the bounding sphere it had before and after, so callers can find the rays
+ * the change can reach. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/scene_diff.h"
+#include "../include/vector_math.h"
+#include "../include/shadowmap.h"
+#include "../include/memstats.h"
+
+/**
+ * Copies the global scene into a snapshot. The vectors are shared with the scene, the
+ * materials are copied when asked since the next parse reuses their buffer
+ * @param s - output snapshot
+ * @param copy_materials - true to give the snapshot its own materials
+ */
+void take_snapshot(scene_snapshot *s, boolean copy_materials) {
+    memcpy(s->objects, objects, sizeof(objects));
+    s->nobjects = nobjects;
+    memcpy(s->lights, lights, sizeof(lights));
+    s->nlights = nlights;
+    memcpy(s->prototypes, prototypes, sizeof(prototypes));
+    s->nprototypes = nprototypes;
+    s->nmaterials = nmaterials;
+    s->materials = materials;
+    if (copy_materials) {
+        s->materials = mem_alloc(MEM_MATERIALS, sizeof(Material) * (nmaterials > 0 ? nmaterials : 1));
+        memcpy(s->materials, materials, sizeof(Material) * nmaterials);
+    }
+}
+
+/* frees the vectors of the objects in a type 0 terminated list */
+static void free_object_vectors(object *list) {
+    for (int i=0; list[i].type != 0; i++) {
+        if (list[i].type == SPHERE) {
+            json_free(list[i].sphere.position);
+        }
+        else if (list[i].type == PLANE) {
+            json_free(list[i].plane.position);
+            json_free(list[i].plane.normal);
+        }
+        else if (list[i].type == CAMERA) {
+            json_free(list[i].camera.position);
+            json_free(list[i].camera.direction);
+            json_free(list[i].camera.up);
+        }
+    }
+}
+
+/**
+ * Frees a scene that is no longer rendered. Only for scenes read by read_json, the parallel
+ * parser's vectors live in arenas
+ * @param s - snapshot taken with its own materials
+ */
+void free_snapshot(scene_snapshot *s) {
+    free_object_vectors(s->objects);
+    for (int k=0; k<s->nprototypes; k++) {
+        free_object_vectors(s->prototypes[k].objects);
+        mem_free(s->prototypes[k].objects);
+        mem_free(s->prototypes[k].name);
+    }
+    for (int l=0; l<s->nlights; l++) {
+        json_free(s->lights[l].color);
+        json_free(s->lights[l].position);
+        json_free(s->lights[l].direction);
+    }
+    mem_free(s->materials);
+}
+
+/**
+ * Parses the scene again, keeping the scene it replaces to compare against. Shadow maps
+ * belong to the old scene and are freed
+ * @param json - the new scene, closed once it's read
+ * @param old - output copy of the scene before, with its own materials
+ * @param cur - output copy of the new scene
+ */
+void reparse_scene(FILE *json, scene_snapshot *old, scene_snapshot *cur) {
+    take_snapshot(old, true);
+    free_shadow_maps();
+    init_lights();
+    init_objects();
+    read_json(json);
+    take_snapshot(cur, false);
+}
+
+/* equal vectors, either may be NULL for a vector that wasn't given */
+static boolean same_vector(scalar *a, scalar *b) {
+    if (a == NULL || b == NULL)
+        return a == b;
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+static boolean same_light(Light *a, Light *b) {
+    return a->type == b->type && same_vector(a->color, b->color) &&
+           same_vector(a->position, b->position) && same_vector(a->direction, b->direction) &&
+           a->theta_deg == b->theta_deg && a->rad_att0 == b->rad_att0 && a->rad_att1 == b->rad_att1 &&
+           a->rad_att2 == b->rad_att2 && a->ang_att0 == b->ang_att0;
+}
+
+static boolean same_material(scene_snapshot *sa, int a, scene_snapshot *sb, int b) {
+    return memcmp(&sa->materials[a], &sb->materials[b], sizeof(Material)) == 0;
+}
+
+static boolean same_prototype(scene_snapshot *sa, int a, scene_snapshot *sb, int b);
+
+/**
+ * Tests whether an object renders the same in two versions of the scene
+ * @param sa - first scene
+ * @param a - the object in sa (or in one of its prototypes)
+ * @param sb - second scene
+ * @param b - the object in sb
+ * @return - true if type, geometry and material all match
+ */
+static boolean same_object(scene_snapshot *sa, object *a, scene_snapshot *sb, object *b) {
+    if (a->type != b->type)
+        return false;
+    switch (a->type) {
+        case CAMERA:
+            return a->camera.width == b->camera.width && a->camera.height == b->camera.height &&
+                   same_vector(a->camera.position, b->camera.position) &&
+                   same_vector(a->camera.direction, b->camera.direction) &&
+                   same_vector(a->camera.up, b->camera.up);
+        case SPHERE:
+            return same_vector(a->sphere.position, b->sphere.position) &&
+                   a->sphere.radius == b->sphere.radius &&
+                   same_material(sa, a->sphere.material, sb, b->sphere.material);
+        case PLANE:
+            return same_vector(a->plane.position, b->plane.position) &&
+                   same_vector(a->plane.normal, b->plane.normal) &&
+                   same_material(sa, a->plane.material, sb, b->plane.material);
+        case INSTANCE:
+            return same_vector(a->instance.translate, b->instance.translate) &&
+                   a->instance.scale == b->instance.scale &&
+                   same_prototype(sa, a->instance.prototype, sb, b->instance.prototype);
+        default:
+            return true;
+    }
+}
+
+static boolean same_prototype(scene_snapshot *sa, int a, scene_snapshot *sb, int b) {
+    Prototype *pa = &sa->prototypes[a];
+    Prototype *pb = &sb->prototypes[b];
+    if (pa->nobjects != pb->nobjects)
+        return false;
+    for (int i=0; i<pa->nobjects; i++) {
+        if (!same_object(sa, &pa->objects[i], sb, &pb->objects[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * World space bounding sphere of a scene object
+ * @param s - scene the object is in
+ * @param obj - the object
+ * @param bound - output bound
+ * @return - false for objects that draw nothing (the camera)
+ */
+static boolean object_bound(scene_snapshot *s, object *obj, diff_bound *bound) {
+    switch (obj->type) {
+        case SPHERE:
+            v3_copy(obj->sphere.position, bound->center);
+            bound->radius = obj->sphere.radius;
+            return true;
+        case PLANE:
+            v3_zero(bound->center);
+            bound->radius = INFINITY;
+            return true;
+        case INSTANCE: {
+            Prototype *proto = &s->prototypes[obj->instance.prototype];
+            v3_scale(proto->center, obj->instance.scale, bound->center);
+            v3_add(bound->center, obj->instance.translate, bound->center);
+            bound->radius = proto->radius * obj->instance.scale;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Compares two versions of the scene. Objects keep their identity across an insert or delete:
+ * the unchanged run at the start and at the end of the list are matched up and everything
+ * between them counts as changed
+ * @param old - scene before the change
+ * @param cur - scene after the change
+ * @param diff - output differences
+ */
+void diff_scenes(scene_snapshot *old, scene_snapshot *cur, scene_diff *diff) {
+    diff->everything = false;
+    diff->nbounds = 0;
+    diff->nchanged_lights = 0;
+    diff->light_count_changed = (old->nlights != cur->nlights);
+    for (int l=0; l<cur->nlights; l++) {
+        diff->light_changed[l] = diff->light_count_changed || !same_light(&old->lights[l], &cur->lights[l]);
+        if (diff->light_changed[l])
+            diff->nchanged_lights++;
+    }
+
+    int prefix = 0;
+    while (prefix < old->nobjects && prefix < cur->nobjects &&
+           same_object(old, &old->objects[prefix], cur, &cur->objects[prefix]))
+        prefix++;
+    int suffix = 0;
+    while (suffix < old->nobjects - prefix && suffix < cur->nobjects - prefix &&
+           same_object(old, &old->objects[old->nobjects - 1 - suffix], cur, &cur->objects[cur->nobjects - 1 - suffix]))
+        suffix++;
+    diff->prefix = prefix;
+    diff->shift = cur->nobjects - old->nobjects;
+    for (int i=prefix; i<old->nobjects - suffix; i++) {
+        if (old->objects[i].type == CAMERA)
+            diff->everything = true;
+        else if (object_bound(old, &old->objects[i], &diff->bounds[diff->nbounds]))
+            diff->nbounds++;
+    }
+    for (int i=prefix; i<cur->nobjects - suffix; i++) {
+        if (cur->objects[i].type == CAMERA)
+            diff->everything = true;
+        else if (object_bound(cur, &cur->objects[i], &diff->bounds[diff->nbounds]))
+            diff->nbounds++;
+    }
+    for (int k=0; k<diff->nbounds; k++) {
+        diff_bound *bound = &diff->bounds[k];
+        if (bound->radius == INFINITY)
+            diff->everything = true;
+        // a little larger so rounding can't let a real hit slip past the test
+        bound->radius += 1000 * SCALAR_ROUNDING * (bound->radius + v3_len(bound->center)) + SCALAR_ROUNDING;
+    }
+}
+
+/* tests whether the segment from p along unit direction d for length len touches a bound */
+boolean segment_hits_bound(scalar *p, scalar *d, scalar len, diff_bound *bound) {
+    scalar v[3];
+    v3_sub(bound->center, p, v);
+    scalar t = v3_dot(v, d);
+    if (t < 0)
+        t = 0;
+    if (t > len)
+        t = len;
+    scalar closest[3];
+    v3_scale(d, t, closest);
+    v3_add(closest, p, closest);
+    v3_sub(bound->center, closest, v);
+    return v3_dot(v, v) <= sqr(bound->radius);
+}
+
+/**
+ * Tests whether a segment passes through anything that changed
+ * @param origin - start of the segment
+ * @param d - unit direction of the segment
+ * @param len - length of the segment, INFINITY for a ray
+ * @param diff - the changes
+ * @return - true if any changed object's bound is touched
+ */
+boolean ray_hits_changed(scalar *origin, scalar *d, scalar len, scene_diff *diff) {
+    for (int k=0; k<diff->nbounds; k++) {
+        if (segment_hits_bound(origin, d, len, &diff->bounds[k]))
+            return true;
+    }
+    return false;
+}
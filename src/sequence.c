@@ -0,0 +1,249 @@
+/* sequence.c - renders a numbered sequence of scene files as an animation
+ *
+ * Frame k is read from the scene pattern with k filled in (e.g. anim/frame%03d.json) and written
+ * to the output pattern. Between frames most pixels see the same thing, so every pixel keeps its
+ * primary hit and, per light, whether its shadow ray got through. Each frame is compared with
+ * the one before (scene_diff.c) and a pixel reuses its primary hit when its primary ray doesn't
+ * pass through the bound of anything that changed, and a light's visibility when that light
+ * didn't change and the shadow ray doesn't pass through one of those bounds either. Only the
+ * rest is traced. Shading runs for every pixel with the same arithmetic as shade, so frames
+ * match a full render exactly. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include "../include/sequence.h"
+#include "../include/scene_diff.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/shadowmap.h"
+#include "../include/writer.h"
+#include "../include/memstats.h"
+
+/**
+ * Checks that a file name pattern has exactly one frame number conversion (%d, %03d, ...)
+ * @param pattern - the pattern
+ * @return - 0 if it's usable, -1 (after printing why) if not
+ */
+int check_frame_pattern(const char *pattern) {
+    int conversions = 0;
+    for (const char *c = pattern; *c != '\0'; c++) {
+        if (*c != '%')
+            continue;
+        c++;
+        if (*c == '%')
+            continue;   // a literal percent sign
+        while (isdigit((unsigned char)*c))
+            c++;
+        if (*c != 'd') {
+            fprintf(stderr, "Error: check_frame_pattern: Only %%d conversions are allowed in '%s'\n", pattern);
+            return -1;
+        }
+        conversions++;
+    }
+    if (conversions != 1) {
+        fprintf(stderr, "Error: check_frame_pattern: '%s' needs exactly one %%d for the frame number\n", pattern);
+        return -1;
+    }
+    return 0;
+}
+
+/* fills the frame number into a pattern checked by check_frame_pattern */
+static void frame_path(const char *pattern, int frame, char *path) {
+    if (snprintf(path, MAX_FRAME_PATH, pattern, frame) >= MAX_FRAME_PATH) {
+        fprintf(stderr, "Error: frame_path: File name for frame %d is too long\n", frame);
+        exit(1);
+    }
+}
+
+/**
+ * Renders one frame, reusing what the cache holds wherever the changes since the last frame
+ * can't reach
+ * @param img - the frame
+ * @param cache - what every pixel saw last frame, updated for this one
+ * @param diff - changes since the last frame. Nothing is reused if diff->everything is set
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param stats - reuse counts are added to this
+ */
+static void render_cached(image *img, frame_cache *cache, scene_diff *diff, scalar cam_width,
+                          scalar cam_height, reuse_stats *stats) {
+    Ray ray = {.origin = {0, 0, 0}};
+    for (int i = 0; i < img->height; i++) {
+        for (int j = 0; j < img->width; j++) {
+            size_t p = (size_t)i * img->width + j;
+            v3_zero(ray.origin);
+            get_primary_ray_dir(i, j, img->width, img->height, cam_width, cam_height, ray.direction);
+            stats->pixels++;
+
+            int best_o;
+            scalar best_t;
+            boolean reuse = !diff->everything && !ray_hits_changed(ray.origin, ray.direction, INFINITY, diff);
+            if (reuse) {
+                // nothing that changed is on the ray, so it still hits the same object
+                best_o = cache->obj[p];
+                best_t = cache->t[p];
+                if (best_o >= diff->prefix)
+                    best_o += diff->shift;
+                stats->primary_reused++;
+            }
+            else {
+                get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+                if (!(best_t > 0 && best_t != INFINITY))
+                    best_o = -1;
+            }
+            cache->obj[p] = best_o;
+            cache->t[p] = best_t;
+            if (best_o == -1) {
+                set_pixel_color(background_color, i, j, img);
+                continue;
+            }
+
+            scalar color[3] = {0, 0, 0};
+            if (objects[best_o].type == INSTANCE) {
+                // the primitive inside the instance isn't cached, shade it in full
+                shade(&ray, best_o, best_t, color);
+                set_pixel_color(color, i, j, img);
+                stats->shadow_rays += nlights;
+                continue;
+            }
+
+            // same steps as shade, with the shadow test taken from the cache where possible
+            Ray ray_new;
+            v3_scale(ray.direction, best_t, ray_new.origin);
+            v3_add(ray_new.origin, ray.origin, ray_new.origin);
+            for (int r=0; r<nlight_runs; r++) {
+                light_kernel kernel = light_runs[r].shade;
+                for (int l=light_runs[r].first; l<light_runs[r].end; l++) {
+                    v3_sub(lights[l].position, ray_new.origin, ray_new.direction);
+                    scalar distance_to_light = v3_len(ray_new.direction);
+                    normalize(ray_new.direction);
+
+                    unsigned char *visible = &cache->visible[p * cache->nlights + l];
+                    scalar visibility;
+                    if (shadow_maps != NULL) {
+                        visibility = shadow_map_visibility(l, best_o, ray_new.origin, distance_to_light);
+                    }
+                    else {
+                        stats->shadow_rays++;
+                        if (reuse && !diff->light_changed[l] &&
+                            !ray_hits_changed(ray_new.origin, ray_new.direction, distance_to_light, diff)) {
+                            stats->shadow_reused++;
+                        }
+                        else {
+                            int shadow_o;
+                            scalar shadow_t;
+                            Ray shadow_test = ray_new;
+                            scalar test_distance = distance_to_light;
+                            offset_shadow_ray(&shadow_test, best_t, &test_distance);
+                            get_dist_and_idx_closest_obj(&shadow_test, best_o, test_distance, &shadow_o, &shadow_t);
+                            *visible = (shadow_o == -1);
+                        }
+                        visibility = *visible ? 1 : 0;
+                    }
+                    kernel(&ray, &objects[best_o], &ray_new, distance_to_light, &lights[l], visibility, color);
+                }
+            }
+            set_pixel_color(color, i, j, img);
+        }
+    }
+}
+
+static void print_reuse(FILE *out, const char *label, reuse_stats *stats) {
+    fprintf(out, "%s: primary hits reused %zu of %zu (%.1f%%), shadow rays reused %zu of %zu (%.1f%%)\n",
+            label, stats->primary_reused, stats->pixels,
+            stats->pixels ? 100.0 * stats->primary_reused / stats->pixels : 0.0,
+            stats->shadow_reused, stats->shadow_rays,
+            stats->shadow_rays ? 100.0 * stats->shadow_reused / stats->shadow_rays : 0.0);
+}
+
+/**
+ * Renders frames 0 to frames-1 of a scene sequence, each into its own output file
+ * @param scene_pattern - scene file name pattern with one %d for the frame number
+ * @param out_pattern - output file name pattern with one %d for the frame number
+ * @param frames - number of frames
+ * @param format - output encoding
+ * @param img - frame size, the pixmap is allocated here
+ * @param shadow_res - shadow map resolution, 0 for ray traced shadows
+ * @param pcf - shadow map PCF kernel width
+ */
+void render_sequence(const char *scene_pattern, const char *out_pattern, int frames, int format,
+                     image *img, int shadow_res, int pcf) {
+    size_t npixels = (size_t)img->width * img->height;
+    frame_cache cache = {.nlights = 0, .visible = NULL};
+    img->pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel) * npixels);
+    cache.obj = mem_alloc(MEM_ACCEL, sizeof(int) * npixels);
+    cache.t = mem_alloc(MEM_ACCEL, sizeof(scalar) * npixels);
+    scene_snapshot *old = mem_alloc(MEM_SCENE, sizeof(scene_snapshot));
+    scene_snapshot *cur = mem_alloc(MEM_SCENE, sizeof(scene_snapshot));
+    scene_diff *diff = mem_alloc(MEM_SCENE, sizeof(scene_diff));
+
+    reuse_stats total = {0, 0, 0, 0};
+    char path[MAX_FRAME_PATH];
+    for (int f=0; f<frames; f++) {
+        frame_path(scene_pattern, f, path);
+        FILE *json = fopen(path, "rb");
+        if (json == NULL) {
+            fprintf(stderr, "Error: render_sequence: Failed to open input file '%s'\n", path);
+            exit(1);
+        }
+        if (f == 0) {
+            init_lights();
+            init_objects();
+            read_json(json);
+            diff->everything = true;
+        }
+        else {
+            reparse_scene(json, old, cur);
+            diff_scenes(old, cur, diff);
+        }
+
+        int cam = get_camera(objects);
+        if (cam == -1) {
+            fprintf(stderr, "Error: render_sequence: No camera object found in '%s'\n", path);
+            exit(1);
+        }
+        if (shadow_res > 0)
+            build_shadow_maps(shadow_res, pcf);
+        if (nlights != cache.nlights) {
+            // new visibility entries are never read, a changed light count changes every light
+            cache.nlights = nlights;
+            mem_free(cache.visible);
+            cache.visible = mem_alloc(MEM_ACCEL, npixels * (nlights > 0 ? nlights : 1));
+        }
+
+        reuse_stats stats = {0, 0, 0, 0};
+        render_cached(img, &cache, diff, objects[cam].camera.width, objects[cam].camera.height, &stats);
+        if (f > 0)
+            free_snapshot(old);
+
+        frame_path(out_pattern, f, path);
+        band_writer writer;
+        if (open_writer(&writer, path, format, img) < 0)
+            exit(1);
+        write_band(&writer, 0, img->height);
+        if (close_writer(&writer) < 0)
+            exit(1);
+
+        char label[MAX_FRAME_PATH + 32];
+        snprintf(label, sizeof(label), "frame %d (%s)", f, path);
+        print_reuse(stdout, label, &stats);
+        if (f > 0) {
+            total.pixels += stats.pixels;
+            total.primary_reused += stats.primary_reused;
+            total.shadow_rays += stats.shadow_rays;
+            total.shadow_reused += stats.shadow_reused;
+        }
+    }
+    if (frames > 1)
+        print_reuse(stdout, "after the first frame", &total);
+
+    free_shadow_maps();
+    mem_free(cache.obj);
+    mem_free(cache.t);
+    mem_free(cache.visible);
+    mem_free(old);
+    mem_free(cur);
+    mem_free(diff);
+}
@@ -0,0 +1,182 @@
+/* shadowmap.c - shadow maps for point lights and spotlights
+ *
+ * Before the main pass every light gets a depth map holding the distance from the light to
+ * the closest object through each texel: a cube map (six faces) for point lights and a single
+ * face covering the cone for spotlights, along with which object that is. Shading then compares the hit point's distance to
+ * the light against the map, with a small bias and optional PCF filtering, instead of tracing
+ * a shadow ray through every object. Like a shadow ray, a texel showing the receiver itself
+ * never shadows it. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/shadowmap.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/memstats.h"
+
+/* global variables */
+shadow_map *shadow_maps = NULL;
+int shadow_pcf = DEFAULT_SHADOW_PCF;
+
+/* the two axes that aren't the major axis a, in increasing order */
+static void minor_axes(int a, int *a1, int *a2) {
+    *a1 = (a == 0) ? 1 : 0;
+    *a2 = (a == 2) ? 1 : 2;
+}
+
+/**
+ * Finds where a direction from the light lands on its map
+ * @param map - the light's map
+ * @param v - direction from the light (doesn't need to be normalized)
+ * @param face - output face
+ * @param u - output horizontal face coordinate in [-1, 1]
+ * @param w - output vertical face coordinate in [-1, 1]
+ * @return - false if the direction is outside a spotlight's map
+ */
+static boolean map_coords(shadow_map *map, scalar *v, int *face, scalar *u, scalar *w) {
+    if (map->kind == SHADOW_SPOT) {
+        scalar z = v3_dot(v, map->forward);
+        if (z <= 0)
+            return false;
+        *face = 0;
+        *u = v3_dot(v, map->right) / (z * map->tan_half);
+        *w = v3_dot(v, map->up) / (z * map->tan_half);
+        return fabs(*u) <= 1 && fabs(*w) <= 1;
+    }
+    int a = 0;
+    if (fabs(v[1]) > fabs(v[a])) a = 1;
+    if (fabs(v[2]) > fabs(v[a])) a = 2;
+    int a1, a2;
+    minor_axes(a, &a1, &a2);
+    scalar m = fabs(v[a]);
+    *face = 2*a + (v[a] >= 0 ? 0 : 1);
+    *u = v[a1] / m;
+    *w = v[a2] / m;
+    return true;
+}
+
+/* normalized direction from the light through the center of a texel */
+static void texel_dir(shadow_map *map, int face, int ix, int iy, scalar *dir) {
+    scalar u = (ix + 0.5) / map->res * 2.0 - 1.0;
+    scalar w = (iy + 0.5) / map->res * 2.0 - 1.0;
+    if (map->kind == SHADOW_SPOT) {
+        for (int k=0; k<3; k++)
+            dir[k] = map->forward[k] + u * map->tan_half * map->right[k] + w * map->tan_half * map->up[k];
+    }
+    else {
+        int a = face / 2;
+        int a1, a2;
+        minor_axes(a, &a1, &a2);
+        dir[a] = (face % 2 == 0) ? 1 : -1;
+        dir[a1] = u;
+        dir[a2] = w;
+    }
+    normalize(dir);
+}
+
+/**
+ * Renders a depth map for every light. Spotlights up to SHADOW_MAX_SPOT_DEG get a single face
+ * covering their cone, everything else a cube map
+ * @param res - width and height of each face in texels
+ * @param pcf - PCF kernel width in texels
+ */
+void build_shadow_maps(int res, int pcf) {
+    shadow_maps = mem_calloc(MEM_ACCEL, nlights > 0 ? nlights : 1, sizeof(shadow_map));
+    shadow_pcf = pcf;
+    for (int l=0; l<nlights; l++) {
+        shadow_map *map = &shadow_maps[l];
+        Light *light = &lights[l];
+        map->res = res;
+        if (light->type == SPOTLIGHT && light->theta_deg <= SHADOW_MAX_SPOT_DEG) {
+            map->kind = SHADOW_SPOT;
+            map->faces = 1;
+            map->tan_half = tan(light->theta_deg * (M_PI / 180.0));
+            v3_copy(light->direction, map->forward);
+            scalar helper[3] = {0, 1, 0};
+            if (fabs(map->forward[1]) > 0.9) {
+                helper[0] = 1;
+                helper[1] = 0;
+            }
+            v3_cross(map->forward, helper, map->right);
+            normalize(map->right);
+            v3_cross(map->right, map->forward, map->up);
+        }
+        else {
+            map->kind = SHADOW_CUBE;
+            map->faces = 6;
+            map->tan_half = 1.0;
+        }
+        map->depth = mem_alloc(MEM_ACCEL, sizeof(scalar) * map->faces * res * res);
+        map->id = mem_alloc(MEM_ACCEL, sizeof(int) * map->faces * res * res);
+
+        Ray ray;
+        v3_copy(light->position, ray.origin);
+        for (int f=0; f<map->faces; f++) {
+            for (int iy=0; iy<res; iy++) {
+                for (int ix=0; ix<res; ix++) {
+                    texel_dir(map, f, ix, iy, ray.direction);
+                    int best_o;
+                    scalar best_t;
+                    get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+                    size_t texel = ((size_t)f * res + iy) * res + ix;
+                    map->depth[texel] = (best_o == -1) ? INFINITY : best_t;
+                    map->id[texel] = best_o;
+                }
+            }
+        }
+    }
+}
+
+void free_shadow_maps() {
+    if (shadow_maps == NULL)
+        return;
+    for (int l=0; l<nlights; l++) {
+        mem_free(shadow_maps[l].depth);
+        mem_free(shadow_maps[l].id);
+    }
+    mem_free(shadow_maps);
+    shadow_maps = NULL;
+}
+
+/**
+ * How much of a light reaches a point, from the light's shadow map
+ * @param light_index - index of the light in lights
+ * @param obj_index - object the point is on
+ * @param point - point being shaded
+ * @param distance_to_light - distance from the point to the light
+ * @return - fraction of the PCF samples that see the light, 0 (shadow) to 1 (lit)
+ */
+scalar shadow_map_visibility(int light_index, int obj_index, scalar *point, scalar distance_to_light) {
+    shadow_map *map = &shadow_maps[light_index];
+    scalar v[3];
+    v3_sub(point, lights[light_index].position, v);
+    int face;
+    scalar u, w;
+    if (!map_coords(map, v, &face, &u, &w))
+        return 1.0;     // outside a spotlight's cone, angular attenuation takes care of it
+
+    int res = map->res;
+    int ix = (int)floor((u + 1.0) / 2.0 * res);
+    int iy = (int)floor((w + 1.0) / 2.0 * res);
+    int lo = -(shadow_pcf / 2);
+    int hi = lo + shadow_pcf - 1;
+    // one texel covers this much at the receiver, wider kernels reach further across slopes
+    scalar texel = distance_to_light * 2.0 * map->tan_half / res;
+    scalar bias = SHADOW_BIAS_TEXELS * texel * (1 + hi);
+    int lit = 0;
+    int samples = 0;
+    for (int dy=lo; dy<=hi; dy++) {
+        for (int dx=lo; dx<=hi; dx++) {
+            int sx = ix + dx;
+            int sy = iy + dy;
+            sx = (sx < 0) ? 0 : (sx >= res) ? res - 1 : sx;
+            sy = (sy < 0) ? 0 : (sy >= res) ? res - 1 : sy;
+            size_t texel = ((size_t)face * res + sy) * res + sx;
+            if (map->id[texel] == obj_index || distance_to_light - bias <= map->depth[texel])
+                lit++;
+            samples++;
+        }
+    }
+    return (scalar)lit / samples;
+}
@@ -0,0 +1,410 @@
+/* tiles.c - multithreaded tile rendering with an autotuned tile size and order
+ *
+ * The frame is cut into square tiles, the tiles are put in the plan's order and threads take
+ * the next one off a shared atomic counter until none are left. Each tile is rendered with
+ * raycast_region into a per thread buffer and copied into the frame, so every engine works
+ * and the frame is the same as a single threaded render.
+ *
+ * The best plan depends on resolution, scene and cores. The tuner picks a sample of
+ * TUNE_WINDOW x TUNE_WINDOW windows spread over the frame, about one in TUNE_STRIDE but at
+ * least two per thread, and every candidate (four sizes times four orders) renders exactly
+ * those windows, cut into its own tiles and taken in its own order, on all the threads. Every
+ * size divides the window, so each candidate renders the same pixels, and the one with the
+ * lowest time wins. A frame too small for that sample to stay under one window in
+ * TUNE_MAX_SHARE isn't tuned, the candidates would render most of it many times over, and
+ * keeps the default plan. Plans are stored in a small text file keyed by a
+ * hash of the scene file, the frame size, thread count and engine, so the next render of the
+ * same job skips tuning.
+ *
+ * Several views of the scene go through one queue: each tile of the order is followed by the
+ * same tile of every other view, so the views' setup is shared and the threads work on the
+ * same part of the scene at the same time. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../include/tiles.h"
+#include "../include/raycaster.h"
+#include "../include/memstats.h"
+#include "../include/views.h"
+
+static const int tune_sizes[] = {8, 16, 32, 64};
+static const char *order_names[TILE_ORDERS] = {"scanline", "morton", "hilbert", "center"};
+
+/* a tile and where it comes in the order */
+typedef struct tile_t {
+    long long key;
+    int x0, y0, x1, y1;
+    int view;                   // index in the job's views
+} tile;
+
+/* what the threads share */
+typedef struct tile_job_t {
+    image *imgs;                // one frame per view
+    view *views;                // NULL for the camera at the origin
+    scalar cam_width, cam_height;
+    tile *tiles;
+    int ntiles;
+    atomic_int next;
+    atomic_llong pixels;        // rendered so far
+} tile_job;
+
+/**
+ * Turns a tile order name into one of the TILE_ constants
+ * @param str - "scanline", "morton", "hilbert" or "center"
+ * @return - the order, -1 if it's unknown
+ */
+int parse_tile_order(char *str) {
+    for (int k=0; k<TILE_ORDERS; k++) {
+        if (strcmp(str, order_names[k]) == 0)
+            return k;
+    }
+    fprintf(stderr, "Error: parse_tile_order: Unknown tile order '%s' (scanline|morton|hilbert|center)\n", str);
+    return -1;
+}
+
+const char *tile_order_name(int order) {
+    return order_names[order];
+}
+
+/* interleaves the bits of x and y */
+static long long morton_index(int x, int y) {
+    long long d = 0;
+    for (int b=0; b<16; b++)
+        d |= (long long)((x >> b) & 1) << (2*b) | (long long)((y >> b) & 1) << (2*b + 1);
+    return d;
+}
+
+/* distance along a Hilbert curve filling an n x n grid (n a power of 2) */
+static long long hilbert_index(int n, int x, int y) {
+    long long d = 0;
+    for (int s=n/2; s>0; s/=2) {
+        int rx = (x & s) > 0;
+        int ry = (y & s) > 0;
+        d += (long long)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            int t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+static int by_key(const void *a, const void *b) {
+    long long ka = ((const tile *)a)->key, kb = ((const tile *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+/**
+ * Cuts the frame into tiles and sorts them in the plan's order, each tile followed by the same
+ * tile of the other views
+ * @param width - frame width
+ * @param height - frame height
+ * @param nviews - frames the tiles are cut from
+ * @param plan - tile size and order
+ * @param ntiles - set to the number of tiles
+ * @return - the tiles, to be freed with mem_free
+ */
+static tile *make_tiles(int width, int height, int nviews, tile_plan *plan, int *ntiles) {
+    int tx = (width + plan->size - 1) / plan->size;
+    int ty = (height + plan->size - 1) / plan->size;
+    int n = 1;
+    while (n < tx || n < ty)
+        n *= 2;
+    tile *tiles = mem_alloc(MEM_SCRATCH, sizeof(tile) * tx * ty * nviews);
+    for (int j=0; j<ty; j++) {
+        for (int i=0; i<tx; i++) {
+            tile *t = &tiles[j * tx + i];
+            t->x0 = i * plan->size;
+            t->y0 = j * plan->size;
+            t->x1 = (t->x0 + plan->size < width) ? t->x0 + plan->size : width;
+            t->y1 = (t->y0 + plan->size < height) ? t->y0 + plan->size : height;
+            long long scan = (long long)j * tx + i;
+            if (plan->order == TILE_MORTON)
+                t->key = morton_index(i, j);
+            else if (plan->order == TILE_HILBERT)
+                t->key = hilbert_index(n, i, j);
+            else if (plan->order == TILE_CENTER) {
+                // twice the offset from the middle, so odd tile counts stay whole numbers
+                long long dx = 2 * i + 1 - tx, dy = 2 * j + 1 - ty;
+                t->key = (dx * dx + dy * dy) * tx * ty + scan;
+            }
+            else
+                t->key = scan;
+            t->view = 0;
+        }
+    }
+    qsort(tiles, tx * ty, sizeof(tile), by_key);
+    // spread out from the back so no tile is overwritten before it's copied
+    for (int k=tx * ty - 1; k>=0; k--) {
+        for (int v=nviews - 1; v>=0; v--) {
+            tiles[k * nviews + v] = tiles[k];
+            tiles[k * nviews + v].view = v;
+        }
+    }
+    *ntiles = tx * ty * nviews;
+    return tiles;
+}
+
+/* render thread: takes tiles off the shared counter until there are none left */
+static void *tile_worker(void *arg) {
+    tile_job *job = arg;
+    image buf = job->imgs[0];
+    buf.pixmap = NULL;
+    size_t capacity = 0;
+    long long pixels = 0;
+    while (true) {
+        int k = atomic_fetch_add(&job->next, 1);
+        if (k >= job->ntiles)
+            break;
+        tile *t = &job->tiles[k];
+        image *img = &job->imgs[t->view];
+        buf.width = t->x1 - t->x0;
+        buf.height = t->y1 - t->y0;
+        if ((size_t)buf.width * buf.height > capacity) {
+            mem_free(buf.pixmap);
+            capacity = (size_t)buf.width * buf.height;
+            buf.pixmap = mem_alloc(MEM_SCRATCH, sizeof(RGBPixel) * capacity);
+        }
+        if (job->views != NULL)
+            render_view_region(&buf, &job->views[t->view], img->width, img->height, t->x0, t->y0);
+        else
+            raycast_region(&buf, img->width, img->height, t->x0, t->y0, job->cam_width, job->cam_height, objects);
+        for (int y=0; y<buf.height; y++)
+            memcpy(&img->pixmap[(size_t)(t->y0 + y) * img->width + t->x0], &buf.pixmap[(size_t)y * buf.width],
+                   sizeof(RGBPixel) * buf.width);
+        pixels += (long long)buf.width * buf.height;
+    }
+    mem_free(buf.pixmap);
+    atomic_fetch_add(&job->pixels, pixels);
+    return NULL;
+}
+
+/**
+ * Renders the tiles of a plan on the threads
+ * @param sample - per TUNE_WINDOW window of the frame, true to render its tiles. NULL for all of them
+ * @return - the pixels rendered
+ */
+static long long run_tiles(image *imgs, view *views, int nviews, scalar cam_width, scalar cam_height,
+                           int threads, tile_plan *plan, const boolean *sample) {
+    tile_job job;
+    job.imgs = imgs;
+    job.views = views;
+    job.cam_width = cam_width;
+    job.cam_height = cam_height;
+    job.tiles = make_tiles(imgs[0].width, imgs[0].height, nviews, plan, &job.ntiles);
+    if (sample != NULL) {
+        // keeps the plan's order, only the tiles inside the sampled windows
+        int windows_x = (imgs[0].width + TUNE_WINDOW - 1) / TUNE_WINDOW;
+        int kept = 0;
+        for (int k=0; k<job.ntiles; k++) {
+            tile *t = &job.tiles[k];
+            if (sample[(t->y0 / TUNE_WINDOW) * windows_x + t->x0 / TUNE_WINDOW])
+                job.tiles[kept++] = *t;
+        }
+        job.ntiles = kept;
+    }
+    atomic_init(&job.next, 0);
+    atomic_init(&job.pixels, 0);
+
+    pthread_t pool[MAX_RENDER_THREADS];
+    for (int i=1; i<threads; i++) {
+        if (pthread_create(&pool[i], NULL, tile_worker, &job) != 0) {
+            fprintf(stderr, "Error: run_tiles: Failed to start render thread\n");
+            exit(1);
+        }
+    }
+    tile_worker(&job);  // this thread renders too
+    for (int i=1; i<threads; i++)
+        pthread_join(pool[i], NULL);
+    mem_free(job.tiles);
+    return atomic_load(&job.pixels);
+}
+
+/**
+ * Renders the whole frame in tiles on a pool of threads
+ * @param img - the frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param threads - threads to render on, including this one (1 to MAX_RENDER_THREADS)
+ * @param plan - tile size and order
+ */
+void render_tiles(image *img, scalar cam_width, scalar cam_height, int threads, tile_plan *plan) {
+    run_tiles(img, NULL, 1, cam_width, cam_height, threads, plan, NULL);
+}
+
+/**
+ * Renders several views of the scene in tiles on one pool of threads, all of them from one
+ * queue
+ * @param imgs - one frame per view, all the same size
+ * @param views - the views
+ * @param nviews - number of views
+ * @param threads - threads to render on, including this one (1 to MAX_RENDER_THREADS)
+ * @param plan - tile size and order
+ */
+void render_view_tiles(image *imgs, view *views, int nviews, int threads, tile_plan *plan) {
+    run_tiles(imgs, views, nviews, 0, 0, threads, plan, NULL);
+}
+
+/* most bytes run_tiles can allocate for one plan, see tile_render_bytes */
+static size_t plan_bytes(image *img, int nviews, scalar cam_width, scalar cam_height, int threads, int size) {
+    size_t ntiles = (size_t)((img->width + size - 1) / size) * ((img->height + size - 1) / size);
+    size_t per_thread = sizeof(RGBPixel) * size * size;
+    if (nviews == 0)
+        per_thread += region_bytes(size, size, img->width, img->height, cam_width, cam_height);
+    return sizeof(tile) * ntiles * (nviews > 0 ? nviews : 1) + per_thread * threads;
+}
+
+/**
+ * Most bytes a tiled render can allocate while it runs
+ * @param img - the frame, for its size
+ * @param nviews - views for render_view_tiles, 0 for render_tiles
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param threads - render threads
+ * @param plan - tile size and order, NULL to count autotune_tiles trying every candidate
+ */
+size_t tile_render_bytes(image *img, int nviews, scalar cam_width, scalar cam_height, int threads, tile_plan *plan) {
+    if (plan != NULL)
+        return plan_bytes(img, nviews, cam_width, cam_height, threads, plan->size);
+    size_t most = 0;
+    for (int s=0; s<(int)(sizeof(tune_sizes) / sizeof(tune_sizes[0])); s++) {
+        size_t bytes = plan_bytes(img, nviews, cam_width, cam_height, threads, tune_sizes[s]);
+        if (bytes > most)
+            most = bytes;
+    }
+    size_t nwindows = (size_t)((img->width + TUNE_WINDOW - 1) / TUNE_WINDOW) *
+                      ((img->height + TUNE_WINDOW - 1) / TUNE_WINDOW);
+    return most + sizeof(boolean) * nwindows;
+}
+
+/**
+ * Finds the fastest tile size and order for this frame by rendering the same sparse sample of
+ * windows with each candidate. The sample's pixels are left in img
+ * @param img - the frame
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ * @param threads - threads to render on
+ * @param best - set to the fastest candidate, left alone if the frame is too small to tune
+ * @return - its time per pixel in nanoseconds, -1 if the frame is too small to tune
+ */
+double autotune_tiles(image *img, scalar cam_width, scalar cam_height, int threads, tile_plan *best) {
+    int nsizes = sizeof(tune_sizes) / sizeof(tune_sizes[0]);
+    double best_ns = -1;
+
+    // windows spread evenly over the frame, enough that even the largest tiles keep every thread busy
+    int windows_x = (img->width + TUNE_WINDOW - 1) / TUNE_WINDOW;
+    int windows_y = (img->height + TUNE_WINDOW - 1) / TUNE_WINDOW;
+    int nwindows = windows_x * windows_y;
+    if (2 * threads > nwindows / TUNE_MAX_SHARE)
+        return -1;
+    int nsample = nwindows / TUNE_STRIDE;
+    if (nsample < 2 * threads)
+        nsample = 2 * threads;
+    boolean *sample = mem_calloc(MEM_SCRATCH, nwindows, sizeof(boolean));
+    for (int k=0; k<nsample; k++)
+        sample[(int)(((long long)2 * k + 1) * nwindows / (2 * nsample))] = true;
+
+    // the first candidate is run once more up front, so none of them pays for cold caches
+    tile_plan warm = {tune_sizes[0], TILE_SCANLINE};
+    run_tiles(img, NULL, 1, cam_width, cam_height, threads, &warm, sample);
+    for (int s=0; s<nsizes; s++) {
+        for (int order=0; order<TILE_ORDERS; order++) {
+            tile_plan plan = {tune_sizes[s], order};
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            long long pixels = run_tiles(img, NULL, 1, cam_width, cam_height, threads, &plan, sample);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (double)pixels;
+            if (best_ns < 0 || ns < best_ns) {
+                best_ns = ns;
+                *best = plan;
+            }
+        }
+    }
+    mem_free(sample);
+    return best_ns;
+}
+
+/* FNV-1a over the scene file's bytes, 0 if it can't be read */
+uint64_t hash_scene_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return 0;
+    uint64_t h = 14695981039346656037ULL;
+    int c;
+    while ((c = getc(f)) != EOF) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ULL;
+    }
+    fclose(f);
+    return h;
+}
+
+/**
+ * Looks up the plan tuned for a job
+ * @param cache_path - file of tuned plans
+ * @param key - the job
+ * @param plan - set to the stored plan when there is one
+ * @return - 0 if a plan was found, -1 if not
+ */
+int load_tile_plan(const char *cache_path, tune_key *key, tile_plan *plan) {
+    FILE *f = fopen(cache_path, "r");
+    if (f == NULL)
+        return -1;
+    char line[MAX_SIZE];
+    int found = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long long h;
+        int w, ht, n, engine, res, pcf, fast, size;
+        double lod;
+        char order[32];
+        if (sscanf(line, "%llx %d %d %d %d %d %d %d %lf %d %31s", &h, &w, &ht, &n, &engine, &res, &pcf, &fast,
+                   &lod, &size, order) != 11)
+            continue;
+        if (h != key->scene || w != key->width || ht != key->height || n != key->threads ||
+            engine != key->engine || res != key->shadow_res || pcf != key->pcf || fast != key->fast_math ||
+            lod != key->lod_radius)
+            continue;
+        for (int k=0; k<TILE_ORDERS; k++) {
+            if (strcmp(order, order_names[k]) == 0 && size > 0) {
+                plan->size = size;
+                plan->order = k;
+                found = 0;  // later lines win, a re-tuned job is appended
+            }
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/**
+ * Stores the plan tuned for a job
+ * @param cache_path - file of tuned plans, created if needed
+ * @param key - the job
+ * @param plan - the tuned plan
+ * @return - 0 on success, -1 on error
+ */
+int save_tile_plan(const char *cache_path, tune_key *key, tile_plan *plan) {
+    FILE *f = fopen(cache_path, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Error: save_tile_plan: Failed to open '%s'\n", cache_path);
+        return -1;
+    }
+    // lod radius is written exactly so it reads back equal
+    fprintf(f, "%016llx %d %d %d %d %d %d %d %.17g %d %s\n", (unsigned long long)key->scene, key->width,
+            key->height, key->threads, key->engine, key->shadow_res, key->pcf, key->fast_math, key->lod_radius,
+            plan->size, order_names[plan->order]);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: save_tile_plan: Failed to write '%s'\n", cache_path);
+        return -1;
+    }
+    return 0;
+}
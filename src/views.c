@@ -0,0 +1,147 @@
+/* views.c - renders the scene from every camera in it
+ *
+ * A camera may give a "position", a "direction" to look in and an "up" vector. Each one is
+ * turned into a view: an origin and a unit basis that takes the usual camera space rays (from
+ * the origin towards the view plane at z = 1) into the scene. The views share everything that
+ * was built from the scene, and their tiles go through one queue on one pool of threads (see
+ * render_view_tiles in tiles.c). Rays start away from the origin, so views are traced like the
+ * scalar engine does, through the compiled primitive buckets. A camera with no pose gets an
+ * identity basis and renders exactly what a single view render of the scene gives. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/views.h"
+#include "../include/vector_math.h"
+#include "../include/writer.h"
+
+/* true if a camera has a position or orientation, which only view renders honor */
+boolean camera_is_posed(object *camera) {
+    return camera->camera.position != NULL || camera->camera.direction != NULL || camera->camera.up != NULL;
+}
+
+/**
+ * Builds the view of a camera object
+ * @param obj - the camera
+ * @param index - its index in objects
+ * @param v - output view
+ * @return - 0 on success, -1 if its direction is zero or parallel to its up vector
+ */
+static int make_view(object *obj, int index, view *v) {
+    Camera *c = &obj->camera;
+    v->camera = index;
+    v->cam_width = c->width;
+    v->cam_height = c->height;
+    v3_zero(v->origin);
+    v3_zero(v->right);
+    v3_zero(v->up);
+    v3_zero(v->forward);
+    v->right[0] = 1;
+    v->up[1] = 1;
+    v->forward[2] = 1;
+    if (c->position != NULL)
+        v3_copy(c->position, v->origin);
+    if (c->direction == NULL && c->up == NULL)
+        return 0;   // keeps the identity basis exact
+
+    scalar up[3];
+    if (c->direction != NULL)
+        v3_copy(c->direction, v->forward);
+    if (c->up != NULL)
+        v3_copy(c->up, up);
+    else
+        v3_copy(v->up, up);
+    if (v3_len(v->forward) == 0) {
+        fprintf(stderr, "Error: make_view: Camera %d has a zero direction\n", index);
+        return -1;
+    }
+    normalize(v->forward);
+    // right = up x forward, then up = forward x right, so +x stays to the right of +z like it is at the origin
+    v3_cross(up, v->forward, v->right);
+    if (v3_len(v->right) < 1e-6 * v3_len(up)) {
+        fprintf(stderr, "Error: make_view: Camera %d has an up vector parallel to its direction\n", index);
+        return -1;
+    }
+    normalize(v->right);
+    v3_cross(v->forward, v->right, v->up);
+    return 0;
+}
+
+/**
+ * Makes a view of every camera in the scene, in file order
+ * @param views - output views
+ * @param max_views - room in views
+ * @return - number of views, -1 on error
+ */
+int find_views(view *views, int max_views) {
+    int n = 0;
+    for (int i=0; objects[i].type != 0; i++) {
+        if (objects[i].type != CAMERA)
+            continue;
+        if (n == max_views) {
+            fprintf(stderr, "Error: find_views: More than %d cameras\n", max_views);
+            return -1;
+        }
+        if (make_view(&objects[i], i, &views[n]) < 0)
+            return -1;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * The primary ray of a view through the center of a pixel
+ * @param v - the view
+ * @param row - row of the full frame
+ * @param col - column of the full frame
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param ray - output ray, direction normalized
+ */
+void view_ray(view *v, int row, int col, int full_width, int full_height, Ray *ray) {
+    scalar d[3];
+    get_primary_ray_dir(row, col, full_width, full_height, v->cam_width, v->cam_height, d);
+    v3_copy(v->origin, ray->origin);
+    for (int k=0; k<3; k++)
+        ray->direction[k] = d[0]*v->right[k] + d[1]*v->up[k] + d[2]*v->forward[k];
+}
+
+/**
+ * Renders a region of one view, like raycast_region does for the camera at the origin
+ * @param img - image data for just the region
+ * @param v - the view
+ * @param full_width - width of the full frame
+ * @param full_height - height of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ */
+void render_view_region(image *img, view *v, int full_width, int full_height, int x0, int y0) {
+    Ray ray;
+    for (int i=0; i<img->height; i++) {
+        for (int j=0; j<img->width; j++) {
+            view_ray(v, y0 + i, x0 + j, full_width, full_height, &ray);
+            scalar color[3] = {0, 0, 0};
+            int best_o;
+            scalar best_t;
+            get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+            if (best_t > 0 && best_t != INFINITY && best_o != -1) {
+                shade(&ray, best_o, best_t, color);
+                set_pixel_color(color, i, j, img);
+            }
+            else {
+                set_pixel_color(background_color, i, j, img);
+            }
+        }
+    }
+}
+
+/**
+ * Writes every view to its own file: out.ppm gives out.view0.ppm, out.view1.ppm and so on
+ * @param imgs - one frame per view
+ * @param nviews - number of views
+ * @param out_path - output file name the view files are named after
+ * @param format - FORMAT_ constant
+ * @return - 0 on success, -1 on error
+ */
+int write_views(image *imgs, int nviews, const char *out_path, int format) {
+    return write_numbered(imgs, nviews, out_path, "view", 0, format);
+}
@@ -0,0 +1,287 @@
+/* watch.c - re-renders the scene whenever its file changes, redoing only what the edit touched
+ *
+ * The file is polled for a new modification time. A changed file is read into memory once and
+ * first parsed in a forked child, so a half-saved or broken file only prints its error and
+ * leaves the current scene up. The same bytes are then parsed again and compared with the
+ * previous parse (scene_diff.c), which gives the bounding spheres every changed object had
+ * before and after the edit. A write that lands in between is picked up on the next poll.
+ *
+ * A pixel can only come out different if its primary ray passes through one of those bounds,
+ * or if it sees a point whose shadow ray to some light does. The depth of every pixel from the
+ * last render is kept so that point is known without tracing. Screen tiles holding such a pixel
+ * are rendered again with raycast_region, everything else is kept, so the frame matches a full
+ * render exactly. Anything that can reach every pixel (the camera, lights, planes, shadow maps)
+ * re-renders the whole frame. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../include/watch.h"
+#include "../include/scene_diff.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/shadowmap.h"
+#include "../include/writer.h"
+#include "../include/memstats.h"
+
+/* what identifies a version of the scene file */
+typedef struct file_stamp_t {
+    struct timespec mtime;
+    off_t size;
+    ino_t inode;    // editors often save by renaming a new file over the old one
+} file_stamp;
+
+static boolean get_stamp(const char *path, file_stamp *stamp) {
+    struct stat st;
+    if (stat(path, &st) < 0)
+        return false;
+    stamp->mtime = st.st_mtim;
+    stamp->size = st.st_size;
+    stamp->inode = st.st_ino;
+    return true;
+}
+
+static boolean same_stamp(file_stamp *a, file_stamp *b) {
+    return a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+           a->size == b->size && a->inode == b->inode;
+}
+
+/**
+ * Tests whether a pixel can come out different after the edit
+ * @param dir - direction of the pixel's primary ray (from the origin)
+ * @param depth - distance to what the pixel showed, INFINITY for the background
+ * @param diff - what the edit changed
+ * @return - true if the pixel has to be rendered again
+ */
+static boolean pixel_dirty(scalar *dir, scalar depth, scene_diff *diff) {
+    scalar origin[3] = {0, 0, 0};
+    if (ray_hits_changed(origin, dir, INFINITY, diff))
+        return true;
+    if (depth == INFINITY)
+        return false;
+    // no changed bound is on the primary ray, so the point it shows is still there
+    scalar point[3];
+    v3_scale(dir, depth, point);
+    for (int l=0; l<nlights; l++) {
+        scalar to_light[3];
+        v3_sub(lights[l].position, point, to_light);
+        scalar len = v3_len(to_light);
+        normalize(to_light);
+        if (ray_hits_changed(point, to_light, len, diff))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Finds the distance to the closest object for every pixel of a tile
+ * @param depth - per pixel depth of the full frame, INFINITY for the background
+ * @param img - the full frame
+ * @param x0, y0, x1, y1 - tile of the frame (x1 and y1 are exclusive)
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+static void trace_depth(scalar *depth, image *img, int x0, int y0, int x1, int y1,
+                        scalar cam_width, scalar cam_height) {
+    Ray ray = {.origin = {0, 0, 0}};
+    for (int y=y0; y<y1; y++) {
+        for (int x=x0; x<x1; x++) {
+            get_primary_ray_dir(y, x, img->width, img->height, cam_width, cam_height, ray.direction);
+            int best_o;
+            scalar best_t;
+            get_dist_and_idx_closest_obj(&ray, -1, INFINITY, &best_o, &best_t);
+            depth[(size_t)y * img->width + x] = (best_o == -1) ? INFINITY : best_t;
+        }
+    }
+}
+
+/* renders one tile of the frame in place */
+static void render_tile(image *img, int x0, int y0, int x1, int y1, scalar cam_width, scalar cam_height) {
+    image tile;
+    tile.width = x1 - x0;
+    tile.height = y1 - y0;
+    tile.max_color_val = img->max_color_val;
+    tile.pixmap = mem_alloc(MEM_FRAMEBUFFER, sizeof(RGBPixel) * tile.width * tile.height);
+    raycast_region(&tile, img->width, img->height, x0, y0, cam_width, cam_height, objects);
+    for (int y=0; y<tile.height; y++)
+        memcpy(&img->pixmap[(size_t)(y0 + y) * img->width + x0], &tile.pixmap[(size_t)y * tile.width],
+               sizeof(RGBPixel) * tile.width);
+    mem_free(tile.pixmap);
+}
+
+/**
+ * Reads the whole scene file into memory, so the check and the real parse see the same bytes
+ * even if the file is written again in between
+ * @param path - scene file name
+ * @param length - set to the number of bytes read
+ * @return - the file's contents, to be freed with mem_free. NULL if it can't be read
+ */
+static char *read_scene_file(const char *path, size_t *length) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: read_scene_file: Failed to open input file '%s'\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: read_scene_file: '%s' is empty\n", path);
+        fclose(f);
+        return NULL;
+    }
+    char *data = mem_alloc(MEM_IO, st.st_size);
+    *length = fread(data, 1, st.st_size, f);    // less if the file was cut short since the stat
+    fclose(f);
+    return data;
+}
+
+/**
+ * Parses the scene in a child process first, so a broken file can't take the watcher down
+ * @param data - the scene file's contents
+ * @param length - their size in bytes
+ * @return - true if the file parses and has a camera
+ */
+static boolean scene_parses(const char *data, size_t length) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Error: scene_parses: fork");
+        return false;
+    }
+    if (pid == 0) {
+        FILE *json = fmemopen((void*)data, length, "r");
+        if (json == NULL) {
+            fprintf(stderr, "Error: scene_parses: Failed to read the scene\n");
+            _exit(1);
+        }
+        init_lights();
+        init_objects();
+        read_json(json);
+        if (get_camera(objects) == -1) {
+            fprintf(stderr, "Error: scene_parses: No camera object found in data\n");
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void write_frame(const char *out_path, int format, image *img) {
+    band_writer writer;
+    if (open_writer(&writer, out_path, format, img) < 0)
+        exit(1);
+    write_band(&writer, 0, img->height);
+    if (close_writer(&writer) < 0)
+        exit(1);
+}
+
+/**
+ * Watches the scene file and keeps the output file up to date until the process is stopped.
+ * The scene must already be parsed with read_json and img rendered from it
+ * @param scene_path - scene file name
+ * @param out_path - output file name
+ * @param format - output encoding
+ * @param img - the frame rendered from the current scene
+ * @param shadow_res - shadow map resolution, 0 for ray traced shadows
+ * @param pcf - shadow map PCF kernel width
+ */
+void watch_scene(const char *scene_path, const char *out_path, int format, image *img,
+                 int shadow_res, int pcf) {
+    int cam = get_camera(objects);
+    scalar cam_width = objects[cam].camera.width;
+    scalar cam_height = objects[cam].camera.height;
+
+    scalar *depth = mem_alloc(MEM_ACCEL, sizeof(scalar) * img->width * img->height);
+    int tiles_x = (img->width + WATCH_TILE - 1) / WATCH_TILE;
+    int tiles_y = (img->height + WATCH_TILE - 1) / WATCH_TILE;
+    scene_snapshot *old = mem_alloc(MEM_SCENE, sizeof(scene_snapshot));
+    scene_snapshot *cur = mem_alloc(MEM_SCENE, sizeof(scene_snapshot));
+    scene_diff *diff = mem_alloc(MEM_SCENE, sizeof(scene_diff));
+    trace_depth(depth, img, 0, 0, img->width, img->height, cam_width, cam_height);
+
+    file_stamp stamp;
+    if (!get_stamp(scene_path, &stamp)) {
+        fprintf(stderr, "Error: watch_scene: Can't stat '%s'\n", scene_path);
+        exit(1);
+    }
+    printf("watching %s, press Ctrl-C to stop\n", scene_path);
+    fflush(stdout);
+
+    struct timespec poll = {WATCH_POLL_MS / 1000, (WATCH_POLL_MS % 1000) * 1000000L};
+    while (true) {
+        nanosleep(&poll, NULL);
+        file_stamp now;
+        if (!get_stamp(scene_path, &now) || same_stamp(&now, &stamp))
+            continue;   // unchanged, or in the middle of being replaced
+        stamp = now;
+        size_t length = 0;
+        char *data = read_scene_file(scene_path, &length);
+        if (data == NULL || length == 0 || !scene_parses(data, length)) {
+            fprintf(stderr, "Error: watch_scene: Keeping the previous scene until '%s' is fixed\n", scene_path);
+            mem_free(data);
+            continue;
+        }
+
+        // parse the same bytes again for real, keeping the old scene around to compare against
+        FILE *json = fmemopen(data, length, "r");
+        if (json == NULL) {
+            fprintf(stderr, "Error: watch_scene: Failed to read the scene\n");
+            exit(1);
+        }
+        reparse_scene(json, old, cur);
+        mem_free(data);
+        cam = get_camera(objects);
+        cam_width = objects[cam].camera.width;
+        cam_height = objects[cam].camera.height;
+
+        diff_scenes(old, cur, diff);
+        boolean full = diff->everything || diff->light_count_changed || diff->nchanged_lights > 0;
+        if (shadow_res > 0) {
+            build_shadow_maps(shadow_res, pcf);
+            full = true;    // any object can change any texel of the maps
+        }
+
+        int dirty = 0;
+        if (full) {
+            raycast_scene(img, cam_width, cam_height, objects);
+            trace_depth(depth, img, 0, 0, img->width, img->height, cam_width, cam_height);
+            dirty = tiles_x * tiles_y;
+        }
+        else if (diff->nbounds > 0) {
+            for (int ty=0; ty<tiles_y; ty++) {
+                for (int tx=0; tx<tiles_x; tx++) {
+                    int x0 = tx * WATCH_TILE, y0 = ty * WATCH_TILE;
+                    int x1 = (x0 + WATCH_TILE < img->width) ? x0 + WATCH_TILE : img->width;
+                    int y1 = (y0 + WATCH_TILE < img->height) ? y0 + WATCH_TILE : img->height;
+                    boolean tile_dirty = false;
+                    for (int y=y0; y<y1 && !tile_dirty; y++) {
+                        for (int x=x0; x<x1 && !tile_dirty; x++) {
+                            scalar dir[3];
+                            get_primary_ray_dir(y, x, img->width, img->height, cam_width, cam_height, dir);
+                            tile_dirty = pixel_dirty(dir, depth[(size_t)y * img->width + x], diff);
+                        }
+                    }
+                    if (!tile_dirty)
+                        continue;
+                    render_tile(img, x0, y0, x1, y1, cam_width, cam_height);
+                    trace_depth(depth, img, x0, y0, x1, y1, cam_width, cam_height);
+                    dirty++;
+                }
+            }
+        }
+        free_snapshot(old);
+
+        write_frame(out_path, format, img);
+        printf("reloaded %s: %s, re-rendered %d of %d tiles\n", scene_path,
+               full ? "full frame" : (diff->nbounds > 0 ? "changed objects" : "no visible change"),
+               dirty, tiles_x * tiles_y);
+        fflush(stdout);
+    }
+}
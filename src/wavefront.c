@@ -0,0 +1,288 @@
+/* wavefront.c - queue based renderer
+ *
+ * Instead of following one pixel through primary intersection and every shadow ray, a tile
+ * is pushed through the pipeline one stage at a time: generate all primary rays into a
+ * structure of arrays buffer, intersect them in bulk object by object, compact the hits and
+ * sort them by object, then emit one batch of shadow rays per light and test it in bulk.
+ * Intersection and shading arithmetic is the same as the scalar path so pixels match it. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../include/wavefront.h"
+#include "../include/raycaster.h"
+#include "../include/vector_math.h"
+#include "../include/json.h"
+#include "../include/shadowmap.h"
+#include "../include/memstats.h"
+
+/* allocates room for n rays in every array of the batch */
+static void alloc_batch(ray_batch *b, int n) {
+    b->count = 0;
+    b->ox = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->oy = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->oz = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->dx = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->dy = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->dz = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->max_t = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->t = mem_alloc(MEM_SCRATCH, sizeof(scalar) * n);
+    b->obj = mem_alloc(MEM_SCRATCH, sizeof(int) * n);
+    b->pixel = mem_alloc(MEM_SCRATCH, sizeof(int) * n);
+}
+
+static void free_batch(ray_batch *b) {
+    mem_free(b->ox);
+    mem_free(b->oy);
+    mem_free(b->oz);
+    mem_free(b->dx);
+    mem_free(b->dy);
+    mem_free(b->dz);
+    mem_free(b->max_t);
+    mem_free(b->t);
+    mem_free(b->obj);
+    mem_free(b->pixel);
+}
+
+/* sphere_intersect on ray k of a batch */
+static inline scalar batch_sphere_intersect(ray_batch *b, int k, scalar *C, scalar r) {
+    scalar v0 = b->ox[k] - C[0];
+    scalar v1 = b->oy[k] - C[1];
+    scalar v2 = b->oz[k] - C[2];
+    scalar bq = 2 * (b->dx[k]*v0 + b->dy[k]*v1 + b->dz[k]*v2);
+    scalar c = sqr(v0) + sqr(v1) + sqr(v2) - sqr(r);
+    scalar disc = sqr(bq) - 4*c;
+    if (disc < 0)
+        return -1;
+    disc = sqrt(disc);
+    scalar t = (-bq - disc) / 2.0;
+    if (t < 0.0)
+        t = (-bq + disc) / 2.0;
+    if (t < 0.0)
+        return -1;
+    return t;
+}
+
+/* plane_intersect on ray k of a batch */
+static inline scalar batch_plane_intersect(ray_batch *b, int k, scalar *Pos, scalar *Norm) {
+    scalar vd = Norm[0]*b->dx[k] + Norm[1]*b->dy[k] + Norm[2]*b->dz[k];
+    if (fabs(vd) < 0.0001)
+        return -1;
+    scalar t = ((Pos[0] - b->ox[k])*Norm[0] + (Pos[1] - b->oy[k])*Norm[1] + (Pos[2] - b->oz[k])*Norm[2]) / vd;
+    if (t < 0.0)
+        return -1;
+    return t;
+}
+
+/**
+ * Finds the closest hit of every ray in the batch. Loops over objects on the outside so each
+ * object's data stays hot while the whole batch is tested against it
+ * @param b - batch of rays, t and obj are filled in
+ */
+static void intersect_closest(ray_batch *b) {
+    for (int k=0; k<b->count; k++) {
+        b->t[k] = INFINITY;
+        b->obj[k] = -1;
+    }
+    for (int i=0; objects[i].type != 0; i++) {
+        if (objects[i].type == SPHERE) {
+            scalar *C = objects[i].sphere.position;
+            scalar r = objects[i].sphere.radius;
+            for (int k=0; k<b->count; k++) {
+                scalar t = batch_sphere_intersect(b, k, C, r);
+                if (t > 0 && t < b->t[k]) {
+                    b->t[k] = t;
+                    b->obj[k] = i;
+                }
+            }
+        }
+        else if (objects[i].type == PLANE) {
+            scalar *Pos = objects[i].plane.position;
+            scalar *Norm = objects[i].plane.normal;
+            for (int k=0; k<b->count; k++) {
+                scalar t = batch_plane_intersect(b, k, Pos, Norm);
+                if (t > 0 && t < b->t[k]) {
+                    b->t[k] = t;
+                    b->obj[k] = i;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Shadow test for a batch of rays. A ray is occluded if any object other than the one it
+ * leaves is hit closer than max_t. Rays drop out of the loop as soon as they are occluded
+ * @param b - batch of shadow rays. obj holds the object each ray starts on
+ * @param occluded - set to true for each occluded ray
+ */
+static void intersect_any(ray_batch *b, char *occluded) {
+    if (b->count > 0)
+        memset(occluded, 0, (size_t)b->count);
+    for (int i=0; objects[i].type != 0; i++) {
+        if (objects[i].type != SPHERE && objects[i].type != PLANE)
+            continue;
+        for (int k=0; k<b->count; k++) {
+            if (occluded[k] || b->obj[k] == i)
+                continue;
+            scalar t;
+            if (objects[i].type == SPHERE)
+                t = batch_sphere_intersect(b, k, objects[i].sphere.position, objects[i].sphere.radius);
+            else
+                t = batch_plane_intersect(b, k, objects[i].plane.position, objects[i].plane.normal);
+            if (t > b->max_t[k])
+                continue;
+            if (t > 0)
+                occluded[k] = true;
+        }
+    }
+}
+
+/* bytes wavefront_region allocates, the same for any region */
+size_t wavefront_region_bytes() {
+    size_t tile_size = WAVEFRONT_TILE * WAVEFRONT_TILE;
+    size_t batch = (sizeof(scalar) * 8 + sizeof(int) * 2) * tile_size;
+    return 2 * batch + (sizeof(int) + sizeof(scalar) * 6 + 1) * tile_size;
+}
+
+/**
+ * Renders a region of the frame with the wavefront pipeline, one tile at a time.
+ * Same arguments and results as raycast_region
+ * @param img - image data for just the region
+ * @param full_width - width in pixels of the full frame
+ * @param full_height - height in pixels of the full frame
+ * @param x0 - column of the full frame where the region starts
+ * @param y0 - row of the full frame where the region starts
+ * @param cam_width - camera width
+ * @param cam_height - camera height
+ */
+void wavefront_region(image *img, int full_width, int full_height, int x0, int y0,
+                      scalar cam_width, scalar cam_height) {
+    int tile_size = WAVEFRONT_TILE * WAVEFRONT_TILE;
+    ray_batch primary;
+    ray_batch shadow;
+    alloc_batch(&primary, tile_size);
+    alloc_batch(&shadow, tile_size);
+    int *order = mem_alloc(MEM_SCRATCH, sizeof(int) * tile_size);          // hits sorted by object
+    scalar *hx = mem_alloc(MEM_SCRATCH, sizeof(scalar) * tile_size * 3);   // hit points, sorted like order
+    scalar *colors = mem_alloc(MEM_SCRATCH, sizeof(scalar) * tile_size * 3);
+    char *occluded = mem_alloc(MEM_SCRATCH, tile_size);
+
+    for (int ty = 0; ty < img->height; ty += WAVEFRONT_TILE) {
+        for (int tx = 0; tx < img->width; tx += WAVEFRONT_TILE) {
+            int th = (ty + WAVEFRONT_TILE > img->height) ? img->height - ty : WAVEFRONT_TILE;
+            int tw = (tx + WAVEFRONT_TILE > img->width) ? img->width - tx : WAVEFRONT_TILE;
+
+            // stage 1: generate primary rays for the tile
+            primary.count = 0;
+            for (int i = 0; i < th; i++) {
+                for (int j = 0; j < tw; j++) {
+                    int k = primary.count++;
+                    scalar dir[3];
+                    get_primary_ray_dir(y0 + ty + i, x0 + tx + j, full_width, full_height,
+                                        cam_width, cam_height, dir);
+                    primary.ox[k] = 0;
+                    primary.oy[k] = 0;
+                    primary.oz[k] = 0;
+                    primary.dx[k] = dir[0];
+                    primary.dy[k] = dir[1];
+                    primary.dz[k] = dir[2];
+                    primary.max_t[k] = INFINITY;
+                    primary.pixel[k] = i * WAVEFRONT_TILE + j;
+                }
+            }
+
+            // stage 2: bulk primary intersection
+            intersect_closest(&primary);
+
+            // stage 3: compact the hits and sort them by object (counting sort)
+            int counts[MAX_OBJECTS + 1];
+            memset(counts, 0, sizeof(counts));
+            for (int k = 0; k < primary.count; k++) {
+                if (primary.obj[k] != -1)
+                    counts[primary.obj[k] + 1]++;
+                else
+                    set_pixel_color(background_color, ty + primary.pixel[k] / WAVEFRONT_TILE,
+                                    tx + primary.pixel[k] % WAVEFRONT_TILE, img);
+            }
+            for (int o = 1; o <= MAX_OBJECTS; o++)
+                counts[o] += counts[o - 1];
+            int nhits = counts[MAX_OBJECTS];
+            for (int k = 0; k < primary.count; k++) {
+                if (primary.obj[k] != -1)
+                    order[counts[primary.obj[k]]++] = k;
+            }
+            for (int m = 0; m < nhits; m++) {
+                int k = order[m];
+                scalar p[3] = {primary.dx[k], primary.dy[k], primary.dz[k]};
+                scalar o[3] = {primary.ox[k], primary.oy[k], primary.oz[k]};
+                v3_scale(p, primary.t[k], p);
+                v3_add(p, o, &hx[3*m]);
+                v3_zero(&colors[3*m]);
+            }
+
+            // stage 4: one batch of shadow rays per light, tested in bulk, then shaded
+            for (int r = 0; r < nlight_runs; r++) {
+                light_kernel kernel = light_runs[r].shade;
+                for (int l = light_runs[r].first; l < light_runs[r].end; l++) {
+                    shadow.count = nhits;
+                    for (int m = 0; m < nhits; m++) {
+                        scalar dir[3];
+                        v3_sub(lights[l].position, &hx[3*m], dir);
+                        // t keeps the distance to the light for shading, max_t is for the test
+                        Ray test = {.origin = {hx[3*m], hx[3*m + 1], hx[3*m + 2]}};
+                        shadow.t[m] = v3_len(dir);
+                        shadow.max_t[m] = shadow.t[m];
+                        normalize(dir);
+                        v3_copy(dir, test.direction);
+                        offset_shadow_ray(&test, primary.t[order[m]], &shadow.max_t[m]);
+                        shadow.ox[m] = test.origin[0];
+                        shadow.oy[m] = test.origin[1];
+                        shadow.oz[m] = test.origin[2];
+                        shadow.dx[m] = dir[0];
+                        shadow.dy[m] = dir[1];
+                        shadow.dz[m] = dir[2];
+                        shadow.obj[m] = primary.obj[order[m]];
+                        shadow.pixel[m] = m;
+                    }
+                    if (shadow_maps == NULL)
+                        intersect_any(&shadow, occluded);
+                    for (int m = 0; m < nhits; m++) {
+                        scalar visibility;
+                        if (shadow_maps != NULL)
+                            visibility = shadow_map_visibility(l, shadow.obj[m], &hx[3*m], shadow.t[m]);
+                        else
+                            visibility = occluded[m] ? 0 : 1;
+                        if (visibility <= 0)
+                            continue;   // it's shadow
+                        int k = order[m];
+                        Ray ray = {
+                                .origin = {primary.ox[k], primary.oy[k], primary.oz[k]},
+                                .direction = {primary.dx[k], primary.dy[k], primary.dz[k]}
+                        };
+                        Ray ray_new = {
+                                .origin = {hx[3*m], hx[3*m + 1], hx[3*m + 2]},
+                                .direction = {shadow.dx[m], shadow.dy[m], shadow.dz[m]}
+                        };
+                        kernel(&ray, &objects[primary.obj[k]], &ray_new, shadow.t[m], &lights[l],
+                               visibility, &colors[3*m]);
+                    }
+                }
+            }
+
+            // stage 5: write the shaded hits
+            for (int m = 0; m < nhits; m++) {
+                int k = order[m];
+                set_pixel_color(&colors[3*m], ty + primary.pixel[k] / WAVEFRONT_TILE,
+                                tx + primary.pixel[k] % WAVEFRONT_TILE, img);
+            }
+        }
+    }
+
+    free_batch(&primary);
+    free_batch(&shadow);
+    mem_free(order);
+    mem_free(hx);
+    mem_free(colors);
+    mem_free(occluded);
+}
@@ -0,0 +1,220 @@
+/* writer.c - encodes and writes an image band by band
+ *
+ * The renderer pushes finished row bands into a bounded lock-free queue and a dedicated
+ * writer thread pops them, encodes them and writes them while rendering carries on. The
+ * queue has exactly one producer and one consumer, so head and tail only ever move forward
+ * and each side only writes its own index. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "../include/writer.h"
+#include "../include/memstats.h"
+
+/**
+ * Turns an output format name into one of the FORMAT_ constants
+ * @param str - "p6", "p3" or "p6gz"
+ * @return - the format, -1 if it's unknown or not built in
+ */
+int parse_format(char *str) {
+    if (strcmp(str, "p6") == 0)
+        return FORMAT_P6;
+    if (strcmp(str, "p3") == 0)
+        return FORMAT_P3;
+    if (strcmp(str, "p6gz") == 0) {
+#ifdef HAVE_ZLIB
+        return FORMAT_P6_GZ;
+#else
+        fprintf(stderr, "Error: parse_format: p6gz needs a build with zlib\n");
+        return -1;
+#endif
+    }
+    fprintf(stderr, "Error: parse_format: Unknown output format '%s' (p6|p3|p6gz)\n", str);
+    return -1;
+}
+
+/**
+ * Opens the output file and writes the header
+ * @param w - writer to set up
+ * @param path - output file name
+ * @param format - FORMAT_P6, FORMAT_P3 or FORMAT_P6_GZ
+ * @param img - image being rendered. Only rows handed to write_band are read
+ * @return 0 on success, -1 on error
+ */
+int open_writer(band_writer *w, const char *path, int format, image *img) {
+    memset(w, 0, sizeof(band_writer));
+    w->format = format;
+    w->img = img;
+    w->row_buf = mem_alloc(MEM_IO, 3 * (size_t)img->width);
+    atomic_init(&w->head, 0);
+    atomic_init(&w->tail, 0);
+
+    int type = (format == FORMAT_P3) ? 3 : 6;
+    char hdr[64];
+    int hdr_len = snprintf(hdr, sizeof(hdr), "P%d\n%d %d\n%d\n", type, img->width, img->height, 255);
+#ifdef HAVE_ZLIB
+    if (format == FORMAT_P6_GZ) {
+        w->gz = gzopen(path, "wb");
+        if (w->gz == NULL || gzwrite(w->gz, hdr, hdr_len) != hdr_len) {
+            fprintf(stderr, "Error: open_writer: Failed to create output file '%s'\n", path);
+            return -1;
+        }
+        return 0;
+    }
+#endif
+    w->fh = fopen(path, "wb");
+    if (w->fh == NULL || fwrite(hdr, 1, hdr_len, w->fh) != (size_t)hdr_len) {
+        fprintf(stderr, "Error: open_writer: Failed to create output file '%s'\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Encodes rows [y0, y1) of the image and writes them out
+ * @param w - open writer
+ * @param y0 - first row
+ * @param y1 - one past the last row
+ */
+void write_band(band_writer *w, int y0, int y1) {
+    image *img = w->img;
+    for (int i=y0; i<y1; i++) {
+        RGBPixel *row = &img->pixmap[(size_t)i * img->width];
+        if (w->format == FORMAT_P3) {
+            for (int j=0; j<img->width; j++) {
+                if (fprintf(w->fh, "%d %d %d\n", row[j].r, row[j].g, row[j].b) < 0)
+                    w->error = true;
+            }
+            continue;
+        }
+        for (int j=0; j<img->width; j++) {
+            w->row_buf[3*j] = row[j].r;
+            w->row_buf[3*j + 1] = row[j].g;
+            w->row_buf[3*j + 2] = row[j].b;
+        }
+        size_t len = 3 * (size_t)img->width;
+#ifdef HAVE_ZLIB
+        if (w->format == FORMAT_P6_GZ) {
+            if (gzwrite(w->gz, w->row_buf, len) != (int)len)
+                w->error = true;
+            continue;
+        }
+#endif
+        if (fwrite(w->row_buf, 1, len, w->fh) != len)
+            w->error = true;
+    }
+}
+
+/**
+ * Flushes and closes the output file
+ * @param w - open writer
+ * @return 0 on success, -1 if anything failed to write
+ */
+int close_writer(band_writer *w) {
+#ifdef HAVE_ZLIB
+    if (w->format == FORMAT_P6_GZ) {
+        if (gzclose(w->gz) != Z_OK)
+            w->error = true;
+    }
+    else
+#endif
+    if (fclose(w->fh) != 0) {
+        w->error = true;
+    }
+    mem_free(w->row_buf);
+    if (w->error) {
+        fprintf(stderr, "Error: close_writer: Problem writing image data\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Writes images to files named after out_path with a numbered suffix before its extension:
+ * out.ppm with suffix "mip" and first 1 gives out.mip1.ppm, out.mip2.ppm and so on
+ * @param imgs - the images
+ * @param count - number of images
+ * @param out_path - file name the others are named after
+ * @param suffix - goes between the stem and the number
+ * @param first - number of the first image
+ * @param format - output encoding
+ * @return - 0 on success, -1 on error
+ */
+int write_numbered(image *imgs, int count, const char *out_path, const char *suffix, int first, int format) {
+    const char *slash = strrchr(out_path, '/');
+    const char *dot = strrchr(out_path, '.');
+    int stem = (dot != NULL && (slash == NULL || dot > slash)) ? (int)(dot - out_path) : (int)strlen(out_path);
+    char path[MAX_SIZE];
+    for (int k=0; k<count; k++) {
+        if (snprintf(path, sizeof(path), "%.*s.%s%d%s", stem, out_path, suffix, first + k,
+                     out_path + stem) >= (int)sizeof(path)) {
+            fprintf(stderr, "Error: write_numbered: File name for '%s' is too long\n", out_path);
+            return -1;
+        }
+        band_writer writer;
+        if (open_writer(&writer, path, format, &imgs[k]) < 0)
+            return -1;
+        write_band(&writer, 0, imgs[k].height);
+        if (close_writer(&writer) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* writer thread: pops bands in order until it sees the stop band */
+static void *writer_main(void *arg) {
+    band_writer *w = arg;
+    while (true) {
+        size_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+        while (head == atomic_load_explicit(&w->tail, memory_order_acquire))
+            sched_yield();  // nothing finished yet
+        band b = w->queue[head % WRITER_QUEUE_SIZE];
+        atomic_store_explicit(&w->head, head + 1, memory_order_release);
+        if (b.y0 < 0)
+            break;
+        write_band(w, b.y0, b.y1);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the writer thread
+ * @param w - open writer
+ */
+void start_writer(band_writer *w) {
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        fprintf(stderr, "Error: start_writer: Failed to start writer thread\n");
+        exit(1);
+    }
+}
+
+/**
+ * Hands finished rows to the writer thread. Blocks while the queue is full
+ * @param w - running writer
+ * @param y0 - first finished row
+ * @param y1 - one past the last finished row
+ */
+void push_band(band_writer *w, int y0, int y1) {
+    size_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&w->head, memory_order_acquire) == WRITER_QUEUE_SIZE)
+        sched_yield();  // writer is behind, let it catch up
+    w->queue[tail % WRITER_QUEUE_SIZE].y0 = y0;
+    w->queue[tail % WRITER_QUEUE_SIZE].y1 = y1;
+    atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * Waits for the writer thread to write everything that was pushed and closes the file
+ * @param w - running writer
+ * @return 0 on success, -1 if anything failed to write
+ */
+int finish_writer(band_writer *w) {
+    push_band(w, -1, -1);
+    pthread_join(w->thread, NULL);
+    return close_writer(w);
+}
+
+/* band callback for raycast_scene_bands, arg is the running band_writer */
+void band_done(int y0, int y1, void *arg) {
+    push_band((band_writer*)arg, y0, y1);
+}